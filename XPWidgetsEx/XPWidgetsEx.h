@@ -1,6 +1,12 @@
 #include <XPLMDataAccess.h>
 #include <XPWidgets.h>
+#if IBM
 #include <gl/GL.h>
+#elif APL
+#include <OpenGL/gl.h>
+#else
+#include <GL/gl.h>
+#endif
 /************************************************************************
  *  X-PLANE UI INFRASTRUCTURE CODE
  ************************************************************************
@@ -0,0 +1,148 @@
+#include <XPLMUtilities.h>
+#include <format>
+#include <iterator>
+#include "baud.hpp"
+#include "serial.hpp"
+#include "protocol.hpp"
+#include "config.hpp"
+
+namespace Baud {
+    enum class State {
+        Idle,
+        Offered,
+        Switching,
+        Testing,
+        Done
+    };
+    const uint32_t rates[] = BAUD_RATES;
+    State state = State::Idle;
+    // next rate in rates to offer
+    size_t candidate = 0;
+    uint32_t target = 0;
+    // time in the current state
+    float timer = 0;
+    // wait before the next offer, the autopilot may still be on the old rate
+    float hold = 0;
+    // since the last valid frame
+    float silence = 0;
+    uint8_t sent = 0;
+    void Enter(State next);
+    void Fail(const std::string &why);
+}
+
+bool Baud::IsEnabled() {
+    return Protocol::Version() >= 2 && (Protocol::Features() & FEATURE_BAUD) && Serial::HasBaudRate();
+}
+
+bool Baud::IsSettled() {
+    return !IsEnabled() || state == State::Done || (state == State::Idle && candidate >= std::size(rates));
+}
+
+void Baud::Reset(unsigned int start) {
+    state = State::Idle;
+    candidate = 0;
+    while (start != 0 && candidate < std::size(rates) && rates[candidate] > start) {
+        candidate++;
+    }
+    target = 0;
+    timer = 0;
+    hold = 0;
+    silence = 0;
+    sent = 0;
+}
+
+size_t Baud::Poll(float dt, baud_test_t &msg) {
+    if (!IsEnabled()) { return 0; }
+    timer += dt;
+    silence += dt;
+    // the autopilot went back on its own, or the link stopped working at this rate
+    if (Serial::GetBaudRate() != BAUD_RATE && silence > BAUD_TIMEOUT) {
+        Fail("nothing received");
+        return 0;
+    }
+    switch (state) {
+    case State::Idle:
+        if (candidate >= std::size(rates) || timer < hold) { return 0; }
+        target = rates[candidate];
+        msg.msg = { target, BAUD_OFFER, 0 };
+        Enter(State::Offered);
+        return sizeof(msg.msg);
+    case State::Offered:
+        // taken as a refusal
+        if (timer > BAUD_TIMEOUT) {
+            candidate++;
+            Enter(State::Idle);
+        }
+        return 0;
+    case State::Switching:
+        if (Serial::IsChangingBaudRate()) { return 0; }
+        if (Serial::GetBaudRate() != target) {
+            Fail("not supported by the port");
+            return 0;
+        }
+        sent = 0;
+        silence = 0;
+        Enter(State::Testing);
+        [[fallthrough]];
+    case State::Testing:
+        if (sent < BAUD_TEST_FRAMES) {
+            msg.msg = { target, BAUD_TEST, sent };
+            Pattern(sent, msg.pattern);
+            sent++;
+            return sizeof(msg);
+        }
+        if (timer > BAUD_TIMEOUT) {
+            Fail("no test result");
+        }
+        return 0;
+    case State::Done:
+        return 0;
+    }
+    return 0;
+}
+
+void Baud::OnMessage(const baud_msg_t &msg) {
+    if (msg.stage == BAUD_ACCEPT && state == State::Offered) {
+        if (msg.baud != target) {
+            candidate++;
+            Enter(State::Idle);
+            return;
+        }
+        Serial::SetBaudRate(target);
+        Enter(State::Switching);
+    } else if (msg.stage == BAUD_RESULT && state == State::Testing && msg.baud == target) {
+        if (msg.count < BAUD_TEST_FRAMES) {
+            Fail(std::format("{} of {} test frames arrived", msg.count, BAUD_TEST_FRAMES));
+            return;
+        }
+        Enter(State::Done);
+        Config::SetBaudRate(target);
+        XPLMDebugString(std::format("HITL: Serial link switched to {} baud\n", target).c_str());
+    }
+}
+
+void Baud::OnFrame() {
+    silence = 0;
+}
+
+// Runs of zeros and of every other byte value, so COBS and the UART both get exercised
+void Baud::Pattern(uint8_t index, uint8_t *dest) {
+    for (int i = 0; i < BAUD_TEST_SIZE; i++) {
+        dest[i] = i % 16 < 4 ? 0 : static_cast<uint8_t>(index * 37 + i * 11);
+    }
+}
+
+void Baud::Enter(State next) {
+    state = next;
+    timer = 0;
+}
+
+// Back to the starting rate and on to the next one down
+void Baud::Fail(const std::string &why) {
+    XPLMDebugString(std::format("HITL: {} baud failed, {}\n", target, why).c_str());
+    Serial::SetBaudRate(BAUD_RATE);
+    candidate++;
+    hold = 2 * BAUD_TIMEOUT;
+    silence = 0;
+    Enter(State::Idle);
+}
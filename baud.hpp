@@ -0,0 +1,57 @@
+#pragma once
+#include <cstdint>
+
+// Serial speed negotiation. Links open at BAUD_RATE, once FEATURE_BAUD is agreed the plug-in
+// offers the fastest rate it has not ruled out yet. The autopilot accepts it, or refuses with 0,
+// and both sides switch. The plug-in then sends BAUD_TEST_FRAMES test frames and the autopilot
+// reports how many arrived intact, the rate is kept only if all of them did. Otherwise both go
+// back to BAUD_RATE and the next rate down is tried.
+// Away from BAUD_RATE either side falls back to it on its own after BAUD_TIMEOUT without a valid frame
+
+// Offered in this order
+#define BAUD_RATES { 2000000, 1500000, 921600, 460800, 230400 }
+#define BAUD_TEST_FRAMES 16
+// test frames are about as long as the longest telemetry frame
+#define BAUD_TEST_SIZE 192
+#define BAUD_TIMEOUT 1.0f // s
+
+enum BAUD_STAGE : uint8_t {
+    BAUD_OFFER, // plug-in
+    BAUD_ACCEPT, // autopilot, baud is 0 if refused
+    BAUD_TEST, // plug-in, count is the index of the frame and the pattern follows
+    BAUD_RESULT // autopilot, count is how many test frames arrived
+};
+
+#pragma pack(push, 1)
+struct baud_msg_t {
+    uint32_t baud;
+    uint8_t stage;
+    uint8_t count;
+};
+
+struct baud_test_t {
+    baud_msg_t msg;
+    uint8_t pattern[BAUD_TEST_SIZE];
+};
+#pragma pack(pop)
+
+static_assert(sizeof(baud_msg_t) == 6);
+static_assert(sizeof(baud_test_t) == 6 + BAUD_TEST_SIZE);
+
+namespace Baud {
+    // Whether both sides agreed on FEATURE_BAUD over a serial link
+    bool IsEnabled();
+    // A rate was agreed or there is none left to offer, the speed won't change on its own
+    bool IsSettled();
+    // New link, rates faster than start are not offered, 0 offers them all
+    void Reset(unsigned int start = 0);
+    // Called every frame while connected, fills in the next message to send and returns its
+    // size, 0 when there is nothing to send right now
+    size_t Poll(float dt, baud_test_t &msg);
+    // BAUD from the autopilot
+    void OnMessage(const baud_msg_t &msg);
+    // Any valid frame from the autopilot
+    void OnFrame();
+    // Test frame contents, the same on both sides
+    void Pattern(uint8_t index, uint8_t *dest);
+}
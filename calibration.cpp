@@ -11,22 +11,22 @@
 #include "calibration.hpp"
 #include "util.hpp"
 #include "ui.hpp"
+#include "datarefs.hpp"
 
 namespace Calibration {
     namespace DataRef {
-        XPLMDataRef physics = XPLMFindDataRef("sim/operation/override/override_planepath");
-        XPLMDataRef x = XPLMFindDataRef("sim/flightmodel/position/local_x");
-        XPLMDataRef y = XPLMFindDataRef("sim/flightmodel/position/local_y");
-        XPLMDataRef z = XPLMFindDataRef("sim/flightmodel/position/local_z");
-        XPLMDataRef vx = XPLMFindDataRef("sim/flightmodel/position/local_vx");
-        XPLMDataRef vy = XPLMFindDataRef("sim/flightmodel/position/local_vy");
-        XPLMDataRef vz = XPLMFindDataRef("sim/flightmodel/position/local_vz");
-        XPLMDataRef yaw = XPLMFindDataRef("sim/flightmodel/position/psi");
-        XPLMDataRef quat = XPLMFindDataRef("sim/flightmodel/position/q");
-        XPLMDataRef P = XPLMFindDataRef("sim/flightmodel/position/P");
-        XPLMDataRef Q = XPLMFindDataRef("sim/flightmodel/position/Q");
-        XPLMDataRef R = XPLMFindDataRef("sim/flightmodel/position/R");
-        XPLMDataRef semilen = XPLMFindDataRef("sim/aircraft/parts/acf_semilen_JND");
+        dataref_t x{ "sim/flightmodel/position/local_x", xplmType_Double };
+        dataref_t y{ "sim/flightmodel/position/local_y", xplmType_Double };
+        dataref_t z{ "sim/flightmodel/position/local_z", xplmType_Double };
+        dataref_t vx{ "sim/flightmodel/position/local_vx", xplmType_Float };
+        dataref_t vy{ "sim/flightmodel/position/local_vy", xplmType_Float };
+        dataref_t vz{ "sim/flightmodel/position/local_vz", xplmType_Float };
+        dataref_t yaw{ "sim/flightmodel/position/psi", xplmType_Float };
+        dataref_t quat{ "sim/flightmodel/position/q", xplmType_FloatArray };
+        dataref_t P{ "sim/flightmodel/position/P", xplmType_Float };
+        dataref_t Q{ "sim/flightmodel/position/Q", xplmType_Float };
+        dataref_t R{ "sim/flightmodel/position/R", xplmType_Float };
+        dataref_t semilen{ "sim/aircraft/parts/acf_semilen_JND", xplmType_FloatArray };
     }
     namespace Saved {
         Eigen::Vector3d pos;
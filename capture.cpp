@@ -0,0 +1,154 @@
+#include <XPLMUtilities.h>
+#include <atomic>
+#include <chrono>
+#include <format>
+#include <cstring>
+#include "capture.hpp"
+#include "logfile.hpp"
+#include "timesync.hpp"
+
+// https://www.ietf.org/archive/id/draft-ietf-opsawg-pcapng-01.html
+#define PCAPNG_SECTION_HEADER 0x0A0D0D0A
+#define PCAPNG_BYTE_ORDER_MAGIC 0x1A2B3C4D
+#define PCAPNG_INTERFACE_DESCRIPTION 1
+#define PCAPNG_ENHANCED_PACKET 6
+#define PCAPNG_OPT_ENDOFOPT 0
+#define PCAPNG_OPT_EPB_FLAGS 2
+#define PCAPNG_FLAG_INBOUND 1
+#define PCAPNG_FLAG_OUTBOUND 2
+
+namespace Capture {
+#pragma pack(push, 1)
+    struct section_header_t {
+        uint32_t type = PCAPNG_SECTION_HEADER;
+        uint32_t length = sizeof(section_header_t);
+        uint32_t byte_order = PCAPNG_BYTE_ORDER_MAGIC;
+        uint16_t major = 1;
+        uint16_t minor = 0;
+        // not known while writing
+        int64_t section_length = -1;
+        uint32_t length_again = sizeof(section_header_t);
+    };
+    // timestamps are in microseconds, the default resolution
+    struct interface_t {
+        uint32_t type = PCAPNG_INTERFACE_DESCRIPTION;
+        uint32_t length = sizeof(interface_t);
+        uint16_t link_type = CAPTURE_LINKTYPE;
+        uint16_t reserved = 0;
+        uint32_t snap_length = 0;
+        uint32_t length_again = sizeof(interface_t);
+    };
+    // followed by the bytes padded to 32 bits, then packet_trailer_t
+    struct packet_t {
+        uint32_t type;
+        uint32_t length;
+        uint32_t interface_id;
+        uint32_t time_high;
+        uint32_t time_low;
+        uint32_t captured;
+        uint32_t original;
+    };
+    struct packet_trailer_t {
+        uint16_t flags_code;
+        uint16_t flags_length;
+        uint32_t flags;
+        uint16_t end_code;
+        uint16_t end_length;
+        uint32_t length;
+    };
+#pragma pack(pop)
+    logfile_t log;
+    std::atomic<bool> capturing = false;
+    // the rest is filled under log.lock
+    capture_stats_t stats;
+    // Timesync::Now() and the wall clock when the capture started, blocks are stamped on the wall clock
+    uint64_t start_us;
+    int64_t unix_us;
+    void Add(uint32_t flags, const uint8_t *data, size_t bytes);
+}
+
+bool Capture::Start() {
+    using namespace std::chrono;
+    if (LogFile::IsRunning(log)) { return true; }
+    if (!LogFile::Open(log, "pcapng")) { return false; }
+    section_header_t section;
+    interface_t link;
+    LogFile::Write(log, &section, sizeof(section));
+    LogFile::Write(log, &link, sizeof(link));
+    {
+        std::lock_guard guard(log.lock);
+        stats = { 0, 0, sizeof(section) + sizeof(link) };
+        start_us = Timesync::Now();
+        unix_us = duration_cast<microseconds>(log.opened.time_since_epoch()).count();
+        capturing = true;
+    }
+    LogFile::Start(log);
+    XPLMDebugString(std::format("HITL: Capturing the link to {}\n", log.path.string()).c_str());
+    return true;
+}
+
+void Capture::Stop() {
+    if (!LogFile::IsRunning(log)) { return; }
+    {
+        std::lock_guard guard(log.lock);
+        capturing = false;
+    }
+    LogFile::Stop(log);
+    LogFile::Close(log);
+    capture_stats_t last = GetStats();
+    XPLMDebugString(std::format("HITL: Captured {} reads and writes, {} bytes to {}{}{}\n", last.chunks, last.bytes, log.path.string(),
+        last.dropped ? std::format(", {} dropped", last.dropped) : "", log.failed ? ", the file could not be written" : "").c_str());
+}
+
+bool Capture::IsCapturing() {
+    return capturing;
+}
+
+std::string Capture::GetPath() {
+    return log.path.string();
+}
+
+capture_stats_t Capture::GetStats() {
+    std::lock_guard guard(log.lock);
+    return stats;
+}
+
+void Capture::Sent(const uint8_t *data, size_t bytes) {
+    Add(PCAPNG_FLAG_OUTBOUND, data, bytes);
+}
+
+void Capture::Received(const uint8_t *data, size_t bytes) {
+    Add(PCAPNG_FLAG_INBOUND, data, bytes);
+}
+
+// One enhanced packet block per chunk, built in place in the buffer
+void Capture::Add(uint32_t flags, const uint8_t *data, size_t bytes) {
+    if (!capturing.load(std::memory_order_relaxed) || bytes == 0) { return; }
+    uint64_t now = Timesync::Now();
+    size_t padded = (bytes + 3) & ~static_cast<size_t>(3);
+    size_t size = sizeof(packet_t) + padded + sizeof(packet_trailer_t);
+    bool half;
+    {
+        std::lock_guard guard(log.lock);
+        if (!capturing) { return; }
+        uint8_t *block = LogFile::Reserve(log, size);
+        if (!block) {
+            stats.dropped++;
+            return;
+        }
+        uint64_t time = static_cast<uint64_t>(unix_us) + (now - start_us);
+        packet_t packet = { PCAPNG_ENHANCED_PACKET, static_cast<uint32_t>(size), 0,
+            static_cast<uint32_t>(time >> 32), static_cast<uint32_t>(time), static_cast<uint32_t>(bytes), static_cast<uint32_t>(bytes) };
+        packet_trailer_t trailer = { PCAPNG_OPT_EPB_FLAGS, sizeof(uint32_t), flags, PCAPNG_OPT_ENDOFOPT, 0, static_cast<uint32_t>(size) };
+        memcpy(block, &packet, sizeof(packet));
+        memcpy(block + sizeof(packet), data, bytes);
+        memset(block + sizeof(packet) + bytes, 0, padded - bytes);
+        memcpy(block + sizeof(packet) + padded, &trailer, sizeof(trailer));
+        half = LogFile::Commit(log, size);
+        stats.chunks++;
+        stats.bytes += size;
+    }
+    if (half) {
+        LogFile::Wake(log);
+    }
+}
@@ -0,0 +1,30 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include <string>
+
+// Raw link capture. The I/O thread adds every chunk it reads from or writes to the link,
+// stamped with when it did, as a pcapng block to a log file (see logfile.hpp). Bytes are
+// kept as they crossed the link, frames split over reads or writes stay split
+// LINKTYPE_USER0, Wireshark shows the bytes as data unless a dissector is given for
+// it in the DLT_USER preferences
+#define CAPTURE_LINKTYPE 147
+
+struct capture_stats_t {
+    // reads and writes captured, and the ones left out because the writer fell behind
+    uint64_t chunks;
+    uint64_t dropped;
+    uint64_t bytes;
+};
+
+namespace Capture {
+    // Start a new .pcapng file, false if it could not be created
+    bool Start();
+    void Stop();
+    bool IsCapturing();
+    std::string GetPath();
+    capture_stats_t GetStats();
+    // Called by the I/O thread right after each write and read that moved bytes
+    void Sent(const uint8_t *data, size_t bytes);
+    void Received(const uint8_t *data, size_t bytes);
+}
@@ -0,0 +1,127 @@
+#pragma once
+#include <cstdint>
+#include <cmath>
+#include <algorithm>
+#include <limits>
+
+// Compact sensor encoding, used when the autopilot accepts it during protocol negotiation.
+// Every layout is packed little endian with values stored as scaled integers.
+
+// LSB per unit of each scaled field
+#define ACCEL_SCALE 200.0f // m/s/s, +-163 m/s/s
+#define GYRO_SCALE 900.0f // rad/s, +-36 rad/s
+#define QUAT_SCALE 32767.0f
+#define MAG_SCALE 10000.0f
+#define PRESSURE_SCALE 100.0f // Pa, unsigned 24 bit
+#define DIFF_PRESSURE_SCALE 2.0f // Pa
+#define TEMPERATURE_SCALE 100.0f // degC
+#define VELOCITY_SCALE 100.0f // m/s
+#define ACCURACY_SCALE 100.0f
+#define THROTTLE_SCALE 10000.0f
+// A full GPS fix is sent every this many messages, the rest are deltas from the previous one
+#define GPS_KEYFRAME_PERIOD 10
+// EFI is only sent on change, but at least this often (s)
+#define EFI_KEEPALIVE 1.0f
+
+#pragma pack(push, 1)
+struct uint24_t {
+    uint8_t bytes[3];
+};
+
+struct imu_compact_t {
+    // low 16 bits of the sample time, unwrapped by the receiver (microseconds)
+    uint16_t time_us;
+    int16_t accel[3];
+    int16_t gyro[3];
+};
+
+// attitude is sent on its own and slower than the IMU in compact mode
+struct attitude_compact_t {
+    int16_t quat[4];
+};
+
+struct baro_compact_t {
+    uint8_t instance;
+    uint24_t pressure;
+    int16_t temperature;
+};
+
+struct mag_compact_t {
+    int16_t field[3];
+};
+
+struct gps_compact_t {
+    uint16_t gps_week;
+    uint32_t ms_tow;
+    uint8_t fix_type;
+    uint8_t satellites_in_view;
+    uint16_t horizontal_pos_accuracy;
+    uint16_t vertical_pos_accuracy;
+    uint16_t horizontal_vel_accuracy;
+    uint16_t hdop;
+    uint16_t vdop;
+    int32_t longitude;
+    int32_t latitude;
+    int32_t msl_altitude;
+    int16_t ned_vel[3];
+};
+
+// position relative to the previous GPS message
+struct gps_delta_t {
+    uint32_t ms_tow;
+    int16_t longitude;
+    int16_t latitude;
+    int16_t msl_altitude;
+    int16_t ned_vel[3];
+};
+
+struct airspeed_compact_t {
+    int16_t differential_pressure;
+    int16_t temperature;
+};
+
+// only the fields the plug-in fills, everything else is not supported
+struct efi_compact_t {
+    uint8_t engine_state;
+    uint8_t engine_load_percent;
+    uint16_t engine_speed_rpm;
+    uint8_t throttle_position_percent;
+    uint16_t throttle_out;
+    float estimated_consumed_fuel_volume_cm3;
+    float fuel_consumption_rate_cm3pm;
+};
+#pragma pack(pop)
+
+static_assert(sizeof(uint24_t) == 3);
+static_assert(sizeof(imu_compact_t) == 14);
+static_assert(sizeof(attitude_compact_t) == 8);
+static_assert(sizeof(baro_compact_t) == 6);
+static_assert(sizeof(mag_compact_t) == 6);
+static_assert(sizeof(gps_compact_t) == 36);
+static_assert(sizeof(gps_delta_t) == 16);
+static_assert(sizeof(airspeed_compact_t) == 4);
+static_assert(sizeof(efi_compact_t) == 15);
+
+// Round and saturate to the integer type
+template<typename T>
+T ToFixed(float value, float scale) {
+    float scaled = std::round(value * scale);
+    scaled = std::clamp(scaled,
+        static_cast<float>(std::numeric_limits<T>::min()),
+        static_cast<float>(std::numeric_limits<T>::max()));
+    return static_cast<T>(scaled);
+}
+
+inline uint24_t ToFixed24(float value, float scale) {
+    uint32_t fixed = static_cast<uint32_t>(std::clamp(std::round(value * scale), 0.0f, 16777215.0f));
+    return { {
+        static_cast<uint8_t>(fixed),
+        static_cast<uint8_t>(fixed >> 8),
+        static_cast<uint8_t>(fixed >> 16)
+    } };
+}
+
+inline float FromFixed24(uint24_t value, float scale) {
+    uint32_t fixed = value.bytes[0] | (value.bytes[1] << 8) | (value.bytes[2] << 16);
+    return fixed / scale;
+}
@@ -0,0 +1,120 @@
+#include <XPLMPlugin.h>
+#include <XPLMUtilities.h>
+#include <filesystem>
+#include <fstream>
+#include <format>
+#include <string>
+#include <atomic>
+#include <mutex>
+#include <cstdlib>
+#include "config.hpp"
+
+namespace Config {
+    config_t config;
+    // taken by the setters and to copy the settings for saving, never while writing the file
+    std::mutex lock;
+    std::atomic<bool> dirty = false;
+    // found by Load, the XPLM API is only called from the sim thread
+    std::filesystem::path path;
+    void Changed();
+}
+
+std::filesystem::path Config::Folder() {
+    char file[512] = {};
+    XPLMGetPluginInfo(XPLMGetMyID(), nullptr, file, nullptr, nullptr);
+    std::filesystem::path folder = std::filesystem::path(file).parent_path();
+    if (folder.filename() == "32" || folder.filename() == "64") {
+        folder = folder.parent_path();
+    }
+    return folder;
+}
+
+void Config::Load() {
+    config = {};
+    path = Folder() / CONFIG_FILE;
+    std::ifstream file(path);
+    std::string line;
+    while (std::getline(file, line)) {
+        size_t equals = line.find('=');
+        if (equals == std::string::npos) { continue; }
+        std::string key = line.substr(0, equals);
+        std::string value = line.substr(equals + 1);
+        if (key == "address") {
+            config.address = value;
+        } else if (key == "port") {
+            config.port = value;
+        } else if (key == "baud") {
+            config.baud = static_cast<unsigned int>(std::strtoul(value.c_str(), nullptr, 10));
+        } else if (key == "version") {
+            config.version = std::atoi(value.c_str());
+        } else if (key == "features") {
+            config.features = static_cast<uint8_t>(std::atoi(value.c_str()));
+        } else if (key == "low_latency") {
+            config.low_latency = value == "1";
+        }
+    }
+}
+
+const config_t &Config::Get() {
+    return config;
+}
+
+void Config::SetAddress(const std::string &address) {
+    if (address == config.address) { return; }
+    std::lock_guard guard(lock);
+    config.address = address;
+    Changed();
+}
+
+void Config::SetPort(const std::string &port) {
+    if (port == config.port) { return; }
+    std::lock_guard guard(lock);
+    config.port = port;
+    config.baud = 0;
+    config.version = 1;
+    config.features = 0;
+    Changed();
+}
+
+void Config::SetBaudRate(unsigned int baud) {
+    if (baud == config.baud) { return; }
+    std::lock_guard guard(lock);
+    config.baud = baud;
+    Changed();
+}
+
+void Config::SetProtocol(int version, uint8_t features) {
+    if (version == config.version && features == config.features) { return; }
+    std::lock_guard guard(lock);
+    config.version = version;
+    config.features = features;
+    Changed();
+}
+
+void Config::SetLowLatency(bool state) {
+    if (state == config.low_latency) { return; }
+    std::lock_guard guard(lock);
+    config.low_latency = state;
+    Changed();
+}
+
+// Called under the lock
+void Config::Changed() {
+    dirty.store(true, std::memory_order_release);
+}
+
+void Config::Save() {
+    if (!dirty.load(std::memory_order_acquire)) { return; }
+    config_t saved;
+    {
+        std::lock_guard guard(lock);
+        saved = config;
+        dirty = false;
+    }
+    std::ofstream file(path, std::ios::trunc);
+    file << std::format("address={}\nport={}\nbaud={}\nversion={}\nfeatures={}\nlow_latency={}\n",
+        saved.address, saved.port, saved.baud, saved.version, saved.features, saved.low_latency ? 1 : 0);
+    if (!file) {
+        XPLMDebugString(std::format("HITL: Could not save {}\n", path.string()).c_str());
+    }
+}
@@ -0,0 +1,37 @@
+#pragma once
+#include <string>
+#include <filesystem>
+#include <cstdint>
+
+// Link settings kept across sessions, one key=value per line in a file next to the plug-in
+#define CONFIG_FILE "hitl.cfg"
+
+struct config_t {
+    // fixed link typed in the settings window, empty to scan the serial ports
+    std::string address;
+    // serial port the autopilot last answered on, tried first when scanning
+    std::string port;
+    // what was agreed on that port, the next link starts from it
+    unsigned int baud = 0;
+    int version = 1;
+    uint8_t features = 0;
+    bool low_latency = false;
+};
+
+namespace Config {
+    // Next to the plug-in binary, above the 32/64 folder of fat plug-ins
+    std::filesystem::path Folder();
+    // Read the file, missing keys keep their defaults
+    void Load();
+    const config_t &Get();
+    // Called from the sim thread, each one marks the file for saving if the value changed
+    void SetAddress(const std::string &address);
+    // A different port forgets what was agreed on the last one
+    void SetPort(const std::string &port);
+    void SetBaudRate(unsigned int baud);
+    void SetProtocol(int version, uint8_t features);
+    void SetLowLatency(bool state);
+    // Write the file if anything changed since the last time, never on the sim thread while
+    // a link is up. The serial I/O thread calls it, and so does closing the link
+    void Save();
+}
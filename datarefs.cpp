@@ -0,0 +1,53 @@
+#include <XPLMDataAccess.h>
+#include <XPLMUtilities.h>
+#include <vector>
+#include <format>
+#include "datarefs.hpp"
+
+namespace DataRefs {
+    // function statics, registration runs from other files' static initializers
+    std::vector<dataref_t *> &Registered() {
+        static std::vector<dataref_t *> datarefs;
+        return datarefs;
+    }
+    std::vector<command_t *> &RegisteredCommands() {
+        static std::vector<command_t *> commands;
+        return commands;
+    }
+}
+
+dataref_t::dataref_t(const char *name, XPLMDataTypeID type) : name(name), type(type) {
+    DataRefs::Registered().push_back(this);
+}
+
+command_t::command_t(const char *name) : name(name) {
+    DataRefs::RegisteredCommands().push_back(this);
+}
+
+int DataRefs::Resolve() {
+    int problems = 0;
+    for (dataref_t *dataref : Registered()) {
+        dataref->ref = XPLMFindDataRef(dataref->name);
+        if (!dataref->ref) {
+            XPLMDebugString(std::format("HITL: Missing dataref {}\n", dataref->name).c_str());
+            problems++;
+            continue;
+        }
+        XPLMDataTypeID type = XPLMGetDataRefTypes(dataref->ref);
+        if (!(type & dataref->type)) {
+            XPLMDebugString(std::format("HITL: Dataref {} is of type {:#x}, expected {:#x}\n",
+                dataref->name, type, dataref->type).c_str());
+            problems++;
+        }
+    }
+    for (command_t *command : RegisteredCommands()) {
+        command->ref = XPLMFindCommand(command->name);
+        if (!command->ref) {
+            XPLMDebugString(std::format("HITL: Missing command {}\n", command->name).c_str());
+            problems++;
+        }
+    }
+    XPLMDebugString(std::format("HITL: Resolved {} datarefs and {} commands, {} problems\n",
+        Registered().size(), RegisteredCommands().size(), problems).c_str());
+    return problems;
+}
@@ -0,0 +1,31 @@
+#pragma once
+#include <XPLMDataAccess.h>
+#include <XPLMUtilities.h>
+
+// Entries in the per engine array datarefs
+#define ENGINE_COUNT 8
+
+// Datarefs and commands register their names while the plug-in is loaded and
+// are looked up together at XPluginStart. Until then they convert to NULL,
+// which X-Plane ignores on reads and writes.
+struct dataref_t {
+    dataref_t(const char *name, XPLMDataTypeID type);
+    operator XPLMDataRef() const { return ref; }
+    const char *name;
+    // any of these types is accepted
+    XPLMDataTypeID type;
+    XPLMDataRef ref = nullptr;
+};
+
+struct command_t {
+    command_t(const char *name);
+    operator XPLMCommandRef() const { return ref; }
+    const char *name;
+    XPLMCommandRef ref = nullptr;
+};
+
+namespace DataRefs {
+    // Find every registered dataref and command, reports the missing ones and
+    // the datarefs of an unexpected type. Returns how many were reported
+    int Resolve();
+}
@@ -0,0 +1,225 @@
+#include <serialib.h>
+#include <string>
+#include <format>
+#include <optional>
+#include <stop_token>
+#include "discovery.hpp"
+#include "serial.hpp"
+
+#if defined (__linux__)
+#include <vector>
+#include <chrono>
+#include <filesystem>
+#include <cerrno>
+#include <climits>
+#include <cstdlib>
+#include <fcntl.h>
+#include <poll.h>
+#include <termios.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/inotify.h>
+#endif
+
+#define SCAN_TIMEOUT 3000
+#define SCAN_MAXBYTES 200
+// how long the Linux scanner waits for data before checking for new ports (ms)
+#define SCAN_POLL_TIMEOUT 250
+#define SCAN_ENUMERATE_PERIOD std::chrono::seconds(1)
+// longest a probe waits for bytes before checking for a stop request (ms)
+#define PROBE_READ_TIMEOUT 50
+
+namespace Discovery {
+    char ping_msg[] = "PINGHITLPINGHITLPING";
+    // Advance the ping matcher by one byte, true once the whole ping was seen
+    bool Match(int &pos, char c);
+}
+
+bool Discovery::Match(int &pos, char c) {
+    if (c == ping_msg[pos]) { pos++; } else { pos = 0; };
+    if (pos == sizeof(ping_msg)) {
+        pos = 0;
+        return true;
+    }
+    return false;
+}
+
+bool Discovery::Probe(const std::string &port, unsigned int timeout, std::stop_token stop) {
+    serialib serial;
+    if (serial.openDevice(port.c_str(), BAUD_RATE) != 1) { return false; }
+    serial.setDTR();
+    serial.clearRTS();
+    timeOut timer;
+    timer.initTimer();
+    int pos = 0;
+    char bytes[SCAN_MAXBYTES];
+    while (!stop.stop_requested() && timer.elapsedTime_ms() < timeout) {
+        int n = serial.readBytes(bytes, sizeof(bytes), PROBE_READ_TIMEOUT);
+        if (n < 0) { break; }
+        for (int i = 0; i < n; i++) {
+            if (Match(pos, bytes[i])) { return true; }
+        }
+    }
+    return false;
+}
+
+#if defined (_WIN32) || defined (_WIN64)
+
+// Probe COM ports one at a time
+std::optional<std::string> Discovery::Find(std::stop_token stop) {
+    int i = 0;
+    while (true) {
+        i++;
+        if (i > MAX_SERIAL_PORTS) { i = 1; }
+        if (stop.stop_requested()) { return std::optional<std::string>(); }
+        // Attempt connection
+        serialib temp_serial;
+        std::string device = std::format("\\\\.\\COM{}", i);
+        if (temp_serial.openDevice(device.c_str(), BAUD_RATE) != 1) { continue; }
+        temp_serial.setDTR();
+        temp_serial.clearRTS();
+        // Scan for header
+        char c;
+        int pos = 0;
+        int bytes_read = 0;
+        while (bytes_read < SCAN_MAXBYTES && temp_serial.readBytes(&c, 1, SCAN_TIMEOUT) == 1) {
+            bytes_read++;
+            if (Match(pos, c)) {
+                // Header found, return device name
+                temp_serial.closeDevice();
+                return std::optional<std::string>(device);
+            }
+        }
+    }
+}
+
+#elif defined (__linux__)
+
+namespace Discovery {
+    struct candidate_t {
+        std::string path;
+        // resolved device node, the same port can show up under several names
+        std::string device;
+        int fd;
+        int pos;
+    };
+    int Open(const std::string &path);
+    void Enumerate(std::vector<candidate_t> &candidates);
+}
+
+// Open a port without blocking, raw at the link baud rate
+int Discovery::Open(const std::string &path) {
+    int fd = open(path.c_str(), O_RDWR | O_NOCTTY | O_NONBLOCK | O_CLOEXEC);
+    if (fd == -1) { return -1; }
+    termios options;
+    if (tcgetattr(fd, &options) != 0) {
+        close(fd);
+        return -1;
+    }
+    cfmakeraw(&options);
+    cfsetispeed(&options, B115200);
+    cfsetospeed(&options, B115200);
+    options.c_cflag |= CLOCAL | CREAD;
+    options.c_cc[VMIN] = 0;
+    options.c_cc[VTIME] = 0;
+    tcsetattr(fd, TCSANOW, &options);
+    // same line states the link uses, some boards only talk with DTR set
+    int dtr = TIOCM_DTR;
+    int rts = TIOCM_RTS;
+    ioctl(fd, TIOCMBIS, &dtr);
+    ioctl(fd, TIOCMBIC, &rts);
+    return fd;
+}
+
+// Open every port that showed up since the last call
+void Discovery::Enumerate(std::vector<candidate_t> &candidates) {
+    namespace fs = std::filesystem;
+    std::vector<std::string> paths;
+    std::error_code ec;
+    // stable names first so they are the ones reported
+    for (const fs::directory_entry &entry : fs::directory_iterator("/dev/serial/by-id", ec)) {
+        paths.push_back(entry.path().string());
+    }
+    for (const fs::directory_entry &entry : fs::directory_iterator("/dev", ec)) {
+        std::string name = entry.path().filename().string();
+        if (name.starts_with("ttyACM") || name.starts_with("ttyUSB")) {
+            paths.push_back(entry.path().string());
+        }
+    }
+    for (const std::string &path : paths) {
+        char resolved[PATH_MAX];
+        if (!realpath(path.c_str(), resolved)) { continue; }
+        bool known = false;
+        for (const candidate_t &candidate : candidates) {
+            known = known || candidate.device == resolved;
+        }
+        if (known) { continue; }
+        int fd = Open(path);
+        if (fd == -1) { continue; }
+        candidates.push_back({ path, resolved, fd, 0 });
+    }
+}
+
+// Watch every port at once, new ports are picked up as they are plugged in
+std::optional<std::string> Discovery::Find(std::stop_token stop) {
+    std::vector<candidate_t> candidates;
+    int notify = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (notify != -1) {
+        inotify_add_watch(notify, "/dev", IN_CREATE | IN_ATTRIB);
+        inotify_add_watch(notify, "/dev/serial/by-id", IN_CREATE);
+    }
+    std::optional<std::string> found;
+    auto last_enumerate = std::chrono::steady_clock::time_point{};
+    bool changed = true;
+    std::vector<pollfd> fds;
+    while (!found && !stop.stop_requested()) {
+        // without inotify fall back to enumerating periodically
+        auto now = std::chrono::steady_clock::now();
+        if (changed || now - last_enumerate > SCAN_ENUMERATE_PERIOD) {
+            Enumerate(candidates);
+            last_enumerate = now;
+            changed = false;
+        }
+        fds.clear();
+        for (const candidate_t &candidate : candidates) {
+            fds.push_back({ candidate.fd, POLLIN, 0 });
+        }
+        if (notify != -1) {
+            fds.push_back({ notify, POLLIN, 0 });
+        }
+        if (poll(fds.data(), fds.size(), SCAN_POLL_TIMEOUT) <= 0) { continue; }
+        if (notify != -1 && fds.back().revents & POLLIN) {
+            char events[4096];
+            while (read(notify, events, sizeof(events)) > 0) {}
+            changed = true;
+        }
+        for (size_t i = 0; i < candidates.size() && !found; i++) {
+            candidate_t &candidate = candidates[i];
+            if (fds[i].revents & POLLIN) {
+                char bytes[256];
+                ssize_t n = read(candidate.fd, bytes, sizeof(bytes));
+                for (ssize_t j = 0; j < n && !found; j++) {
+                    if (Match(candidate.pos, bytes[j])) {
+                        found = candidate.path;
+                    }
+                }
+                if (n > 0 || (n == -1 && errno == EAGAIN)) { continue; }
+            } else if (!(fds[i].revents & (POLLERR | POLLHUP | POLLNVAL))) {
+                continue;
+            }
+            // unplugged or failing, it is reopened if it comes back
+            close(candidate.fd);
+            candidate.fd = -1;
+        }
+        std::erase_if(candidates, [](const candidate_t &candidate) { return candidate.fd == -1; });
+    }
+    for (const candidate_t &candidate : candidates) {
+        close(candidate.fd);
+    }
+    if (notify != -1) {
+        close(notify);
+    }
+    return found;
+}
+
+#endif
@@ -0,0 +1,11 @@
+#pragma once
+#include <string>
+#include <optional>
+#include <stop_token>
+
+namespace Discovery {
+    // Block until a port sending the HITL ping is found, or stop is requested
+    std::optional<std::string> Find(std::stop_token stop);
+    // Look for the ping on a single port for up to timeout (ms)
+    bool Probe(const std::string &port, unsigned int timeout, std::stop_token stop);
+}
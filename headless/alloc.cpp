@@ -0,0 +1,65 @@
+#include <new>
+#include <cstdlib>
+#include <cstdint>
+#include <cstdio>
+#include <execinfo.h>
+#include <unistd.h>
+#include "headless.hpp"
+
+// Global operator new for the headless build, counts heap allocations per thread
+// so the flight loop can be checked for them
+
+#define ALLOC_TRACE_DEPTH 24
+
+namespace Headless {
+    thread_local uint64_t allocations = 0;
+    // print where the next allocations on this thread come from
+    thread_local int traces = 0;
+    void *Allocate(size_t size, size_t alignment);
+}
+
+uint64_t Headless::Allocations() {
+    return allocations;
+}
+
+void Headless::TraceAllocations(int count) {
+    // the first backtrace loads the unwinder, which allocates
+    void *frames[1];
+    backtrace(frames, 1);
+    traces = count;
+}
+
+void *Headless::Allocate(size_t size, size_t alignment) {
+    allocations++;
+    if (traces > 0) {
+        traces--;
+        void *frames[ALLOC_TRACE_DEPTH];
+        int depth = backtrace(frames, ALLOC_TRACE_DEPTH);
+        fprintf(stderr, "allocation of %zu bytes on the sim thread:\n", size);
+        backtrace_symbols_fd(frames, depth, STDERR_FILENO);
+    }
+    void *memory = alignment > alignof(std::max_align_t) ?
+        std::aligned_alloc(alignment, (size + alignment - 1) / alignment * alignment) :
+        std::malloc(size ? size : 1);
+    if (!memory) { throw std::bad_alloc(); }
+    return memory;
+}
+
+void *operator new(size_t size) { return Headless::Allocate(size, 0); }
+void *operator new[](size_t size) { return Headless::Allocate(size, 0); }
+void *operator new(size_t size, std::align_val_t alignment) { return Headless::Allocate(size, static_cast<size_t>(alignment)); }
+void *operator new[](size_t size, std::align_val_t alignment) { return Headless::Allocate(size, static_cast<size_t>(alignment)); }
+void *operator new(size_t size, const std::nothrow_t &) noexcept {
+    try { return Headless::Allocate(size, 0); } catch (...) { return nullptr; }
+}
+void *operator new[](size_t size, const std::nothrow_t &) noexcept {
+    try { return Headless::Allocate(size, 0); } catch (...) { return nullptr; }
+}
+void operator delete(void *memory) noexcept { std::free(memory); }
+void operator delete[](void *memory) noexcept { std::free(memory); }
+void operator delete(void *memory, size_t) noexcept { std::free(memory); }
+void operator delete[](void *memory, size_t) noexcept { std::free(memory); }
+void operator delete(void *memory, std::align_val_t) noexcept { std::free(memory); }
+void operator delete[](void *memory, std::align_val_t) noexcept { std::free(memory); }
+void operator delete(void *memory, size_t, std::align_val_t) noexcept { std::free(memory); }
+void operator delete[](void *memory, size_t, std::align_val_t) noexcept { std::free(memory); }
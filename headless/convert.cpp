@@ -0,0 +1,716 @@
+#include <chrono>
+#include <thread>
+#include <format>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <iterator>
+#include <memory>
+#include <algorithm>
+#include <filesystem>
+#include <cstdio>
+#include <cstring>
+#include <cstddef>
+#include <type_traits>
+#include "headless.hpp"
+#include "recording.hpp"
+#include "../messages.hpp"
+#include "../compact.hpp"
+#include "../remote.hpp"
+
+// Records are read this much at a time by each worker, the ones a chunk holds are
+// sorted by table and decoded before the next chunk is read
+#define CONVERT_CHUNK_SIZE (1024 * 1024)
+// Rows of each table are formatted into a buffer written out at this size
+#define CONVERT_FLUSH_SIZE (256 * 1024)
+// Compact IMU samples scaled together, as columns
+#define CONVERT_BATCH 1024
+// Each worker reads this far back for the last full GPS fix before its range, GPS
+// deltas are relative to it. About 30 s of a full rate v2 stream
+#define CONVERT_WARMUP (1024 * 1024)
+// Smaller ranges are not worth a thread of their own
+#define CONVERT_MIN_RANGE (4 * 1024 * 1024)
+
+namespace Headless {
+    enum TABLE {
+        IMU_TABLE,
+        ATTITUDE_TABLE,
+        BARO_TABLE,
+        MAG_TABLE,
+        GPS_TABLE,
+        AIRSPEED_TABLE,
+        EFI_TABLE,
+        PLANE_TABLE,
+        HELI_TABLE,
+        TABLE_COUNT
+    };
+    struct table_t {
+        const char *name;
+        const char *columns;
+    };
+    // time_us is the plug-in clock since the recording started
+    const table_t tables[TABLE_COUNT] = {
+        { "imu", "time_us,sample_us,accel_x,accel_y,accel_z,gyro_x,gyro_y,gyro_z,temperature" },
+        { "attitude", "time_us,q1,q2,q3,q4" },
+        { "baro", "time_us,instance,pressure_pa,temperature" },
+        { "mag", "time_us,field_x,field_y,field_z" },
+        { "gps", "time_us,gps_week,ms_tow,fix_type,satellites_in_view,latitude,longitude,msl_altitude,"
+            "ned_vel_north,ned_vel_east,ned_vel_down,horizontal_pos_accuracy,vertical_pos_accuracy,horizontal_vel_accuracy,hdop,vdop,delta" },
+        { "airspeed", "time_us,differential_pressure,temperature" },
+        { "efi", "time_us,engine_state,engine_load_percent,engine_speed_rpm,throttle_position_percent,throttle_out,"
+            "estimated_consumed_fuel_volume_cm3,fuel_consumption_rate_cm3pm" },
+        { "plane", "time_us,roll,pitch,yaw,throttle" },
+        { "heli", "time_us,roll_cyclic,pitch_cyclic,collective,tail,throttle" },
+    };
+    // A record of the chunk being decoded
+    struct entry_t {
+        record_t record;
+        const uint8_t *payload;
+    };
+    // One table of one worker, concatenated in range order at the end
+    struct part_t {
+        std::filesystem::path path;
+        std::ofstream file;
+        std::string buffer;
+        uint64_t rows;
+    };
+    // Compact IMU samples as columns
+    struct imu_batch_t {
+        int64_t time[CONVERT_BATCH];
+        int64_t sample[CONVERT_BATCH];
+        int16_t raw[6][CONVERT_BATCH];
+        float value[6][CONVERT_BATCH];
+    };
+    // Converts the records starting in [begin, end) of the file that are in [from_us, until_us)
+    struct worker_t {
+        uint64_t begin;
+        uint64_t end;
+        uint64_t start_us;
+        uint64_t from_us;
+        uint64_t until_us;
+        part_t parts[TABLE_COUNT];
+        std::vector<entry_t> buckets[TABLE_COUNT];
+        imu_batch_t batch;
+        // the last GPS position, kept up to date by deltas too
+        gps_compact_t gps;
+        bool has_gps;
+        uint64_t records;
+        // wrong size or a GPS delta without a fix before it
+        uint64_t undecoded;
+        bool truncated;
+    };
+    void Work(const std::string &path, uint64_t end, worker_t &worker);
+    void Route(worker_t &worker, const record_t &record, const uint8_t *payload, bool warmup);
+    void Decode(worker_t &worker);
+    void DecodeImu(worker_t &worker);
+    void DecodeImuBatch(worker_t &worker, size_t count);
+    void DecodeAttitude(worker_t &worker);
+    void DecodeBaro(worker_t &worker);
+    void DecodeMag(worker_t &worker);
+    void DecodeGps(worker_t &worker);
+    bool TrackGps(worker_t &worker, const record_t &record, const uint8_t *payload);
+    void DecodeAirspeed(worker_t &worker);
+    void DecodeEfi(worker_t &worker);
+    void DecodePwm(worker_t &worker, TABLE table, int channels);
+    void Flush(part_t &part);
+    template<typename... Args>
+    void Row(part_t &part, std::format_string<Args...> format, Args &&...args) {
+        std::format_to(std::back_inserter(part.buffer), format, std::forward<Args>(args)...);
+        part.rows++;
+        if (part.buffer.size() >= CONVERT_FLUSH_SIZE) {
+            Flush(part);
+        }
+    }
+    // The AP messages hold Eigen vectors, which are not trivially copyable, so they are
+    // put together member by member
+    template<typename T> requires std::is_trivially_copyable_v<T>
+    void Copy(const uint8_t *payload, size_t offset, T &member) {
+        memcpy(&member, payload + offset, sizeof(T));
+    }
+    void Copy(const uint8_t *payload, size_t offset, Eigen::Vector3f &member);
+    void Copy(const uint8_t *payload, size_t offset, AP::mag_data_message_t &msg);
+    void Copy(const uint8_t *payload, size_t offset, AP::ins_data_message_t &msg);
+    void Copy(const uint8_t *payload, size_t offset, imu_msg_t &msg);
+    void Copy(const uint8_t *payload, size_t offset, sensors_msg_t &msg);
+    template<typename T>
+    bool Payload(const entry_t &entry, T &msg) {
+        if (entry.record.size != sizeof(T)) { return false; }
+        Copy(entry.payload, 0, msg);
+        return true;
+    }
+}
+
+// The file is split in byte ranges of about the same size, which are time ranges since
+// records are written in time order. Every worker streams its range and writes its own
+// part of each table, the parts are joined in order once all of them finished. A window
+// of the recording only reads the keyframes around it
+int Headless::Convert(const options_t &options) {
+    using namespace std::chrono;
+    steady_clock::time_point start = steady_clock::now();
+    recording_t input;
+    if (!Recording::Open(input, options.convert)) {
+        fprintf(stderr, "%s is not a recording\n", options.convert.c_str());
+        return 1;
+    }
+    std::error_code error;
+    std::filesystem::path folder = options.convert_out.empty() ?
+        std::filesystem::path(options.convert).replace_extension() : std::filesystem::path(options.convert_out);
+    std::filesystem::create_directories(folder, error);
+
+    int threads = options.threads > 0 ? options.threads : std::max(1u, std::thread::hardware_concurrency());
+    uint64_t from_us = static_cast<uint64_t>(options.from * 1e6);
+    uint64_t until_us = options.until > 0 ? static_cast<uint64_t>(options.until * 1e6) : UINT64_MAX - input.header.start_us;
+    uint64_t begin = sizeof(recording_header_t);
+    uint64_t end = input.end;
+    uint64_t unused;
+    if (from_us > 0) {
+        Recording::Locate(input, from_us, begin, unused);
+    }
+    if (options.until > 0) {
+        Recording::Locate(input, until_us, unused, end);
+    }
+    end = std::max(begin, end);
+    uint64_t size = end - begin;
+    threads = static_cast<int>(std::clamp<uint64_t>(size / CONVERT_MIN_RANGE, 1, threads));
+    std::vector<uint64_t> bounds(threads + 1);
+    bounds[0] = begin;
+    bounds[threads] = end;
+    for (int i = 1; i < threads; i++) {
+        uint64_t offset = begin + size * i / threads;
+        bounds[i] = std::clamp(Recording::Sync(input.file, offset, input.end), bounds[i - 1], end);
+    }
+
+    std::vector<std::unique_ptr<worker_t>> workers(threads);
+    for (int i = 0; i < threads; i++) {
+        workers[i] = std::make_unique<worker_t>();
+        worker_t &worker = *workers[i];
+        worker.begin = bounds[i];
+        worker.end = bounds[i + 1];
+        worker.start_us = input.header.start_us;
+        worker.from_us = input.header.start_us + from_us;
+        worker.until_us = input.header.start_us + until_us;
+        for (int table = 0; table < TABLE_COUNT; table++) {
+            part_t &part = worker.parts[table];
+            part.path = folder / std::format("{}.csv.{}", tables[table].name, i);
+            part.file.open(part.path, std::ios::binary | std::ios::trunc);
+            part.buffer.reserve(CONVERT_FLUSH_SIZE + PROTOCOL_MAX_PAYLOAD);
+            if (i == 0) {
+                part.buffer.append(tables[table].columns);
+                part.buffer.push_back('\n');
+            }
+        }
+    }
+    {
+        std::vector<std::jthread> running;
+        for (int i = 0; i < threads; i++) {
+            running.emplace_back([&, i]() { Work(options.convert, input.end, *workers[i]); });
+        }
+    }
+
+    uint64_t records = 0;
+    uint64_t undecoded = 0;
+    bool truncated = false;
+    bool failed = false;
+    uint64_t rows[TABLE_COUNT] = {};
+    for (const auto &worker : workers) {
+        records += worker->records;
+        undecoded += worker->undecoded;
+        truncated |= worker->truncated;
+    }
+    for (int table = 0; table < TABLE_COUNT; table++) {
+        std::filesystem::path path = folder / std::format("{}.csv", tables[table].name);
+        std::filesystem::rename(workers[0]->parts[table].path, path, error);
+        failed |= static_cast<bool>(error) || !workers[0]->parts[table].file;
+        std::ofstream file(path, std::ios::binary | std::ios::app);
+        for (const auto &worker : workers) {
+            rows[table] += worker->parts[table].rows;
+            if (worker == workers[0]) { continue; }
+            failed |= !worker->parts[table].file;
+            {
+                std::ifstream part(worker->parts[table].path, std::ios::binary);
+                if (part.peek() != std::ifstream::traits_type::eof()) {
+                    file << part.rdbuf();
+                }
+            }
+            std::filesystem::remove(worker->parts[table].path, error);
+        }
+        failed |= !file;
+    }
+    float elapsed = duration<float>(steady_clock::now() - start).count();
+
+    printf("%s", std::format("Converted {} records, {:.1f} MB in {:.2f} s with {} threads{}{}\n", records, size / 1e6, elapsed, threads,
+        undecoded ? std::format(", {} could not be decoded", undecoded) : "", truncated ? ", the last record is cut short" : "").c_str());
+    for (int table = 0; table < TABLE_COUNT; table++) {
+        printf("%s", std::format("{:<14} {} rows\n", std::format("{}.csv", tables[table].name), rows[table]).c_str());
+    }
+    printf("%s", std::format("Written to {}\n", folder.string()).c_str());
+    if (failed) {
+        fprintf(stderr, "could not write to %s\n", folder.string().c_str());
+    }
+    return failed ? 1 : 0;
+}
+
+// Records before begin only bring the GPS state up to date
+void Headless::Work(const std::string &path, uint64_t end, worker_t &worker) {
+    std::ifstream file(path, std::ios::binary);
+    uint64_t offset = worker.begin;
+    if (worker.begin > sizeof(recording_header_t)) {
+        uint64_t warmup = std::max<uint64_t>(sizeof(recording_header_t), worker.begin - std::min<uint64_t>(worker.begin, CONVERT_WARMUP));
+        offset = warmup == sizeof(recording_header_t) ? warmup : std::min(worker.begin, Recording::Sync(file, warmup, end));
+    }
+    std::vector<uint8_t> chunk(CONVERT_CHUNK_SIZE);
+    size_t filled = 0;
+    file.clear();
+    file.seekg(offset);
+    while (offset < worker.end) {
+        file.read(reinterpret_cast<char *>(chunk.data() + filled), chunk.size() - filled);
+        size_t read = static_cast<size_t>(file.gcount());
+        filled += read;
+        size_t used = 0;
+        while (offset < worker.end && used + sizeof(record_t) <= filled) {
+            record_t record;
+            memcpy(&record, chunk.data() + used, sizeof(record));
+            size_t bytes = sizeof(record) + record.size;
+            if (!Recording::IsValid(record) || used + bytes > filled) { break; }
+            Route(worker, record, chunk.data() + used + sizeof(record), offset < worker.begin || record.time_us < worker.from_us);
+            used += bytes;
+            offset += bytes;
+        }
+        Decode(worker);
+        if (offset < worker.end && read == 0 && used == 0) {
+            // the plug-in stopped in the middle of a record
+            worker.truncated = true;
+            break;
+        }
+        memmove(chunk.data(), chunk.data() + used, filled - used);
+        filled -= used;
+    }
+    for (part_t &part : worker.parts) {
+        Flush(part);
+        part.file.close();
+    }
+}
+
+// Keyframes are left out, every message in them is in the file on its own too
+void Headless::Route(worker_t &worker, const record_t &record, const uint8_t *payload, bool warmup) {
+    if (record.direction == RECORD_KEYFRAME || record.time_us >= worker.until_us) { return; }
+    if (warmup) {
+        if (record.direction == RECORD_SENT) {
+            TrackGps(worker, record, payload);
+        }
+        return;
+    }
+    worker.records++;
+    entry_t entry = { record, payload };
+    auto add = [&](TABLE table) { worker.buckets[table].push_back(entry); };
+    if (record.direction == RECORD_RECEIVED) {
+        if (record.type == Remote::PLANE) {
+            add(PLANE_TABLE);
+        } else if (record.type == Remote::HELI) {
+            add(HELI_TABLE);
+        }
+        return;
+    }
+    switch (record.type) {
+    case Telemetry::SENSORS:
+        for (int table = IMU_TABLE; table <= EFI_TABLE; table++) {
+            add(static_cast<TABLE>(table));
+        }
+        break;
+    case Telemetry::IMU:
+        add(IMU_TABLE);
+        add(ATTITUDE_TABLE);
+        break;
+    case Telemetry::IMU_COMPACT:
+        add(IMU_TABLE);
+        break;
+    case Telemetry::ATTITUDE_COMPACT:
+        add(ATTITUDE_TABLE);
+        break;
+    case Telemetry::BARO:
+    case Telemetry::BARO_COMPACT:
+        add(BARO_TABLE);
+        break;
+    case Telemetry::MAG:
+    case Telemetry::MAG_COMPACT:
+        add(MAG_TABLE);
+        break;
+    case Telemetry::GPS:
+    case Telemetry::GPS_COMPACT:
+    case Telemetry::GPS_DELTA:
+        add(GPS_TABLE);
+        break;
+    case Telemetry::AIRSPEED:
+    case Telemetry::AIRSPEED_COMPACT:
+        add(AIRSPEED_TABLE);
+        break;
+    case Telemetry::EFI:
+    case Telemetry::EFI_COMPACT:
+        add(EFI_TABLE);
+        break;
+    }
+}
+
+// Table by table, each one in file order
+void Headless::Decode(worker_t &worker) {
+    DecodeImu(worker);
+    DecodeAttitude(worker);
+    DecodeBaro(worker);
+    DecodeMag(worker);
+    DecodeGps(worker);
+    DecodeAirspeed(worker);
+    DecodeEfi(worker);
+    DecodePwm(worker, PLANE_TABLE, 4);
+    DecodePwm(worker, HELI_TABLE, 5);
+    for (auto &bucket : worker.buckets) {
+        bucket.clear();
+    }
+}
+
+// Runs of compact samples go through the batch, the rest one at a time
+void Headless::DecodeImu(worker_t &worker) {
+    const std::vector<entry_t> &bucket = worker.buckets[IMU_TABLE];
+    part_t &part = worker.parts[IMU_TABLE];
+    size_t i = 0;
+    while (i < bucket.size()) {
+        const entry_t &entry = bucket[i];
+        int64_t time = static_cast<int64_t>(entry.record.time_us - worker.start_us);
+        if (entry.record.type == Telemetry::IMU_COMPACT) {
+            size_t count = 0;
+            for (; i < bucket.size() && count < CONVERT_BATCH && bucket[i].record.type == Telemetry::IMU_COMPACT; i++) {
+                imu_compact_t msg;
+                if (!Payload(bucket[i], msg)) {
+                    worker.undecoded++;
+                    continue;
+                }
+                // the sample is never newer than the record, the low 16 bits are enough to go back to it
+                uint64_t record_us = bucket[i].record.time_us;
+                uint64_t sample_us = record_us - static_cast<uint16_t>(static_cast<uint16_t>(record_us) - msg.time_us);
+                worker.batch.time[count] = static_cast<int64_t>(record_us - worker.start_us);
+                worker.batch.sample[count] = static_cast<int64_t>(sample_us - worker.start_us);
+                for (int axis = 0; axis < 3; axis++) {
+                    worker.batch.raw[axis][count] = msg.accel[axis];
+                    worker.batch.raw[3 + axis][count] = msg.gyro[axis];
+                }
+                count++;
+            }
+            DecodeImuBatch(worker, count);
+            continue;
+        }
+        i++;
+        if (entry.record.type == Telemetry::IMU) {
+            imu_msg_t msg;
+            if (!Payload(entry, msg)) {
+                worker.undecoded++;
+                continue;
+            }
+            const AP::ins_data_message_t &ins = msg.ins;
+            Row(part, "{},{},{},{},{},{},{},{},{}\n", time, static_cast<int64_t>(msg.time_us - worker.start_us),
+                ins.accel.x(), ins.accel.y(), ins.accel.z(), ins.gyro.x(), ins.gyro.y(), ins.gyro.z(), ins.temperature);
+        } else {
+            sensors_msg_t msg;
+            if (!Payload(entry, msg)) {
+                worker.undecoded++;
+                continue;
+            }
+            // sampled when it was sent
+            const AP::ins_data_message_t &ins = msg.ins;
+            Row(part, "{},{},{},{},{},{},{},{},{}\n", time, time,
+                ins.accel.x(), ins.accel.y(), ins.accel.z(), ins.gyro.x(), ins.gyro.y(), ins.gyro.z(), ins.temperature);
+        }
+    }
+}
+
+// Scaled column by column so the loops vectorize, then formatted row by row
+void Headless::DecodeImuBatch(worker_t &worker, size_t count) {
+    imu_batch_t &batch = worker.batch;
+    for (int column = 0; column < 6; column++) {
+        float scale = column < 3 ? ACCEL_SCALE : GYRO_SCALE;
+        const int16_t *raw = batch.raw[column];
+        float *value = batch.value[column];
+        for (size_t i = 0; i < count; i++) {
+            value[i] = raw[i] / scale;
+        }
+    }
+    part_t &part = worker.parts[IMU_TABLE];
+    for (size_t i = 0; i < count; i++) {
+        Row(part, "{},{},{},{},{},{},{},{},\n", batch.time[i], batch.sample[i],
+            batch.value[0][i], batch.value[1][i], batch.value[2][i], batch.value[3][i], batch.value[4][i], batch.value[5][i]);
+    }
+}
+
+void Headless::DecodeAttitude(worker_t &worker) {
+    part_t &part = worker.parts[ATTITUDE_TABLE];
+    for (const entry_t &entry : worker.buckets[ATTITUDE_TABLE]) {
+        int64_t time = static_cast<int64_t>(entry.record.time_us - worker.start_us);
+        if (entry.record.type == Telemetry::ATTITUDE_COMPACT) {
+            attitude_compact_t msg;
+            if (!Payload(entry, msg)) {
+                worker.undecoded++;
+                continue;
+            }
+            Row(part, "{},{},{},{},{}\n", time, msg.quat[0] / QUAT_SCALE, msg.quat[1] / QUAT_SCALE,
+                msg.quat[2] / QUAT_SCALE, msg.quat[3] / QUAT_SCALE);
+        } else if (entry.record.type == Telemetry::IMU) {
+            imu_msg_t msg;
+            if (!Payload(entry, msg)) {
+                worker.undecoded++;
+                continue;
+            }
+            Row(part, "{},{},{},{},{}\n", time, msg.q1, msg.q2, msg.q3, msg.q4);
+        } else {
+            sensors_msg_t msg;
+            if (!Payload(entry, msg)) {
+                worker.undecoded++;
+                continue;
+            }
+            Row(part, "{},{},{},{},{}\n", time, msg.q1, msg.q2, msg.q3, msg.q4);
+        }
+    }
+}
+
+void Headless::DecodeBaro(worker_t &worker) {
+    part_t &part = worker.parts[BARO_TABLE];
+    for (const entry_t &entry : worker.buckets[BARO_TABLE]) {
+        int64_t time = static_cast<int64_t>(entry.record.time_us - worker.start_us);
+        AP::baro_data_message_t baro;
+        if (entry.record.type == Telemetry::BARO_COMPACT) {
+            baro_compact_t msg;
+            if (!Payload(entry, msg)) {
+                worker.undecoded++;
+                continue;
+            }
+            baro = { msg.instance, FromFixed24(msg.pressure, PRESSURE_SCALE), msg.temperature / TEMPERATURE_SCALE };
+        } else if (entry.record.type == Telemetry::BARO) {
+            if (!Payload(entry, baro)) {
+                worker.undecoded++;
+                continue;
+            }
+        } else {
+            sensors_msg_t msg;
+            if (!Payload(entry, msg)) {
+                worker.undecoded++;
+                continue;
+            }
+            baro = msg.baro;
+        }
+        Row(part, "{},{},{},{}\n", time, baro.instance, baro.pressure_pa, baro.temperature);
+    }
+}
+
+void Headless::DecodeMag(worker_t &worker) {
+    part_t &part = worker.parts[MAG_TABLE];
+    for (const entry_t &entry : worker.buckets[MAG_TABLE]) {
+        int64_t time = static_cast<int64_t>(entry.record.time_us - worker.start_us);
+        Eigen::Vector3f field;
+        if (entry.record.type == Telemetry::MAG_COMPACT) {
+            mag_compact_t msg;
+            if (!Payload(entry, msg)) {
+                worker.undecoded++;
+                continue;
+            }
+            field = Eigen::Vector3f(msg.field[0], msg.field[1], msg.field[2]) / MAG_SCALE;
+        } else if (entry.record.type == Telemetry::MAG) {
+            AP::mag_data_message_t msg;
+            if (!Payload(entry, msg)) {
+                worker.undecoded++;
+                continue;
+            }
+            field = msg.field;
+        } else {
+            sensors_msg_t msg;
+            if (!Payload(entry, msg)) {
+                worker.undecoded++;
+                continue;
+            }
+            field = msg.mag.field;
+        }
+        Row(part, "{},{},{},{}\n", time, field.x(), field.y(), field.z());
+    }
+}
+
+// Compact fixes and deltas are turned back into the full message
+void Headless::DecodeGps(worker_t &worker) {
+    part_t &part = worker.parts[GPS_TABLE];
+    for (const entry_t &entry : worker.buckets[GPS_TABLE]) {
+        int64_t time = static_cast<int64_t>(entry.record.time_us - worker.start_us);
+        AP::gps_data_message_t gps;
+        bool delta = entry.record.type == Telemetry::GPS_DELTA;
+        if (entry.record.type == Telemetry::GPS_COMPACT || delta) {
+            if (!TrackGps(worker, entry.record, entry.payload)) {
+                worker.undecoded++;
+                continue;
+            }
+            const gps_compact_t &msg = worker.gps;
+            gps = { msg.gps_week, msg.ms_tow, msg.fix_type, msg.satellites_in_view,
+                msg.horizontal_pos_accuracy / ACCURACY_SCALE, msg.vertical_pos_accuracy / ACCURACY_SCALE,
+                msg.horizontal_vel_accuracy / ACCURACY_SCALE, msg.hdop / ACCURACY_SCALE, msg.vdop / ACCURACY_SCALE,
+                msg.longitude, msg.latitude, msg.msl_altitude,
+                msg.ned_vel[0] / VELOCITY_SCALE, msg.ned_vel[1] / VELOCITY_SCALE, msg.ned_vel[2] / VELOCITY_SCALE };
+        } else if (entry.record.type == Telemetry::GPS) {
+            if (!Payload(entry, gps)) {
+                worker.undecoded++;
+                continue;
+            }
+        } else {
+            sensors_msg_t msg;
+            if (!Payload(entry, msg)) {
+                worker.undecoded++;
+                continue;
+            }
+            gps = msg.gps;
+        }
+        Row(part, "{},{},{},{},{},{},{},{},{},{},{},{},{},{},{},{},{}\n", time, gps.gps_week, gps.ms_tow, gps.fix_type,
+            gps.satellites_in_view, gps.latitude, gps.longitude, gps.msl_altitude, gps.ned_vel_north, gps.ned_vel_east,
+            gps.ned_vel_down, gps.horizontal_pos_accuracy, gps.vertical_pos_accuracy, gps.horizontal_vel_accuracy,
+            gps.hdop, gps.vdop, delta ? 1 : 0);
+    }
+}
+
+// false for anything but a compact fix or a delta with a fix before it
+bool Headless::TrackGps(worker_t &worker, const record_t &record, const uint8_t *payload) {
+    if (record.type == Telemetry::GPS_COMPACT && record.size == sizeof(gps_compact_t)) {
+        memcpy(&worker.gps, payload, sizeof(gps_compact_t));
+        worker.has_gps = true;
+        return true;
+    }
+    if (record.type != Telemetry::GPS_DELTA || record.size != sizeof(gps_delta_t) || !worker.has_gps) { return false; }
+    gps_delta_t delta;
+    memcpy(&delta, payload, sizeof(delta));
+    worker.gps.ms_tow = delta.ms_tow;
+    worker.gps.longitude += delta.longitude;
+    worker.gps.latitude += delta.latitude;
+    worker.gps.msl_altitude += delta.msl_altitude;
+    std::copy_n(delta.ned_vel, 3, worker.gps.ned_vel);
+    return true;
+}
+
+void Headless::DecodeAirspeed(worker_t &worker) {
+    part_t &part = worker.parts[AIRSPEED_TABLE];
+    for (const entry_t &entry : worker.buckets[AIRSPEED_TABLE]) {
+        int64_t time = static_cast<int64_t>(entry.record.time_us - worker.start_us);
+        AP::airspeed_data_message_t aspd;
+        if (entry.record.type == Telemetry::AIRSPEED_COMPACT) {
+            airspeed_compact_t msg;
+            if (!Payload(entry, msg)) {
+                worker.undecoded++;
+                continue;
+            }
+            aspd = { msg.differential_pressure / DIFF_PRESSURE_SCALE, msg.temperature / TEMPERATURE_SCALE };
+        } else if (entry.record.type == Telemetry::AIRSPEED) {
+            if (!Payload(entry, aspd)) {
+                worker.undecoded++;
+                continue;
+            }
+        } else {
+            sensors_msg_t msg;
+            if (!Payload(entry, msg)) {
+                worker.undecoded++;
+                continue;
+            }
+            aspd = msg.aspd;
+        }
+        Row(part, "{},{},{}\n", time, aspd.differential_pressure, aspd.temperature);
+    }
+}
+
+// Only the fields the compact encoding keeps, they are the ones the plug-in fills
+void Headless::DecodeEfi(worker_t &worker) {
+    part_t &part = worker.parts[EFI_TABLE];
+    for (const entry_t &entry : worker.buckets[EFI_TABLE]) {
+        int64_t time = static_cast<int64_t>(entry.record.time_us - worker.start_us);
+        efi_compact_t efi;
+        if (entry.record.type == Telemetry::EFI_COMPACT) {
+            if (!Payload(entry, efi)) {
+                worker.undecoded++;
+                continue;
+            }
+        } else {
+            EFI_State msg;
+            if (entry.record.type == Telemetry::EFI) {
+                if (!Payload(entry, msg)) {
+                    worker.undecoded++;
+                    continue;
+                }
+            } else {
+                sensors_msg_t sensors;
+                if (!Payload(entry, sensors)) {
+                    worker.undecoded++;
+                    continue;
+                }
+                msg = sensors.efi;
+            }
+            efi = { static_cast<uint8_t>(msg.engine_state), msg.engine_load_percent,
+                static_cast<uint16_t>(std::min<uint32_t>(msg.engine_speed_rpm, UINT16_MAX)), msg.throttle_position_percent,
+                ToFixed<uint16_t>(msg.throttle_out, THROTTLE_SCALE), msg.estimated_consumed_fuel_volume_cm3, msg.fuel_consumption_rate_cm3pm };
+        }
+        // copies, references can't bind to packed fields
+        Row(part, "{},{},{},{},{},{},{},{}\n", time, static_cast<int>(efi.engine_state), static_cast<int>(efi.engine_load_percent),
+            static_cast<int>(efi.engine_speed_rpm), static_cast<int>(efi.throttle_position_percent), efi.throttle_out / THROTTLE_SCALE,
+            static_cast<float>(efi.estimated_consumed_fuel_volume_cm3), static_cast<float>(efi.fuel_consumption_rate_cm3pm));
+    }
+}
+
+// PLANE and HELI are a PWM value per channel
+void Headless::DecodePwm(worker_t &worker, TABLE table, int channels) {
+    part_t &part = worker.parts[table];
+    for (const entry_t &entry : worker.buckets[table]) {
+        if (entry.record.size < channels * sizeof(uint16_t)) {
+            worker.undecoded++;
+            continue;
+        }
+        uint16_t pwm[5];
+        memcpy(pwm, entry.payload, channels * sizeof(uint16_t));
+        std::back_insert_iterator<std::string> out = std::format_to(std::back_inserter(part.buffer), "{}",
+            static_cast<int64_t>(entry.record.time_us - worker.start_us));
+        for (int channel = 0; channel < channels; channel++) {
+            out = std::format_to(out, ",{}", pwm[channel]);
+        }
+        part.buffer.push_back('\n');
+        part.rows++;
+        if (part.buffer.size() >= CONVERT_FLUSH_SIZE) {
+            Flush(part);
+        }
+    }
+}
+
+void Headless::Flush(part_t &part) {
+    part.file.write(part.buffer.data(), part.buffer.size());
+    part.buffer.clear();
+}
+
+void Headless::Copy(const uint8_t *payload, size_t offset, Eigen::Vector3f &member) {
+    memcpy(member.data(), payload + offset, sizeof(float) * member.size());
+}
+
+void Headless::Copy(const uint8_t *payload, size_t offset, AP::mag_data_message_t &msg) {
+    Copy(payload, offset + offsetof(AP::mag_data_message_t, field), msg.field);
+}
+
+void Headless::Copy(const uint8_t *payload, size_t offset, AP::ins_data_message_t &msg) {
+    Copy(payload, offset + offsetof(AP::ins_data_message_t, accel), msg.accel);
+    Copy(payload, offset + offsetof(AP::ins_data_message_t, gyro), msg.gyro);
+    Copy(payload, offset + offsetof(AP::ins_data_message_t, temperature), msg.temperature);
+}
+
+void Headless::Copy(const uint8_t *payload, size_t offset, imu_msg_t &msg) {
+    Copy(payload, offset + offsetof(imu_msg_t, time_us), msg.time_us);
+    Copy(payload, offset + offsetof(imu_msg_t, ins), msg.ins);
+    Copy(payload, offset + offsetof(imu_msg_t, q1), msg.q1);
+    Copy(payload, offset + offsetof(imu_msg_t, q2), msg.q2);
+    Copy(payload, offset + offsetof(imu_msg_t, q3), msg.q3);
+    Copy(payload, offset + offsetof(imu_msg_t, q4), msg.q4);
+}
+
+void Headless::Copy(const uint8_t *payload, size_t offset, sensors_msg_t &msg) {
+    Copy(payload, offset + offsetof(sensors_msg_t, baro), msg.baro);
+    Copy(payload, offset + offsetof(sensors_msg_t, mag), msg.mag);
+    Copy(payload, offset + offsetof(sensors_msg_t, gps), msg.gps);
+    Copy(payload, offset + offsetof(sensors_msg_t, ins), msg.ins);
+    Copy(payload, offset + offsetof(sensors_msg_t, aspd), msg.aspd);
+    Copy(payload, offset + offsetof(sensors_msg_t, q1), msg.q1);
+    Copy(payload, offset + offsetof(sensors_msg_t, q2), msg.q2);
+    Copy(payload, offset + offsetof(sensors_msg_t, q3), msg.q3);
+    Copy(payload, offset + offsetof(sensors_msg_t, q4), msg.q4);
+    Copy(payload, offset + offsetof(sensors_msg_t, efi), msg.efi);
+}
@@ -0,0 +1,549 @@
+#include <thread>
+#include <chrono>
+#include <string>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <cstddef>
+#include <cstdlib>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include "emulator.hpp"
+#include "../messages.hpp"
+#include "../compact.hpp"
+#include "../baud.hpp"
+
+#define EMULATOR_BUFFER_SIZE 8192
+// longest v1 payload looked for before giving up on a header
+#define EMULATOR_MAX_V1_PAYLOAD 2048
+#define PWM_MIN 1100
+#define PWM_MAX 1900
+#define PWM_PER_MARKER 3
+// results go out this long after switching even if the test burst did not all arrive (s)
+#define BAUD_TEST_WINDOW 0.2f
+// received bytes between two damaged ones above the clean rate
+#define BAUD_DAMAGE_SPACING 64
+// the plug-in is taken as gone after this long without a valid frame, the firmware
+// goes back to v1 and sends the discovery ping instead of PING (s)
+#define EMULATOR_LINK_TIMEOUT 1.0f
+
+namespace Emulator {
+    // Messages the firmware sends, same layout as in remote.cpp
+    enum MSG_TYPE {
+        PING,
+        STATE,
+        PLANE,
+        HELI,
+        VERSION,
+        BAUD
+    };
+    struct state_msg_t {
+        uint8_t state;
+        uint32_t ahrs_count;
+        uint16_t starter;
+    };
+    struct plane_msg_t {
+        uint16_t roll;
+        uint16_t pitch;
+        uint16_t yaw;
+        uint16_t throttle;
+    };
+    struct heli_msg_t {
+        uint16_t roll_cyclic;
+        uint16_t pitch_cyclic;
+        uint16_t collective;
+        uint16_t tail;
+        uint16_t throttle;
+    };
+    struct version_msg_t {
+        uint8_t version;
+        uint8_t features;
+    };
+
+    emulator_options_t options;
+    emulator_stats_t stats;
+    // pty master, accepted TCP connection or UDP socket
+    int master = -1;
+    // TCP only, waiting for the plug-in
+    int listener = -1;
+    bool pty = false;
+    bool udp = false;
+    sockaddr_in peer;
+    socklen_t peer_len = 0;
+    std::jthread thread;
+    uint8_t buffer[EMULATOR_BUFFER_SIZE];
+    size_t len = 0;
+    uint8_t raw[PROTOCOL_MAX_FRAME];
+    uint16_t tx_seq[256];
+    uint16_t rx_seq[256];
+    bool rx_seq_valid[256];
+    // last probe level received, mirrored in the actuator output
+    int marker = -1;
+    uint32_t ahrs_count = 0;
+    uint32_t ahrs_rate = 0;
+    // last PING with the plug-in clock, echoed in STATE
+    uint64_t ping_time = 0;
+    uint64_t ping_rx = 0;
+    // frames built, for the damage and duplicate options
+    uint64_t frames = 0;
+    // serial speed negotiation, test frames received while testing
+    int baud = BAUD_RATE;
+    bool testing = false;
+    int tests = 0;
+    float test_timer = 0;
+    float silence = 0;
+    bool Stamped() { return stats.version >= 2 && (stats.features & FEATURE_TIMESYNC); }
+    std::string Bind(int type);
+    ssize_t Receive(uint8_t *dest, size_t max);
+    void Run(std::stop_token stop);
+    size_t Parse(size_t start);
+    void Dispatch(int type, const uint8_t *payload, size_t bytes);
+    void OnGyro(float gyro);
+    void SendMsg(int type, const void *msg, size_t bytes);
+    void Write(const uint8_t *frame, size_t size);
+    void SendActuators();
+    void OnBaud(const uint8_t *payload, size_t bytes);
+    void SendBaudResult();
+}
+
+std::string Emulator::Open(const std::string &transport) {
+    pty = transport == "pty";
+    udp = transport == "udp";
+    peer_len = 0;
+    if (transport == "tcp") {
+        std::string port = Bind(SOCK_STREAM);
+        return port.empty() ? "" : "tcp://127.0.0.1:" + port;
+    }
+    if (udp) {
+        std::string port = Bind(SOCK_DGRAM);
+        return port.empty() ? "" : "udp://127.0.0.1:" + port;
+    }
+    master = posix_openpt(O_RDWR | O_NOCTTY | O_NONBLOCK);
+    if (master < 0) { return ""; }
+    if (grantpt(master) != 0 || unlockpt(master) != 0) {
+        close(master);
+        master = -1;
+        return "";
+    }
+    return ptsname(master);
+}
+
+// Socket on a free loopback port, returns the port
+std::string Emulator::Bind(int type) {
+    int fd = socket(AF_INET, type | SOCK_NONBLOCK, 0);
+    if (fd < 0) { return ""; }
+    sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t len = sizeof(addr);
+    if (bind(fd, reinterpret_cast<sockaddr *>(&addr), len) != 0 ||
+        getsockname(fd, reinterpret_cast<sockaddr *>(&addr), &len) != 0 ||
+        (type == SOCK_STREAM && listen(fd, 1) != 0)) {
+        close(fd);
+        return "";
+    }
+    if (type == SOCK_STREAM) {
+        listener = fd;
+    } else {
+        master = fd;
+    }
+    return std::to_string(ntohs(addr.sin_port));
+}
+
+void Emulator::Start(const emulator_options_t &options) {
+    Emulator::options = options;
+    stats = {};
+    stats.version = 1;
+    len = 0;
+    marker = -1;
+    ping_time = 0;
+    ping_rx = 0;
+    frames = 0;
+    baud = BAUD_RATE;
+    testing = false;
+    silence = 0;
+    std::fill_n(rx_seq_valid, 256, false);
+    thread = std::jthread(Run);
+}
+
+void Emulator::Stop() {
+    if (thread.joinable()) {
+        thread.request_stop();
+        thread.join();
+    }
+    if (master >= 0) {
+        close(master);
+        master = -1;
+    }
+    if (listener >= 0) {
+        close(listener);
+        listener = -1;
+    }
+}
+
+emulator_stats_t Emulator::GetStats() {
+    stats.baud = baud;
+    return stats;
+}
+
+uint64_t Emulator::Clock(uint64_t local_us) {
+    return local_us + static_cast<int64_t>(local_us * options.clock_drift_ppm * 1e-6) + options.clock_offset_us;
+}
+
+float Emulator::MarkerToGyro(int marker) {
+    return (marker - MARKER_LEVELS / 2) * MARKER_STEP;
+}
+
+int Emulator::RollToMarker(float roll) {
+    float steps = (roll + 1) / 2 * (PWM_MAX - PWM_MIN) / PWM_PER_MARKER;
+    int level = static_cast<int>(std::round(steps));
+    if (std::abs(steps - level) > MARKER_TOLERANCE) { return -1; }
+    level--;
+    return level >= 0 && level < MARKER_LEVELS ? level : -1;
+}
+
+void Emulator::Run(std::stop_token stop) {
+    using namespace std::chrono;
+    steady_clock::time_point last = steady_clock::now();
+    steady_clock::time_point second = last;
+    float ping_timer = 0;
+    float state_timer = 0;
+    float actuator_timer = 0;
+    // UART pacing, bytes that could have arrived since the last read
+    double budget = 0;
+    while (!stop.stop_requested()) {
+        double bytes_per_second = baud / 10.0;
+        if (master < 0) {
+            master = accept4(listener, nullptr, nullptr, SOCK_NONBLOCK);
+            // small frames must not wait for Nagle
+            int nodelay = 1;
+            if (master >= 0) { setsockopt(master, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay)); }
+        }
+        pollfd fd = { master < 0 ? listener : master, POLLIN, 0 };
+        poll(&fd, 1, 1);
+        steady_clock::time_point now = steady_clock::now();
+        float dt = duration<float>(now - last).count();
+        last = now;
+        // sockets have no baud rate to emulate
+        budget = pty ? std::min(budget + dt * bytes_per_second, bytes_per_second / 100 + 64) : sizeof(buffer);
+        size_t room = std::min(sizeof(buffer) - len, static_cast<size_t>(budget));
+        if (room > 0 && master >= 0) {
+            ssize_t got = Receive(&buffer[len], room);
+            for (ssize_t i = BAUD_DAMAGE_SPACING / 2; pty && baud > options.clean_baud && i < got; i += BAUD_DAMAGE_SPACING) {
+                buffer[len + i] ^= 0x10;
+            }
+            if (got > 0) {
+                len += got;
+                budget -= got;
+                stats.rx_bytes += got;
+                size_t start = Parse(0);
+                len -= start;
+                memmove(buffer, &buffer[start], len);
+            }
+        }
+        if (now - second >= seconds(1)) {
+            second = now;
+            ahrs_rate = ahrs_count;
+            ahrs_count = 0;
+        }
+        ping_timer += dt;
+        state_timer += dt;
+        actuator_timer += dt;
+        silence += dt;
+        test_timer += dt;
+        if (testing && test_timer > BAUD_TEST_WINDOW) {
+            SendBaudResult();
+        }
+        // the plug-in went back or is gone, the firmware returns to the rate it started at
+        if (baud != BAUD_RATE && silence > BAUD_TIMEOUT) {
+            baud = BAUD_RATE;
+            testing = false;
+        }
+        bool linked = silence <= EMULATOR_LINK_TIMEOUT;
+        if (!linked && stats.version >= 2) {
+            stats.version = 1;
+            stats.features = 0;
+            std::fill_n(rx_seq_valid, 256, false);
+        }
+        if (options.ping_rate > 0 && ping_timer >= 1 / options.ping_rate) {
+            ping_timer = 0;
+            if (linked) {
+                SendMsg(PING, nullptr, 0);
+            } else {
+                const char discovery[] = "PINGHITLPINGHITLPING";
+                Write(reinterpret_cast<const uint8_t *>(discovery), sizeof(discovery));
+            }
+        }
+        if (options.state_rate > 0 && state_timer >= 1 / options.state_rate) {
+            state_timer = 0;
+            struct {
+                state_msg_t state;
+                state_sync_t sync;
+            } msg = { { 2, ahrs_rate, 0 }, { ping_time, ping_rx, 0 } };
+            msg.sync.time_us = Clock(Timesync::Now());
+            SendMsg(STATE, &msg, Stamped() ? sizeof(msg) : sizeof(msg.state));
+        }
+        if (options.actuator_rate > 0 && actuator_timer >= 1 / options.actuator_rate) {
+            actuator_timer = std::fmod(actuator_timer, 1 / options.actuator_rate);
+            SendActuators();
+        }
+    }
+}
+
+ssize_t Emulator::Receive(uint8_t *dest, size_t max) {
+    if (!udp) {
+        return read(master, dest, max);
+    }
+    // a datagram is never split, what does not fit is lost like on a real link
+    uint8_t datagram[65536];
+    sockaddr_in from;
+    socklen_t from_len = sizeof(from);
+    ssize_t got = recvfrom(master, datagram, sizeof(datagram), 0, reinterpret_cast<sockaddr *>(&from), &from_len);
+    if (got <= 0) { return got; }
+    peer = from;
+    peer_len = from_len;
+    got = std::min(got, static_cast<ssize_t>(max));
+    memcpy(dest, datagram, got);
+    return got;
+}
+
+// Both framings are accepted since v1 frames may still be on the way after the switch,
+// returns where parsing stopped
+size_t Emulator::Parse(size_t start) {
+    while (start < len) {
+        if (len - start >= 8 && memcmp(&buffer[start], "HITL", 4) == 0) {
+            // v1, find the footer whose length points back at this header
+            size_t end = std::min(len, start + 8 + EMULATOR_MAX_V1_PAYLOAD + 8);
+            size_t footer = start + 8;
+            while (footer + 8 <= end) {
+                int32_t size;
+                memcpy(&size, &buffer[footer], sizeof(size));
+                if (size == static_cast<int32_t>(footer - start) && memcmp(&buffer[footer + 4], "END", 3) == 0) { break; }
+                footer++;
+            }
+            if (footer + 8 > end) {
+                if (end < start + 8 + EMULATOR_MAX_V1_PAYLOAD + 8) { break; }
+                stats.bad_frames++;
+                start++;
+                continue;
+            }
+            int32_t type;
+            memcpy(&type, &buffer[start + 4], sizeof(type));
+            stats.rx_frames++;
+            silence = 0;
+            Dispatch(type, &buffer[start + 8], footer - start - 8);
+            // footer is padded to 8 bytes
+            start = footer + 8;
+            continue;
+        }
+        // wait for the rest of what may be a v1 header
+        if (len - start < 8 && memcmp(&buffer[start], "HITL", std::min<size_t>(len - start, 4)) == 0) { break; }
+        if (stats.version < 2) {
+            uint8_t *found = static_cast<uint8_t *>(memchr(&buffer[start + 1], 'H', len - start - 1));
+            if (!found) { return len; }
+            start = found - buffer;
+            continue;
+        }
+        uint8_t *found = static_cast<uint8_t *>(memchr(&buffer[start], 0, len - start));
+        if (!found) {
+            if (len - start > PROTOCOL_MAX_FRAME) {
+                stats.bad_frames++;
+                return len;
+            }
+            break;
+        }
+        size_t size = found - &buffer[start];
+        const uint8_t *src = &buffer[start];
+        start += size + 1;
+        if (size == 0) { continue; }
+        frame_header_t header;
+        uint32_t stamp;
+        const uint8_t *payload = Protocol::Decode(src, size, raw, header, Stamped() ? &stamp : nullptr);
+        if (!payload) {
+            stats.bad_frames++;
+            continue;
+        }
+        if (Stamped()) {
+            stats.uplink_frames++;
+            stats.uplink_total_us += static_cast<int32_t>(static_cast<uint32_t>(Timesync::Now()) - stamp);
+        }
+        if (rx_seq_valid[header.type]) {
+            stats.lost_frames += static_cast<uint16_t>(header.seq - rx_seq[header.type] - 1);
+        }
+        rx_seq[header.type] = header.seq;
+        rx_seq_valid[header.type] = true;
+        stats.rx_frames++;
+        silence = 0;
+        Dispatch(header.type, payload, header.len);
+    }
+    return start;
+}
+
+void Emulator::Dispatch(int type, const uint8_t *payload, size_t bytes) {
+    switch (type) {
+    case Telemetry::SENSORS:
+        // only the gyro is needed, read straight from the payload since the AP messages
+        // hold Eigen vectors that are not trivially copyable
+        if (bytes == sizeof(sensors_msg_t)) {
+            float gyro;
+            memcpy(&gyro, payload + offsetof(sensors_msg_t, ins) + offsetof(AP::ins_data_message_t, gyro), sizeof(gyro));
+            OnGyro(gyro);
+        }
+        break;
+    case Telemetry::IMU:
+        if (bytes == sizeof(imu_msg_t)) {
+            float gyro;
+            memcpy(&gyro, payload + offsetof(imu_msg_t, ins) + offsetof(AP::ins_data_message_t, gyro), sizeof(gyro));
+            OnGyro(gyro);
+        }
+        break;
+    case Telemetry::IMU_COMPACT:
+        if (bytes == sizeof(imu_compact_t)) {
+            imu_compact_t msg;
+            memcpy(&msg, payload, bytes);
+            OnGyro(msg.gyro[0] / GYRO_SCALE);
+        }
+        break;
+    case Telemetry::BAUD:
+        OnBaud(payload, bytes);
+        break;
+    case Telemetry::RESTART:
+        stats.restarts++;
+        break;
+    case Telemetry::PING:
+        // negotiation, answered in v1 and everything after it is v2
+        if (bytes == sizeof(version_msg_t) && stats.version < 2 && options.version >= 2) {
+            version_msg_t msg;
+            memcpy(&msg, payload, bytes);
+            version_msg_t answer = {
+                static_cast<uint8_t>(std::min<int>(msg.version, options.version)),
+                static_cast<uint8_t>(msg.features & options.features)
+            };
+            SendMsg(VERSION, &answer, sizeof(answer));
+            if (answer.version >= 2) {
+                stats.version = answer.version;
+                stats.features = answer.features;
+            }
+        } else if (bytes == sizeof(ping_sync_t) && Stamped()) {
+            ping_sync_t msg;
+            memcpy(&msg, payload, bytes);
+            ping_time = msg.time_us;
+            ping_rx = Clock(Timesync::Now());
+        }
+        break;
+    }
+}
+
+// Offers are answered at the old rate and the switch is immediate, a pty has no
+// transmit queue to wait for
+void Emulator::OnBaud(const uint8_t *payload, size_t bytes) {
+    if (bytes < sizeof(baud_msg_t) || !(stats.features & FEATURE_BAUD)) { return; }
+    baud_test_t msg;
+    memcpy(&msg, payload, std::min(bytes, sizeof(msg)));
+    if (msg.msg.stage == BAUD_OFFER) {
+        bool accept = msg.msg.baud <= static_cast<uint32_t>(options.max_baud);
+        baud_msg_t answer = { accept ? msg.msg.baud : 0, BAUD_ACCEPT, 0 };
+        SendMsg(BAUD, &answer, sizeof(answer));
+        if (!accept) { return; }
+        baud = msg.msg.baud;
+        testing = true;
+        tests = 0;
+        test_timer = 0;
+    } else if (msg.msg.stage == BAUD_TEST && testing && bytes == sizeof(msg) && msg.msg.baud == static_cast<uint32_t>(baud)) {
+        uint8_t pattern[BAUD_TEST_SIZE];
+        Baud::Pattern(msg.msg.count, pattern);
+        if (memcmp(pattern, msg.pattern, sizeof(pattern)) == 0) {
+            tests++;
+        }
+        if (msg.msg.count == BAUD_TEST_FRAMES - 1) {
+            SendBaudResult();
+        }
+    }
+}
+
+// Reported at the new rate, a failed test sends both sides back to the starting one
+void Emulator::SendBaudResult() {
+    baud_msg_t result = { static_cast<uint32_t>(baud), BAUD_RESULT, static_cast<uint8_t>(tests) };
+    SendMsg(BAUD, &result, sizeof(result));
+    testing = false;
+    if (tests < BAUD_TEST_FRAMES) {
+        baud = BAUD_RATE;
+    }
+}
+
+void Emulator::OnGyro(float gyro) {
+    ahrs_count++;
+    float level = gyro / MARKER_STEP + MARKER_LEVELS / 2;
+    int nearest = static_cast<int>(std::round(level));
+    if (std::abs(level - nearest) > MARKER_TOLERANCE) { return; }
+    if (nearest < 0 || nearest >= MARKER_LEVELS) { return; }
+    marker = nearest;
+}
+
+void Emulator::SendActuators() {
+    // level 0 is kept for no probe, so centered sticks never read as one
+    uint16_t roll = marker < 0 ? (PWM_MIN + PWM_MAX) / 2 : PWM_MIN + (marker + 1) * PWM_PER_MARKER;
+    if (options.heli) {
+        heli_msg_t msg = { roll, 1500, 1500, 1500, 1500 };
+        SendMsg(HELI, &msg, sizeof(msg));
+    } else {
+        plane_msg_t msg = { roll, 1500, 1500, 1500 };
+        SendMsg(PLANE, &msg, sizeof(msg));
+    }
+}
+
+void Emulator::SendMsg(int type, const void *msg, size_t bytes) {
+    uint8_t frame[PROTOCOL_MAX_FRAME];
+    size_t size;
+    if (stats.version >= 2) {
+        uint32_t stamp = static_cast<uint32_t>(Clock(Timesync::Now()));
+        size = Protocol::Encode(static_cast<uint8_t>(type), tx_seq[type]++, msg, bytes, frame, Stamped() ? &stamp : nullptr);
+    } else {
+        struct {
+            char preamble[4] = { 'H', 'I', 'T', 'L' };
+            int type;
+        } header;
+        struct {
+            int len;
+            char postamble[3] = { 'E','N','D' };
+        } footer;
+        header.type = type;
+        footer.len = static_cast<int>(sizeof(header) + bytes);
+        memcpy(frame, &header, sizeof(header));
+        if (bytes > 0) {
+            memcpy(&frame[sizeof(header)], msg, bytes);
+        }
+        memcpy(&frame[sizeof(header) + bytes], &footer, sizeof(footer));
+        size = sizeof(header) + bytes + sizeof(footer);
+    }
+    frames++;
+    // damage a byte in the middle, never a v2 delimiter
+    if (options.corrupt_every > 0 && frames % options.corrupt_every == 0) {
+        frame[size / 2] ^= 0x55;
+        if (frame[size / 2] == 0) { frame[size / 2] = 0x55; }
+    }
+    Write(frame, size);
+    if (options.duplicate_every > 0 && frames % options.duplicate_every == 0) {
+        Write(frame, size);
+    }
+}
+
+void Emulator::Write(const uint8_t *frame, size_t size) {
+    ssize_t sent = -1;
+    if (udp) {
+        // the plug-in has to talk first
+        if (peer_len > 0) {
+            sent = sendto(master, frame, size, 0, reinterpret_cast<const sockaddr *>(&peer), peer_len);
+        }
+    } else if (master >= 0) {
+        sent = pty ? write(master, frame, size) : send(master, frame, size, MSG_NOSIGNAL);
+    }
+    if (sent == static_cast<ssize_t>(size)) {
+        stats.tx_frames++;
+    }
+}
@@ -0,0 +1,70 @@
+#pragma once
+#include <string>
+#include <cstdint>
+#include "../serial.hpp"
+#include "../protocol.hpp"
+#include "../timesync.hpp"
+
+// Latency probe, the driver writes one of MARKER_LEVELS gyro x values and the
+// emulator mirrors the level it receives into the roll output
+#define MARKER_LEVELS 256
+#define MARKER_STEP 0.01f // rad/s
+// received gyro values further than this from a level are interpolated samples
+#define MARKER_TOLERANCE 0.2f // steps
+
+// Stand-in for the ExternalAHRS firmware on the far end of the link
+struct emulator_options_t {
+    // newest protocol version and features it accepts
+    int version = PROTOCOL_VERSION;
+    uint8_t features = PROTOCOL_FEATURES;
+    bool heli = false;
+    float ping_rate = 1; // Hz
+    float state_rate = 10; // Hz
+    float actuator_rate = 400; // Hz
+    // bytes from the plug-in are taken no faster than a UART at the negotiated rate, pty only.
+    // Offers above max_baud are refused, above clean_baud the test frames arrive damaged
+    // like over a long cable
+    int max_baud = 1500000;
+    int clean_baud = 921600;
+    // firmware clock against the plug-in one, for the timesync estimate to find
+    int64_t clock_offset_us = 5000000;
+    double clock_drift_ppm = 40;
+    // damage or send twice every this many frames, 0 never
+    int corrupt_every = 0;
+    int duplicate_every = 0;
+};
+
+struct emulator_stats_t {
+    uint64_t rx_bytes;
+    uint64_t rx_frames;
+    // frames that failed the checks
+    uint64_t bad_frames;
+    // v2 sequence gaps
+    uint64_t lost_frames;
+    uint64_t tx_frames;
+    // RESTART frames, one is sent whenever the plug-in lets go of the link
+    uint64_t restarts;
+    // true plug-in to autopilot latency of stamped frames, read on the plug-in clock
+    uint64_t uplink_frames;
+    int64_t uplink_total_us;
+    int version;
+    uint8_t features;
+    // serial speed at the end
+    int baud;
+};
+
+namespace Emulator {
+    // Create the link end, pty, tcp or udp on the loopback interface.
+    // Returns the address the plug-in should open or empty on failure
+    std::string Open(const std::string &transport = "pty");
+    void Start(const emulator_options_t &options);
+    // Stops the emulator thread and closes the pseudo terminal
+    void Stop();
+    // Only consistent once stopped
+    emulator_stats_t GetStats();
+    // Firmware clock at the given plug-in time (us)
+    uint64_t Clock(uint64_t local_us);
+    float MarkerToGyro(int marker);
+    // Level encoded in the roll ratio set by the plug-in, -1 if none
+    int RollToMarker(float roll);
+}
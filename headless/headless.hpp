@@ -0,0 +1,98 @@
+#pragma once
+#include <string>
+#include <string_view>
+#include <cstdint>
+#include <functional>
+#include <XPLMDataAccess.h>
+#include <XPWidgetDefs.h>
+#include "emulator.hpp"
+#include "../telemetry.hpp"
+
+// In-memory stand-in for the X-Plane SDK so the plug-in can run without the sim
+namespace Headless {
+    // Aircraft state written into the datarefs before every flight loop, t in seconds
+    using trajectory_t = std::function<void(double t)>;
+
+    struct options_t {
+        float rate = 60;
+        float seconds = 10;
+        std::string trajectory = "circle";
+        bool realtime = false;
+        int bench = 0;
+        bool quiet = false;
+        // start from the config file left by the last run instead of a fresh one
+        bool keep_config = false;
+        // loopback, tear the link down this many times like loading another aircraft does
+        int reconnects = 0;
+        // loopback, fail if the flight loop allocates once the link settled
+        bool alloc_check = false;
+        // loopback, record the session like the Record box does
+        bool record = false;
+        // loopback, capture the link like the Capture box does
+        bool capture = false;
+        // loopback, fail unless the fitted clock drift is known by the end and matches the emulated one
+        bool drift_check = false;
+        // send the messages of a recording instead of flying, to the emulator or to an
+        // autopilot at replay_to. 1 keeps the original timing, 0 is as fast as the link takes them
+        std::string replay;
+        std::string replay_to;
+        float replay_speed = 1;
+        // window of the recording to replay or convert, seconds since it started. until 0 is the end
+        double from = 0;
+        double until = 0;
+        // write the messages of a recording as a CSV file per sensor group and actuator message,
+        // to convert_out or a folder named after the recording. threads 0 is one per core
+        std::string convert;
+        std::string convert_out;
+        int threads = 0;
+        // connect to an emulated autopilot over a pty, tcp or udp
+        bool loopback = false;
+        std::string transport = "pty";
+        bool multirate = false;
+        bool low_latency = false;
+        // outputs only reach the sim through the flight loops, latency is measured
+        // at the flight model step
+        bool in_loop = false;
+        bool single_phase = false;
+        float imu_rate = IMU_RATE;
+        emulator_options_t emulator;
+    };
+
+    // Datarefs are created on first use and hold up to DATAREF_SIZE values
+    XPLMDataRef Find(std::string_view name);
+    void Set(std::string_view name, double value, int index = 0);
+    double Get(std::string_view name, int index = 0);
+    int CommandCount(const std::string &name);
+
+    // Run one frame: before flight model loops, the flight model step, then after
+    // flight model loops, legacy callbacks count as after
+    void RunFlightLoops(float dt, const std::function<void()> &flight_model = {});
+    // Run the before flight model loops after it too, like a single legacy callback
+    void SetSinglePhase(bool state);
+    float ElapsedTime();
+
+    // Widgets are looked up by their initial descriptor
+    XPWidgetID FindWidget(const std::string &descriptor);
+    std::string WidgetText(XPWidgetID widget);
+    int SendWidgetMessage(XPWidgetID widget, XPWidgetMessage message, intptr_t param1, intptr_t param2);
+
+    // Built in trajectories: level, circle, climb
+    trajectory_t Trajectory(const std::string &name);
+
+    // Print XPLMDebugString output to stdout
+    void SetVerbose(bool state);
+    // Heap allocations made so far by the calling thread, counted by the operator new in alloc.cpp
+    uint64_t Allocations();
+    // Print a backtrace of the next count allocations made by the calling thread
+    void TraceAllocations(int count);
+
+    // Where XPLMGetPluginInfo says the plug-in binary is, the config file goes next to it
+    void SetPluginPath(const std::string &path);
+
+    // End to end run against the emulator, returns the process exit code
+    int Loopback(const options_t &options);
+    // Send a recording and compare the actuator responses with the recorded ones
+    int Replay(const options_t &options);
+    // Write a recording as CSV tables, split across threads by time range
+    int Convert(const options_t &options);
+}
@@ -0,0 +1,278 @@
+#include <XPLMDataAccess.h>
+#include <XPLMPlugin.h>
+#include <array>
+#include <optional>
+#include <vector>
+#include <chrono>
+#include <thread>
+#include <format>
+#include <numbers>
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include "headless.hpp"
+#include "emulator.hpp"
+#include "../serial.hpp"
+#include "../remote.hpp"
+#include "../telemetry.hpp"
+#include "../protocol.hpp"
+#include "../main.hpp"
+#include "../timesync.hpp"
+#include "../recorder.hpp"
+#include "../capture.hpp"
+#include "../baud.hpp"
+
+PLUGIN_API void XPluginReceiveMessage(XPLMPluginID inFrom, int inMsg, void *inParam);
+
+// probe levels are visited in this order so that interpolated IMU samples rarely land on one
+#define MARKER_STRIDE 97
+#define PROBE_POLL std::chrono::microseconds(50)
+// allocations traced with --alloc-check, the rest are only counted
+#define ALLOC_TRACES 8
+// --drift-check passes within this fraction of the emulated drift, or TIMESYNC_DRIFT_MAX_ERROR ppm
+#define DRIFT_TOLERANCE 0.25
+
+namespace Headless {
+    struct probe_t {
+        std::chrono::steady_clock::time_point sent;
+        bool pending;
+    };
+    std::array<probe_t, MARKER_LEVELS> probes;
+    // sensor to actuator round trips (microseconds)
+    std::vector<int64_t> latencies;
+    // time to reopen the link and to get back to the same version and baud rate (microseconds)
+    std::vector<int64_t> reopen_times;
+    std::vector<int64_t> restore_times;
+    void CheckProbe();
+    int64_t Percentile(const std::vector<int64_t> &sorted, double p);
+}
+
+int Headless::Loopback(const options_t &options) {
+    using namespace std::chrono;
+    // only the serial scan has a last port to go back to
+    if (options.reconnects > 0 && options.transport != "pty") {
+        fprintf(stderr, "--reconnect needs the pty transport\n");
+        return 1;
+    }
+    std::string port = Emulator::Open(options.transport);
+    if (port.empty()) {
+        fprintf(stderr, "could not create the %s link\n", options.transport.c_str());
+        return 1;
+    }
+    Emulator::Start(options.emulator);
+    if (options.record && !Recorder::Start()) {
+        Emulator::Stop();
+        fprintf(stderr, "could not start recording\n");
+        return 1;
+    }
+    if (options.capture && !Capture::Start()) {
+        Recorder::Stop();
+        Emulator::Stop();
+        fprintf(stderr, "could not start the capture\n");
+        return 1;
+    }
+    Serial::SetLowLatency(options.low_latency);
+    Serial::Connect(port);
+    if (!Serial::IsOpen()) {
+        Emulator::Stop();
+        fprintf(stderr, "could not open %s\n", port.c_str());
+        return 1;
+    }
+    Telemetry::SetMultirate(options.multirate);
+    Telemetry::SetRate(Telemetry::IMU, options.imu_rate);
+    trajectory_t trajectory = Trajectory(options.trajectory);
+    float dt = 1.0f / options.rate;
+    int frames = static_cast<int>(options.seconds * options.rate);
+    int sent = 0;
+    probes = {};
+    latencies.clear();
+    latencies.reserve(frames);
+    reopen_times.clear();
+    restore_times.clear();
+    int reconnects = 0;
+    // set while the link is being brought back
+    std::optional<steady_clock::time_point> torn_down;
+    bool reopened = false;
+    int last_version = 1;
+    unsigned int last_baud = BAUD_RATE;
+    // frames while the link is settled are checked, traced from the first one of each stretch
+    int checked_frames = 0;
+    bool tracing = false;
+    uint64_t frame_allocations = 0;
+    steady_clock::time_point start = steady_clock::now();
+    steady_clock::time_point next = start;
+    // the IMU emitter blends the last two frames, so in multirate a level only comes
+    // through unchanged once it was written twice, the probe starts on the second one
+    int hold = options.multirate ? 2 : 1;
+    int frame = 0;
+    int marker = 0;
+    // built once, a capture this size would otherwise be allocated every frame
+    std::function<void()> flight_model = [&]() {
+        // the flight model consumes whatever outputs were applied before it
+        if (options.in_loop) { CheckProbe(); }
+        trajectory((frame + 1) * dt);
+        Set("sim/flightmodel/position/P", Emulator::MarkerToGyro(marker) * 180 / std::numbers::pi);
+    };
+    for (int i = 0; i < frames && (Serial::IsOpen() || torn_down); i++) {
+        if (reconnects < options.reconnects && i == (reconnects + 1) * frames / (options.reconnects + 1)) {
+            // what X-Plane sends when another aircraft is loaded
+            last_version = Protocol::Version();
+            last_baud = Serial::GetBaudRate();
+            XPluginReceiveMessage(XPLM_PLUGIN_XPLANE, XPLM_MSG_PLANE_LOADED, nullptr);
+            torn_down = steady_clock::now();
+            reopened = false;
+            reconnects++;
+        }
+        if (torn_down && Serial::IsOpen()) {
+            int64_t since = duration_cast<microseconds>(steady_clock::now() - *torn_down).count();
+            if (!reopened) {
+                reopen_times.push_back(since);
+                reopened = true;
+            }
+            if (Protocol::Version() == last_version && Serial::GetBaudRate() == last_baud && !Serial::IsChangingBaudRate()) {
+                restore_times.push_back(since);
+                torn_down.reset();
+            }
+        }
+        // only once the version and speed were agreed, what leads up to it may allocate
+        bool settled = !torn_down && Protocol::Version() == std::min(options.emulator.version, PROTOCOL_VERSION) &&
+            (!Baud::IsEnabled() || Baud::IsSettled()) && !Serial::IsChangingBaudRate();
+        bool checking = options.alloc_check && settled;
+        if (checking != tracing) {
+            TraceAllocations(checking ? ALLOC_TRACES : 0);
+            tracing = checking;
+        }
+        uint64_t allocations = Allocations();
+        frame = i;
+        marker = (i / hold * MARKER_STRIDE) % MARKER_LEVELS;
+        RunFlightLoops(dt, flight_model);
+        if (i % hold == hold - 1) {
+            probes[marker] = { options.in_loop ? LoopTimes().sensors : steady_clock::now(), true };
+            sent++;
+        }
+        next += duration_cast<steady_clock::duration>(duration<float>(dt));
+        if (options.in_loop) {
+            std::this_thread::sleep_until(next);
+        }
+        // outputs are picked up as soon as they arrive rather than on the next frame,
+        // so the round trip does not include waiting for the sim
+        while (!options.in_loop && steady_clock::now() < next) {
+            Remote::Receive();
+            CheckProbe();
+            std::this_thread::sleep_for(PROBE_POLL);
+        }
+        if (checking) {
+            frame_allocations += Allocations() - allocations;
+            checked_frames++;
+        }
+    }
+    // only the frames are traced, not the report
+    TraceAllocations(0);
+    float elapsed = duration<float>(steady_clock::now() - start).count();
+    bool open = Serial::IsOpen();
+    int version = Protocol::Version();
+    uint8_t features = Protocol::Features();
+    serial_stats_t link = Serial::GetStats();
+    remote_stats_t remote = Remote::GetStats();
+    timesync_stats_t sync = Timesync::GetStats();
+    // what a soak test would watch, read back through the published datarefs
+    auto published = [](const char *name) { return XPLMGetDatai(Find(name)); };
+    std::string health = std::format("hitl/link: rx_frames {} rx_bad_frames {} rx_dropped {} rx_duplicates {} rx_resyncs {} rx_discarded_bytes {:.0f} rx_rate {:.0f} tx_rate {:.0f}",
+        published("hitl/link/rx_frames"), published("hitl/link/rx_bad_frames"), published("hitl/link/rx_dropped"),
+        published("hitl/link/rx_duplicates"), published("hitl/link/rx_resyncs"),
+        XPLMGetDatad(Find("hitl/link/rx_discarded_bytes")), XPLMGetDataf(Find("hitl/link/rx_rate")),
+        XPLMGetDataf(Find("hitl/link/tx_rate")));
+    int64_t offset = Emulator::Clock(Timesync::Now()) - Timesync::Now();
+    Serial::Disconnect();
+    Emulator::Stop();
+    emulator_stats_t emulator = Emulator::GetStats();
+    Recorder::Stop();
+    recorder_stats_t recorded = Recorder::GetStats();
+    Capture::Stop();
+    capture_stats_t captured = Capture::GetStats();
+
+    std::sort(latencies.begin(), latencies.end());
+    printf("%s", std::format("Loopback: {} probes at {} Hz in {:.1f} s, {}{}, protocol v{} features {:#04x}{}\n",
+        sent, options.rate, elapsed, options.multirate ? "multirate" : "single message",
+        options.in_loop ? options.single_phase ? ", outputs in the single phase loop" : ", outputs before the flight model" : "",
+        version, features, open ? "" : ", link closed by the plug-in").c_str());
+    std::string usage = options.transport == "pty" ?
+        std::format(", {:.0f}% of {} baud at the end", emulator.rx_bytes * 10 / elapsed / emulator.baud * 100, emulator.baud) :
+        std::format(" over {}", options.transport);
+    printf("%s", std::format("Plug-in to autopilot: {} bytes ({:.0f} B/s{}), {} frames, {} damaged, {} lost, {} dropped and {} stale before sending\n",
+        emulator.rx_bytes, emulator.rx_bytes / elapsed, usage, emulator.rx_frames, emulator.bad_frames,
+        emulator.lost_frames, link.tx_dropped_frames, link.tx_stale_frames).c_str());
+    uint64_t written = link.tx_frames - link.tx_stale_frames;
+    printf("%s", std::format("Writes: {} for {} frames, {:.2f} frames per write, {} cut short by the link\n",
+        link.tx_writes, written, link.tx_writes ? static_cast<double>(written) / link.tx_writes : 0.0,
+        link.tx_partial_writes).c_str());
+    if (options.reconnects > 0) {
+        std::sort(reopen_times.begin(), reopen_times.end());
+        std::sort(restore_times.begin(), restore_times.end());
+        printf("%s", std::format("Reconnects: {} of {} reopened, {} restarts reached the autopilot, p50 {} ms max {} ms, back to v{} at {} baud p50 {} ms max {} ms\n",
+            reopen_times.size(), reconnects, emulator.restarts,
+            reopen_times.empty() ? 0 : Percentile(reopen_times, 0.5) / 1000, reopen_times.empty() ? 0 : reopen_times.back() / 1000,
+            last_version, last_baud,
+            restore_times.empty() ? 0 : Percentile(restore_times, 0.5) / 1000, restore_times.empty() ? 0 : restore_times.back() / 1000).c_str());
+    }
+    printf("%s", std::format("Reads: bytes waited {} us on average, at most {} us, p99 <{:g} ms{}\n",
+        link.rx_wait_mean_us, link.rx_wait_max_us, link.rx_wait.Percentile(0.99) / 1000.0,
+        options.low_latency ? " in low latency mode" : "").c_str());
+    printf("%s", std::format("Autopilot to plug-in: {} frames sent, {} received, {} damaged, {} lost, {} duplicates, {} resyncs\n",
+        emulator.tx_frames, remote.frames, remote.bad_frames, remote.dropped, remote.duplicates, remote.resyncs).c_str());
+    printf("%s\n", health.c_str());
+    if (sync.synced) {
+        std::string drift = sync.drift_valid ? std::format("{:.1f} ppm", sync.drift_ppm) :
+            std::format("withheld after {:.0f} s", sync.drift_span_s);
+        printf("%s", std::format("Clock: offset error {} us, drift {} (emulated {:.1f}), last rtt {} us\n",
+            sync.offset_us - offset, drift, options.emulator.clock_drift_ppm, sync.rtt_us).c_str());
+        printf("%s", std::format("One way: up p50 <{:g} p99 <{:g} ms (emulator measured mean {:.2f} ms), down p50 <{:g} p99 <{:g} ms\n",
+            sync.uplink.Percentile(0.5) / 1000.0, sync.uplink.Percentile(0.99) / 1000.0,
+            emulator.uplink_frames ? emulator.uplink_total_us / 1000.0 / emulator.uplink_frames : 0.0,
+            sync.downlink.Percentile(0.5) / 1000.0, sync.downlink.Percentile(0.99) / 1000.0).c_str());
+    }
+    if (options.record) {
+        printf("%s", std::format("Recording: {} messages, {} bytes, {} dropped in {}\n",
+            recorded.records, recorded.bytes, recorded.dropped, Recorder::GetPath()).c_str());
+    }
+    if (options.capture) {
+        printf("%s", std::format("Capture: {} reads and writes, {} bytes, {} dropped in {}\n",
+            captured.chunks, captured.bytes, captured.dropped, Capture::GetPath()).c_str());
+    }
+    if (options.alloc_check) {
+        printf("%s", std::format("Allocations: {} on the sim thread in {} frames once the link settled\n",
+            frame_allocations, checked_frames).c_str());
+    }
+    if (latencies.empty()) {
+        printf("Round trip: no probe came back\n");
+    } else {
+        printf("%s", std::format("{}: {} of {} probes, p50 {} us, p99 {} us, p999 {} us, max {} us\n",
+            options.in_loop ? "Sensor capture to flight model" : "Round trip", latencies.size(), sent, Percentile(latencies, 0.5), Percentile(latencies, 0.99),
+            Percentile(latencies, 0.999), latencies.back()).c_str());
+    }
+    // every teardown restarts the autopilot
+    bool restarted = emulator.restarts >= static_cast<uint64_t>(reconnects);
+    // same sign and roughly the same size, a fit over too short a window misses both
+    double emulated = options.emulator.clock_drift_ppm;
+    bool drift_ok = !options.drift_check || (sync.drift_valid && sync.drift_ppm * emulated >= 0 &&
+        std::abs(sync.drift_ppm - emulated) <= std::max(std::abs(emulated) * DRIFT_TOLERANCE, static_cast<double>(TIMESYNC_DRIFT_MAX_ERROR)));
+    if (options.drift_check && !drift_ok) {
+        printf("%s", sync.drift_valid ? std::format("Drift check: fitted {:.1f} ppm against {:.1f} emulated\n", sync.drift_ppm, emulated).c_str() :
+            std::format("Drift check: still withheld, it takes more than {} s of timesync\n", TIMESYNC_DRIFT_MIN_SPAN).c_str());
+    }
+    return open && !latencies.empty() && frame_allocations == 0 && restarted && drift_ok ? 0 : 1;
+}
+
+// Match the roll output against the probes still in flight
+void Headless::CheckProbe() {
+    int marker = Emulator::RollToMarker(static_cast<float>(Get("sim/joystick/yoke_roll_ratio")));
+    if (marker < 0 || !probes[marker].pending) { return; }
+    probes[marker].pending = false;
+    auto latency = std::chrono::steady_clock::now() - probes[marker].sent;
+    latencies.push_back(std::chrono::duration_cast<std::chrono::microseconds>(latency).count());
+}
+
+int64_t Headless::Percentile(const std::vector<int64_t> &sorted, double p) {
+    size_t i = std::min(sorted.size() - 1, static_cast<size_t>(p * sorted.size()));
+    return sorted[i];
+}
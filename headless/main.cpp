@@ -0,0 +1,406 @@
+#include <XPLMPlugin.h>
+#include <Eigen/Geometry>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include <string>
+#include <format>
+#include <numbers>
+#include <algorithm>
+#include <functional>
+#include <filesystem>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <termios.h>
+#include <sys/uio.h>
+#include "headless.hpp"
+#include "../messages.hpp"
+#include "../calibration.hpp"
+#include "../remote.hpp"
+#include "../serial.hpp"
+#include "../telemetry.hpp"
+#include "../config.hpp"
+
+// Headless driver, runs the plug-in against the in-memory SDK
+//   hitl-headless [--rate hz] [--seconds s] [--trajectory level|circle|climb]
+//                 [--realtime] [--bench iterations] [--quiet] [--keep-config]
+//   hitl-headless --loopback [--transport pty|tcp|udp] [--multirate] [--low-latency] [--imu-rate hz] [--heli] [--version n] [--no-compact] [--baud max] [--clean-baud rate] [--reconnect n] [--alloc-check] [--record] [--capture]
+//                 [--state-rate hz] [--actuator-rate hz] [--ping-rate hz] [--clock-drift ppm] [--drift-check]
+//   hitl-headless --replay file [--to address] [--speed x|max] [--from time] [--until time] [--transport pty|tcp|udp] [emulator options]
+//   hitl-headless --convert file [--out folder] [--threads n] [--from time] [--until time]
+
+PLUGIN_API int XPluginStart(char *outName, char *outSig, char *outDesc);
+PLUGIN_API void XPluginStop(void);
+
+#define EARTH_RADIUS 6378137.0
+#define GRAVITY 9.80665
+#define CRUISE_SPEED 30.0 // m/s
+#define CIRCLE_RADIUS 300.0 // m
+#define CLIMB_RATE 3.0 // m/s
+// bulk endpoint of a full speed USB CDC serial port
+#define USB_PACKET_SIZE 64
+
+namespace Headless {
+    // Position and body motion in a local north east down frame
+    struct state_t {
+        Eigen::Vector3d ned;
+        Eigen::Vector3d vel;
+        double yaw;
+        double yaw_rate;
+        double pitch;
+    };
+    void Write(const state_t &state);
+    void Defaults();
+    void Bench(const options_t &options);
+    void BenchWrites(int iterations);
+    double ParseTime(const char *text);
+}
+
+// Write a local state into every dataref the plug-in reads
+void Headless::Write(const state_t &state) {
+    double lat0 = -33.45 * std::numbers::pi / 180;
+    double lon0 = -70.66 * std::numbers::pi / 180;
+    Set("sim/flightmodel/position/latitude", (lat0 + state.ned.x() / EARTH_RADIUS) * 180 / std::numbers::pi);
+    Set("sim/flightmodel/position/longitude", (lon0 + state.ned.y() / (EARTH_RADIUS * std::cos(lat0))) * 180 / std::numbers::pi);
+    Set("sim/flightmodel/position/elevation", 500 - state.ned.z());
+    // OpenGL local frame is east up south
+    Set("sim/flightmodel/position/local_x", state.ned.y());
+    Set("sim/flightmodel/position/local_y", 500 - state.ned.z());
+    Set("sim/flightmodel/position/local_z", -state.ned.x());
+    Set("sim/flightmodel/position/local_vx", state.vel.y());
+    Set("sim/flightmodel/position/local_vy", -state.vel.z());
+    Set("sim/flightmodel/position/local_vz", -state.vel.x());
+    double speed = state.vel.norm();
+    Set("sim/flightmodel/position/groundspeed", std::hypot(state.vel.x(), state.vel.y()));
+    Set("sim/flightmodel/position/true_airspeed", speed);
+    // coordinated turn
+    double roll = std::atan2(speed * state.yaw_rate, GRAVITY);
+    Eigen::Quaterniond q =
+        Eigen::AngleAxisd(state.yaw, Eigen::Vector3d::UnitZ()) *
+        Eigen::AngleAxisd(state.pitch, Eigen::Vector3d::UnitY()) *
+        Eigen::AngleAxisd(roll, Eigen::Vector3d::UnitX());
+    Set("sim/flightmodel/position/q", q.w(), 0);
+    Set("sim/flightmodel/position/q", q.x(), 1);
+    Set("sim/flightmodel/position/q", q.y(), 2);
+    Set("sim/flightmodel/position/q", q.z(), 3);
+    Set("sim/flightmodel/position/psi", state.yaw * 180 / std::numbers::pi);
+    Eigen::Vector3d rates = q.conjugate() * Eigen::Vector3d(0, 0, state.yaw_rate);
+    Set("sim/flightmodel/position/P", rates.x() * 180 / std::numbers::pi);
+    Set("sim/flightmodel/position/Q", rates.y() * 180 / std::numbers::pi);
+    Set("sim/flightmodel/position/R", rates.z() * 180 / std::numbers::pi);
+    // load factor in g, body frame
+    Eigen::Vector3d g = q.conjugate() * Eigen::Vector3d(0, 0, -1.0 / std::cos(roll));
+    Set("sim/flightmodel/forces/g_axil", -g.x());
+    Set("sim/flightmodel/forces/g_side", -g.y());
+    Set("sim/flightmodel/forces/g_nrml", -g.z());
+    double altitude = 500 - state.ned.z();
+    Set("sim/weather/barometer_current_inhg", 29.92 * std::pow(1 - 2.25577e-5 * altitude, 5.25588));
+    Set("sim/weather/temperature_ambient_c", 15 - 0.0065 * altitude);
+    Set("sim/weather/rho", 1.225 * std::pow(1 - 2.25577e-5 * altitude, 4.25588));
+    Set("sim/time/local_time_sec", 43200 + ElapsedTime());
+}
+
+// Constant datarefs of a single engine airplane
+void Headless::Defaults() {
+    Set("sim/time/local_date_days", 180);
+    Set("sim/flightmodel/engine/ENGN_running", 1);
+    Set("sim/flightmodel/engine/ENGN_tacrad", 250);
+    Set("sim/flightmodel/engine/ENGN_power", 60000);
+    Set("sim/aircraft/engine/acf_pmax_per_engine", 100000);
+    Set("sim/flightmodel/engine/ENGN_thro_use", 0.6);
+    Set("sim/aircraft/weight/acf_m_fuel_tot", 100);
+    Set("sim/flightmodel/weight/m_fuel_total", 80);
+    Set("sim/cockpit2/engine/indicators/fuel_flow_kg_sec", 0.005);
+    Set("sim/aircraft/prop/acf_max_pitch", 30);
+    Set("sim/aircraft/prop/acf_min_pitch", 10);
+    Set("sim/aircraft/parts/acf_semilen_JND", 5);
+}
+
+Headless::trajectory_t Headless::Trajectory(const std::string &name) {
+    if (name == "level") {
+        return [](double t) {
+            Write({ { CRUISE_SPEED * t, 0, 0 }, { CRUISE_SPEED, 0, 0 }, 0, 0, 0 });
+        };
+    } else if (name == "climb") {
+        return [](double t) {
+            double pitch = std::asin(CLIMB_RATE / CRUISE_SPEED);
+            double ground = CRUISE_SPEED * std::cos(pitch);
+            Write({ { ground * t, 0, -CLIMB_RATE * t }, { ground, 0, -CLIMB_RATE }, 0, 0, pitch });
+        };
+    } else if (name == "circle") {
+        return [](double t) {
+            double rate = CRUISE_SPEED / CIRCLE_RADIUS;
+            double yaw = rate * t;
+            Write({
+                { CIRCLE_RADIUS * std::sin(yaw), CIRCLE_RADIUS * (1 - std::cos(yaw)), 0 },
+                { CRUISE_SPEED * std::cos(yaw), CRUISE_SPEED * std::sin(yaw), 0 },
+                yaw, rate, 0 });
+        };
+    }
+    return nullptr;
+}
+
+// Time a function over a number of iterations and print percentiles
+void Measure(const char *name, int iterations, const std::function<void()> &fn) {
+    std::vector<int64_t> samples(iterations);
+    for (int i = 0; i < iterations; i++) {
+        auto start = std::chrono::steady_clock::now();
+        fn();
+        auto end = std::chrono::steady_clock::now();
+        samples[i] = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+    }
+    std::sort(samples.begin(), samples.end());
+    double mean = 0;
+    for (int64_t s : samples) { mean += s; }
+    mean /= iterations;
+    printf("%s", std::format("{:<24} mean {:>8.0f} ns  p50 {:>8} ns  p99 {:>8} ns  max {:>8} ns\n",
+        name, mean, samples[iterations / 2], samples[iterations * 99 / 100], samples.back()).c_str());
+}
+
+void Headless::Bench(const options_t &options) {
+    trajectory_t trajectory = Trajectory(options.trajectory);
+    float dt = 1.0f / options.rate;
+    int step = 0;
+    auto advance = [&]() {
+        RunFlightLoops(dt, [&]() { trajectory(++step * dt); });
+    };
+    // serial is closed so these measure everything but the port itself
+    Measure("Loop", options.bench, advance);
+    Measure("Telemetry::ReadSnapshot", options.bench, []() { Telemetry::ReadSnapshot(); });
+    Measure("Telemetry::Send", options.bench, [&]() { Telemetry::Send(dt); });
+    Measure("Remote::Receive", options.bench, []() { Remote::Receive(); });
+    Calibration::Toggle();
+    Measure("Calibration::Loop", options.bench, [&]() { Calibration::Loop(dt); });
+    Calibration::Toggle();
+    BenchWrites(options.bench);
+}
+
+// A v1 SENSORS frame written to a pty one piece at a time, assembled into a single
+// write, or gathered by writev. USB CDC drivers turn every write into its own run of
+// packets ending in a short one, so pieces written apart cost extra packets
+void Headless::BenchWrites(int iterations) {
+    int master = posix_openpt(O_RDWR | O_NOCTTY | O_NONBLOCK);
+    if (master < 0 || grantpt(master) != 0 || unlockpt(master) != 0) { return; }
+    int slave = open(ptsname(master), O_RDWR | O_NOCTTY);
+    if (slave < 0) {
+        close(master);
+        return;
+    }
+    termios raw;
+    tcgetattr(slave, &raw);
+    cfmakeraw(&raw);
+    tcsetattr(slave, TCSANOW, &raw);
+    struct {
+        char header[4] = { 'H', 'I', 'T', 'L' };
+        int type = Telemetry::SENSORS;
+    } header;
+    sensors_msg_t msg = {};
+    struct {
+        int len = sizeof(header) + sizeof(msg);
+        char postamble[3] = { 'E','N','D' };
+    } footer;
+    iovec pieces[] = {
+        { &header, sizeof(header) },
+        { &msg, sizeof(msg) },
+        { &footer, sizeof(footer) }
+    };
+    uint8_t frame[sizeof(header) + sizeof(msg) + sizeof(footer)];
+    uint8_t drain[sizeof(frame)];
+    uint64_t syscalls = 0;
+    uint64_t packets = 0;
+    auto count = [&](size_t bytes) {
+        syscalls++;
+        packets += (bytes + USB_PACKET_SIZE - 1) / USB_PACKET_SIZE;
+    };
+    auto report = [&](const char *name, std::function<void()> send) {
+        syscalls = 0;
+        packets = 0;
+        // the master side is read right away so the pty never fills up
+        Measure(name, iterations, [&]() {
+            send();
+            while (read(master, drain, sizeof(drain)) > 0) {}
+        });
+        printf("%s", std::format("{:<24} {:.0f} syscalls {:.0f} USB packets per {} byte frame\n",
+            "", static_cast<double>(syscalls) / iterations, static_cast<double>(packets) / iterations, sizeof(frame)).c_str());
+    };
+    report("Write per piece", [&]() {
+        for (const iovec &piece : pieces) {
+            write(slave, piece.iov_base, piece.iov_len);
+            count(piece.iov_len);
+        }
+    });
+    report("Write assembled", [&]() {
+        size_t len = 0;
+        for (const iovec &piece : pieces) {
+            memcpy(&frame[len], piece.iov_base, piece.iov_len);
+            len += piece.iov_len;
+        }
+        write(slave, frame, len);
+        count(len);
+    });
+    report("Writev", [&]() {
+        writev(slave, pieces, 3);
+        count(sizeof(frame));
+    });
+    close(slave);
+    close(master);
+}
+
+// Seconds, m:s or h:m:s since the recording started, T+02:13:05 works too
+double Headless::ParseTime(const char *text) {
+    if (strncmp(text, "T+", 2) == 0) {
+        text += 2;
+    }
+    double seconds = 0;
+    char *end = const_cast<char *>(text);
+    do {
+        seconds = seconds * 60 + strtod(*end == ':' ? end + 1 : end, &end);
+    } while (*end == ':');
+    return std::max(0.0, seconds);
+}
+
+int main(int argc, char **argv) {
+    Headless::options_t options;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        bool value = i + 1 < argc;
+        if (arg == "--rate" && value) {
+            options.rate = std::max(1.0f, strtof(argv[++i], nullptr));
+        } else if (arg == "--seconds" && value) {
+            options.seconds = strtof(argv[++i], nullptr);
+        } else if (arg == "--trajectory" && value) {
+            options.trajectory = argv[++i];
+        } else if (arg == "--bench" && value) {
+            options.bench = std::max(1, atoi(argv[++i]));
+        } else if (arg == "--realtime") {
+            options.realtime = true;
+        } else if (arg == "--quiet") {
+            options.quiet = true;
+        } else if (arg == "--keep-config") {
+            options.keep_config = true;
+        } else if (arg == "--alloc-check") {
+            options.alloc_check = true;
+        } else if (arg == "--drift-check") {
+            options.drift_check = true;
+        } else if (arg == "--record") {
+            options.record = true;
+        } else if (arg == "--capture") {
+            options.capture = true;
+        } else if (arg == "--replay" && value) {
+            options.replay = argv[++i];
+        } else if (arg == "--to" && value) {
+            options.replay_to = argv[++i];
+        } else if (arg == "--speed" && value) {
+            i++;
+            options.replay_speed = strcmp(argv[i], "max") == 0 ? 0 : std::max(0.01f, strtof(argv[i], nullptr));
+        } else if (arg == "--from" && value) {
+            options.from = Headless::ParseTime(argv[++i]);
+        } else if (arg == "--until" && value) {
+            options.until = Headless::ParseTime(argv[++i]);
+        } else if (arg == "--convert" && value) {
+            options.convert = argv[++i];
+        } else if (arg == "--out" && value) {
+            options.convert_out = argv[++i];
+        } else if (arg == "--threads" && value) {
+            options.threads = std::max(0, atoi(argv[++i]));
+        } else if (arg == "--reconnect" && value) {
+            options.reconnects = std::max(0, atoi(argv[++i]));
+        } else if (arg == "--loopback") {
+            options.loopback = true;
+        } else if (arg == "--transport" && value) {
+            options.transport = argv[++i];
+        } else if (arg == "--in-loop") {
+            options.in_loop = true;
+        } else if (arg == "--single-phase") {
+            options.single_phase = true;
+        } else if (arg == "--multirate") {
+            options.multirate = true;
+        } else if (arg == "--low-latency") {
+            options.low_latency = true;
+        } else if (arg == "--imu-rate" && value) {
+            options.imu_rate = strtof(argv[++i], nullptr);
+        } else if (arg == "--heli") {
+            options.emulator.heli = true;
+        } else if (arg == "--version" && value) {
+            options.emulator.version = atoi(argv[++i]);
+        } else if (arg == "--no-compact") {
+            options.emulator.features &= ~FEATURE_COMPACT;
+        } else if (arg == "--baud" && value) {
+            options.emulator.max_baud = std::max(1, atoi(argv[++i]));
+        } else if (arg == "--clean-baud" && value) {
+            options.emulator.clean_baud = std::max(1, atoi(argv[++i]));
+        } else if (arg == "--state-rate" && value) {
+            options.emulator.state_rate = strtof(argv[++i], nullptr);
+        } else if (arg == "--actuator-rate" && value) {
+            options.emulator.actuator_rate = strtof(argv[++i], nullptr);
+        } else if (arg == "--corrupt" && value) {
+            options.emulator.corrupt_every = atoi(argv[++i]);
+        } else if (arg == "--duplicate" && value) {
+            options.emulator.duplicate_every = atoi(argv[++i]);
+        } else if (arg == "--ping-rate" && value) {
+            options.emulator.ping_rate = strtof(argv[++i], nullptr);
+        } else if (arg == "--clock-drift" && value) {
+            options.emulator.clock_drift_ppm = strtod(argv[++i], nullptr);
+        } else {
+            fprintf(stderr, "usage: %s [--rate hz] [--seconds s] [--trajectory level|circle|climb] [--realtime] [--bench iterations] [--quiet] [--keep-config]\n"
+                "       [--loopback] [--transport pty|tcp|udp] [--multirate] [--low-latency] [--imu-rate hz] [--heli] [--version n] [--no-compact] [--baud max] [--clean-baud rate] [--reconnect n] [--alloc-check] [--record] [--capture]\n"
+                "       [--in-loop] [--single-phase] [--state-rate hz] [--actuator-rate hz] [--ping-rate hz] [--clock-drift ppm] [--drift-check] [--corrupt n] [--duplicate n]\n"
+                "       [--replay file] [--to address] [--speed x|max] [--from time] [--until time]\n"
+                "       [--convert file] [--out folder] [--threads n] [--from time] [--until time]\n", argv[0]);
+            return 1;
+        }
+    }
+    // works on the file alone, the plug-in is not started
+    if (!options.convert.empty()) {
+        return Headless::Convert(options);
+    }
+    Headless::trajectory_t trajectory = Headless::Trajectory(options.trajectory);
+    if (!trajectory) {
+        fprintf(stderr, "unknown trajectory %s\n", options.trajectory.c_str());
+        return 1;
+    }
+    Headless::SetVerbose(!options.quiet);
+    Headless::SetSinglePhase(options.single_phase);
+    Headless::Defaults();
+    trajectory(0);
+    // a fat plug-in layout in the temp folder, the config file ends up above the 64 folder
+    std::filesystem::path folder = std::filesystem::temp_directory_path() / "hitl-headless";
+    std::filesystem::create_directories(folder / "64");
+    Headless::SetPluginPath((folder / "64" / "lin.xpl").string());
+    if (!options.keep_config) {
+        std::filesystem::remove(folder / CONFIG_FILE);
+    }
+
+    char name[256], sig[256], desc[256];
+    XPluginStart(name, sig, desc);
+
+    int code = 0;
+    if (!options.replay.empty()) {
+        code = Headless::Replay(options);
+    } else if (options.loopback) {
+        code = Headless::Loopback(options);
+    } else if (options.bench > 0) {
+        Headless::SetVerbose(false);
+        Headless::Bench(options);
+    } else {
+        float dt = 1.0f / options.rate;
+        int frames = static_cast<int>(options.seconds * options.rate);
+        auto next = std::chrono::steady_clock::now();
+        for (int i = 1; i <= frames; i++) {
+            Headless::RunFlightLoops(dt, [&]() { trajectory(i * dt); });
+            if (options.realtime) {
+                next += std::chrono::microseconds(static_cast<int64_t>(dt * 1e6));
+                std::this_thread::sleep_until(next);
+            }
+        }
+        serial_stats_t stats = Serial::GetStats();
+        printf("%s", std::format("{} frames of {} at {} Hz, {} bytes sent, {} received\n",
+            frames, options.trajectory, options.rate, stats.tx_bytes, stats.rx_bytes).c_str());
+    }
+
+    XPluginStop();
+    return code;
+}
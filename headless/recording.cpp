@@ -0,0 +1,205 @@
+#include <algorithm>
+#include <iterator>
+#include <cstring>
+#include "recording.hpp"
+
+// Without an index a time is found by halving the file down to this many bytes
+#define RECORDING_BISECT_SIZE (64 * 1024)
+
+namespace Recording {
+    void Keep(recording_t &recording, const record_t &record, const uint8_t *payload);
+    bool IsChained(const uint8_t *data, size_t bytes, size_t offset, bool last);
+}
+
+// Version 1 files have no keyframes or index and are read all the same
+bool Recording::Open(recording_t &recording, const std::string &path) {
+    const char magic[] = RECORDER_MAGIC;
+    const char index_magic[] = RECORDER_INDEX_MAGIC;
+    recording.file.open(path, std::ios::binary);
+    recording.file.read(reinterpret_cast<char *>(&recording.header), sizeof(recording.header));
+    if (!recording.file || memcmp(recording.header.magic, magic, sizeof(magic)) != 0 ||
+        recording.header.version == 0 || recording.header.version > RECORDER_VERSION) {
+        return false;
+    }
+    recording.file.seekg(0, std::ios::end);
+    recording.end = static_cast<uint64_t>(recording.file.tellg());
+    recording.offset = sizeof(recording.header);
+    recording.index.clear();
+    recording.seeking = false;
+    recording.pending_count = 0;
+    recording.pending_next = 0;
+    recording_footer_t footer;
+    if (recording.end >= sizeof(recording.header) + sizeof(footer)) {
+        recording.file.seekg(recording.end - sizeof(footer));
+        recording.file.read(reinterpret_cast<char *>(&footer), sizeof(footer));
+        uint64_t bytes = static_cast<uint64_t>(footer.count) * sizeof(recording_index_t);
+        if (recording.file && memcmp(footer.magic, index_magic, sizeof(index_magic)) == 0 &&
+            footer.offset >= sizeof(recording.header) && footer.offset + bytes + sizeof(footer) == recording.end) {
+            recording.index.resize(footer.count);
+            recording.file.seekg(footer.offset);
+            recording.file.read(reinterpret_cast<char *>(recording.index.data()), bytes);
+            if (recording.file) {
+                recording.end = footer.offset;
+            } else {
+                recording.index.clear();
+            }
+        }
+    }
+    recording.file.clear();
+    recording.file.seekg(recording.offset);
+    return true;
+}
+
+bool Recording::Next(recording_t &recording) {
+    if (recording.pending_next < recording.pending_count) {
+        const recording_t::last_t &message = *recording.pending[recording.pending_next++];
+        recording.record = message.record;
+        memcpy(recording.payload, message.payload, message.record.size);
+        return true;
+    }
+    while (recording.offset + sizeof(record_t) <= recording.end) {
+        record_t &record = recording.record;
+        if (!recording.file.read(reinterpret_cast<char *>(&record), sizeof(record))) { return false; }
+        if (!IsValid(record) || recording.offset + sizeof(record) + record.size > recording.end) { return false; }
+        uint8_t *payload = record.direction == RECORD_KEYFRAME ? recording.keyframe : recording.payload;
+        if (!recording.file.read(reinterpret_cast<char *>(payload), record.size)) { return false; }
+        recording.offset += sizeof(record) + record.size;
+        if (record.direction == RECORD_KEYFRAME) {
+            for (size_t i = 0; recording.seeking && i + sizeof(record_t) <= record.size;) {
+                record_t message;
+                memcpy(&message, payload + i, sizeof(message));
+                if (message.size > PROTOCOL_MAX_PAYLOAD) { break; }
+                Keep(recording, message, payload + i + sizeof(message));
+                i += sizeof(message) + message.size;
+            }
+            continue;
+        }
+        if (!recording.seeking) { return true; }
+        if (record.time_us < recording.from_us) {
+            Keep(recording, record, payload);
+            continue;
+        }
+        // the state in the order it was recorded, then this record
+        recording.seeking = false;
+        recording.pending_count = 0;
+        recording.pending_next = 0;
+        for (auto &types : recording.last) {
+            for (recording_t::last_t &message : types) {
+                if (!message.valid) { continue; }
+                message.record.time_us = recording.from_us;
+                recording.pending[recording.pending_count++] = &message;
+            }
+        }
+        std::sort(recording.pending, recording.pending + recording.pending_count,
+            [](const recording_t::last_t *a, const recording_t::last_t *b) { return a->record.seq < b->record.seq; });
+        recording.held.record = record;
+        memcpy(recording.held.payload, payload, record.size);
+        recording.pending[recording.pending_count++] = &recording.held;
+        return Next(recording);
+    }
+    return false;
+}
+
+void Recording::Keep(recording_t &recording, const record_t &record, const uint8_t *payload) {
+    if (record.direction > RECORD_RECEIVED || record.type >= Telemetry::MSG_COUNT) { return; }
+    recording_t::last_t &message = recording.last[record.direction][record.type];
+    message.record = record;
+    memcpy(message.payload, payload, record.size);
+    message.valid = true;
+}
+
+// Reading starts far enough back to pass a keyframe even without the index
+void Recording::Seek(recording_t &recording, uint64_t time_us) {
+    uint64_t margin = 2 * RECORDER_KEYFRAME_PERIOD * 1000;
+    uint64_t begin;
+    uint64_t end;
+    Locate(recording, time_us > margin ? time_us - margin : 0, begin, end);
+    for (auto &types : recording.last) {
+        for (recording_t::last_t &message : types) {
+            message.valid = false;
+        }
+    }
+    recording.pending_count = 0;
+    recording.pending_next = 0;
+    recording.from_us = recording.header.start_us + time_us;
+    recording.seeking = true;
+    recording.offset = begin;
+    recording.file.clear();
+    recording.file.seekg(begin);
+}
+
+// Records are in time order, so without an index the file is halved until the range is small
+void Recording::Locate(recording_t &recording, uint64_t time_us, uint64_t &begin, uint64_t &end) {
+    uint64_t time = recording.header.start_us + time_us;
+    begin = sizeof(recording_header_t);
+    end = recording.end;
+    if (!recording.index.empty()) {
+        auto after = std::lower_bound(recording.index.begin(), recording.index.end(), time,
+            [](const recording_index_t &keyframe, uint64_t time) { return keyframe.time_us < time; });
+        if (after != recording.index.begin()) {
+            begin = std::prev(after)->offset;
+        }
+        if (after != recording.index.end()) {
+            end = after->offset;
+        }
+        return;
+    }
+    while (end - begin > RECORDING_BISECT_SIZE) {
+        uint64_t middle = Sync(recording.file, begin + (end - begin) / 2, recording.end);
+        if (middle >= end) { break; }
+        record_t record;
+        recording.file.clear();
+        recording.file.seekg(middle);
+        if (!recording.file.read(reinterpret_cast<char *>(&record), sizeof(record))) { break; }
+        if (record.time_us < time) {
+            begin = middle;
+        } else {
+            end = middle;
+        }
+    }
+    recording.file.clear();
+    recording.file.seekg(recording.offset);
+}
+
+// Anything found in the same place is a boundary, so two readers looking from the same
+// offset agree on it
+uint64_t Recording::Sync(std::ifstream &file, uint64_t offset, uint64_t end) {
+    if (offset >= end) { return end; }
+    std::vector<uint8_t> window(static_cast<size_t>(std::min<uint64_t>(RECORDING_SYNC_WINDOW, end - offset)));
+    file.clear();
+    file.seekg(offset);
+    file.read(reinterpret_cast<char *>(window.data()), window.size());
+    size_t bytes = static_cast<size_t>(file.gcount());
+    bool last = offset + bytes >= end;
+    for (size_t i = 0; i < bytes; i++) {
+        if (IsChained(window.data(), bytes, i, last)) { return offset + i; }
+    }
+    return end;
+}
+
+bool Recording::IsChained(const uint8_t *data, size_t bytes, size_t offset, bool last) {
+    uint32_t seq = 0;
+    for (int i = 0; i < RECORDING_SYNC_RECORDS; i++) {
+        // the records end right after
+        if (i > 0 && offset == bytes && last) { return true; }
+        if (offset + sizeof(record_t) > bytes) { return false; }
+        record_t record;
+        memcpy(&record, data + offset, sizeof(record));
+        if (!IsValid(record) || (i > 0 && record.seq != seq + 1)) { return false; }
+        seq = record.seq;
+        offset += sizeof(record) + record.size;
+    }
+    return true;
+}
+
+bool Recording::IsValid(const record_t &record) {
+    switch (record.direction) {
+    case RECORD_SENT:
+        return record.type < Telemetry::MSG_COUNT && record.size <= PROTOCOL_MAX_PAYLOAD;
+    case RECORD_RECEIVED:
+        return record.type < Remote::MSG_COUNT && record.size <= PROTOCOL_MAX_PAYLOAD;
+    case RECORD_KEYFRAME:
+        return record.type == 0 && record.size <= RECORDER_KEYFRAME_SIZE;
+    }
+    return false;
+}
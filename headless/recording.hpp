@@ -0,0 +1,59 @@
+#pragma once
+#include <fstream>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include "../recorder.hpp"
+#include "../protocol.hpp"
+
+// A record boundary is where this many records follow each other in sequence, searched
+// for within RECORDING_SYNC_WINDOW bytes
+#define RECORDING_SYNC_RECORDS 4
+#define RECORDING_SYNC_WINDOW (1024 * 1024)
+
+// Sequential reader of the files written by recorder.cpp
+struct recording_t {
+    std::ifstream file;
+    recording_header_t header;
+    // what Next read last
+    record_t record;
+    uint8_t payload[PROTOCOL_MAX_PAYLOAD];
+    // where the next record is read from and where the records end, the index follows them
+    uint64_t offset;
+    uint64_t end;
+    std::vector<recording_index_t> index;
+    // after Seek, the state at from_us is put together from the keyframe before it and
+    // the records since, then handed out before the first record at from_us or later
+    struct last_t {
+        record_t record;
+        uint8_t payload[PROTOCOL_MAX_PAYLOAD];
+        bool valid;
+    };
+    last_t last[2][Telemetry::MSG_COUNT];
+    const last_t *pending[2 * Telemetry::MSG_COUNT + 1];
+    int pending_count;
+    int pending_next;
+    // the first record from from_us on, handed out after the state
+    last_t held;
+    uint64_t from_us;
+    bool seeking;
+    uint8_t keyframe[RECORDER_KEYFRAME_SIZE];
+};
+
+namespace Recording {
+    // false if the file can't be read or is not a recording
+    bool Open(recording_t &recording, const std::string &path);
+    // false at the end, a record cut short when the plug-in stopped ends the file too.
+    // Keyframes are not handed out
+    bool Next(recording_t &recording);
+    // Read from time_us since the recording started, Next starts with the last message of
+    // every type before then, stamped with that time
+    void Seek(recording_t &recording, uint64_t time_us);
+    // Byte range around the first record at time_us since the recording started or later,
+    // every record before begin is earlier and no record from end on is
+    void Locate(recording_t &recording, uint64_t time_us, uint64_t &begin, uint64_t &end);
+    // First record at or after offset, taken as one when the records after it follow in
+    // sequence. end if there is none within RECORDING_SYNC_WINDOW
+    uint64_t Sync(std::ifstream &file, uint64_t offset, uint64_t end);
+    bool IsValid(const record_t &record);
+}
@@ -0,0 +1,238 @@
+#include <chrono>
+#include <thread>
+#include <format>
+#include <vector>
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iterator>
+#include "headless.hpp"
+#include "emulator.hpp"
+#include "recording.hpp"
+#include "../serial.hpp"
+#include "../remote.hpp"
+#include "../telemetry.hpp"
+#include "../protocol.hpp"
+#include "../recorder.hpp"
+#include "../baud.hpp"
+
+// The link is negotiated before the first message goes out so the whole stream is sent
+// the same way. Without an answer to the version offer it is replayed over v1
+#define REPLAY_V1_WAIT 3.0f // s
+#define REPLAY_SETTLE_TIMEOUT 15.0f // s
+// responses to the last messages are still collected for this long (s)
+#define REPLAY_DRAIN 0.5f
+#define REPLAY_POLL std::chrono::microseconds(200)
+// a response of the replay is compared with the closest one of the recording within this (us)
+#define REPLAY_MATCH_WINDOW 20000
+
+namespace Headless {
+    // PLANE or HELI from the autopilot, PWM per channel
+    struct response_t {
+        int64_t time_us;
+        uint8_t type;
+        uint8_t channels;
+        uint16_t pwm[8];
+    };
+    // one pass over a recording, times are relative to the first data message sent
+    struct session_t {
+        std::vector<int64_t> sent;
+        // with the index of the last data message sent before it
+        std::vector<std::pair<response_t, int64_t>> responses;
+    };
+    void Upkeep(std::chrono::steady_clock::time_point &last);
+    bool IsLinkMessage(int type);
+    bool IsCompact(int type);
+    // from and until in us since the recording started, until 0 is the end
+    bool Collect(const std::string &path, session_t &session, uint64_t from_us = 0, uint64_t until_us = 0);
+    void Compare(const session_t &original, const session_t &replay, float speed);
+}
+
+int Headless::Replay(const options_t &options) {
+    using namespace std::chrono;
+    recording_t input;
+    if (!Recording::Open(input, options.replay)) {
+        fprintf(stderr, "%s is not a recording\n", options.replay.c_str());
+        return 1;
+    }
+    uint64_t from_us = static_cast<uint64_t>(options.from * 1e6);
+    uint64_t until_us = static_cast<uint64_t>(options.until * 1e6);
+    std::string address = options.replay_to;
+    bool emulated = address.empty();
+    if (emulated) {
+        address = Emulator::Open(options.transport);
+        if (address.empty()) {
+            fprintf(stderr, "could not create the %s link\n", options.transport.c_str());
+            return 1;
+        }
+        Emulator::Start(options.emulator);
+    }
+    Serial::Connect(address);
+    if (!Serial::IsOpen() || !Recorder::Start()) {
+        Serial::Disconnect();
+        if (emulated) { Emulator::Stop(); }
+        fprintf(stderr, "could not open %s\n", address.c_str());
+        return 1;
+    }
+    steady_clock::time_point last = steady_clock::now();
+    steady_clock::time_point start = last;
+    while (Serial::IsOpen()) {
+        float waited = duration<float>(steady_clock::now() - start).count();
+        bool settled = Protocol::Version() >= 2 ? Baud::IsSettled() : waited > REPLAY_V1_WAIT;
+        if (settled || waited > REPLAY_SETTLE_TIMEOUT) { break; }
+        Upkeep(last);
+        std::this_thread::sleep_for(REPLAY_POLL);
+    }
+    float negotiation = duration<float>(steady_clock::now() - start).count();
+
+    float speed = options.replay_speed;
+    uint64_t first = 0;
+    int replayed = 0;
+    int unsupported = 0;
+    start = steady_clock::now();
+    // the state at from goes out first, then the records from there on
+    if (from_us > 0) {
+        Recording::Seek(input, from_us);
+    }
+    while (Serial::IsOpen() && Recording::Next(input)) {
+        const record_t &record = input.record;
+        if (until_us > 0 && record.time_us >= input.header.start_us + until_us) { break; }
+        if (record.direction != RECORD_SENT || IsLinkMessage(record.type)) { continue; }
+        if (IsCompact(record.type) && !(Protocol::Features() & FEATURE_COMPACT)) {
+            unsupported++;
+            continue;
+        }
+        if (replayed == 0) {
+            first = record.time_us;
+            start = steady_clock::now();
+        }
+        if (speed > 0) {
+            steady_clock::time_point due = start +
+                duration_cast<steady_clock::duration>(duration<double, std::micro>((record.time_us - first) / speed));
+            while (Serial::IsOpen() && steady_clock::now() < due) {
+                Upkeep(last);
+                std::this_thread::sleep_for(std::min<steady_clock::duration>(REPLAY_POLL, due - steady_clock::now()));
+            }
+        } else {
+            // a queued message would be replaced by a newer one of its type, as it is
+            // when the sim outruns the link, so each one waits for the last to leave
+            while (Serial::IsOpen() && Serial::Queued() > 0) {
+                Upkeep(last);
+                std::this_thread::sleep_for(REPLAY_POLL);
+            }
+        }
+        Telemetry::Replay(static_cast<Telemetry::MSG_TYPE>(record.type), input.payload, record.size);
+        Upkeep(last);
+        replayed++;
+    }
+    float elapsed = duration<float>(steady_clock::now() - start).count();
+    steady_clock::time_point drain = steady_clock::now() + duration_cast<steady_clock::duration>(duration<float>(REPLAY_DRAIN));
+    while (Serial::IsOpen() && steady_clock::now() < drain) {
+        Upkeep(last);
+        std::this_thread::sleep_for(REPLAY_POLL);
+    }
+    bool open = Serial::IsOpen();
+    int version = Protocol::Version();
+    uint8_t features = Protocol::Features();
+    unsigned int baud = Serial::GetBaudRate();
+    bool serial = Serial::HasBaudRate();
+    serial_stats_t link = Serial::GetStats();
+    Serial::Disconnect();
+    if (emulated) { Emulator::Stop(); }
+    Recorder::Stop();
+
+    printf("%s", std::format("Replay: {} messages to {} in {:.1f} s ({}), link ready after {:.1f} s, protocol v{} features {:#04x}{}{}\n",
+        replayed, emulated ? "the emulator" : address, elapsed,
+        speed > 0 ? std::format("{:g}x speed", speed) : "as fast as possible", negotiation, version, features,
+        serial ? std::format(" at {} baud", baud) : "", open ? "" : ", link closed by the plug-in").c_str());
+    printf("%s", std::format("Link: {} dropped and {} stale before sending, {} left out that need compact encoding\n",
+        link.tx_dropped_frames, link.tx_stale_frames, unsupported).c_str());
+    printf("%s", std::format("Responses recorded to {}\n", Recorder::GetPath()).c_str());
+    session_t original;
+    session_t replay;
+    if (Collect(options.replay, original, from_us, until_us) && Collect(Recorder::GetPath(), replay)) {
+        Compare(original, replay, speed);
+    }
+    return open && replayed > 0 ? 0 : 1;
+}
+
+// What the flight loop would do between sim frames, apart from sending sim data
+void Headless::Upkeep(std::chrono::steady_clock::time_point &last) {
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    float dt = std::chrono::duration<float>(now - last).count();
+    last = now;
+    Serial::Update();
+    Remote::Update();
+    Telemetry::SendLink(dt);
+}
+
+// Made again for the link at hand rather than replayed, a RESTART would reboot the autopilot
+bool Headless::IsLinkMessage(int type) {
+    return type == Telemetry::PING || type == Telemetry::BAUD || type == Telemetry::RESTART;
+}
+
+bool Headless::IsCompact(int type) {
+    return type >= Telemetry::IMU_COMPACT && type <= Telemetry::EFI_COMPACT;
+}
+
+bool Headless::Collect(const std::string &path, session_t &session, uint64_t from_us, uint64_t until_us) {
+    recording_t recording;
+    if (!Recording::Open(recording, path)) { return false; }
+    if (from_us > 0) {
+        Recording::Seek(recording, from_us);
+    }
+    uint64_t first = 0;
+    while (Recording::Next(recording)) {
+        const record_t &record = recording.record;
+        if (until_us > 0 && record.time_us >= recording.header.start_us + until_us) { break; }
+        if (record.direction == RECORD_SENT) {
+            if (IsLinkMessage(record.type)) { continue; }
+            if (session.sent.empty()) { first = record.time_us; }
+            session.sent.push_back(static_cast<int64_t>(record.time_us - first));
+        } else if ((record.type == Remote::PLANE || record.type == Remote::HELI) && !session.sent.empty()) {
+            response_t response = { static_cast<int64_t>(record.time_us - first), record.type,
+                static_cast<uint8_t>(std::min<size_t>(record.size / sizeof(uint16_t), std::size(response.pwm))), {} };
+            memcpy(response.pwm, recording.payload, response.channels * sizeof(uint16_t));
+            session.responses.push_back({ response, static_cast<int64_t>(session.sent.size()) - 1 });
+        }
+    }
+    return true;
+}
+
+// Replayed responses are put on the recording's timeline through the message sent before
+// them, then matched with the closest response of the same type
+void Headless::Compare(const session_t &original, const session_t &replay, float speed) {
+    size_t matched = 0;
+    int64_t total = 0;
+    int64_t samples = 0;
+    int max = 0;
+    size_t next = 0;
+    for (const auto &[response, index] : replay.responses) {
+        if (index >= static_cast<int64_t>(original.sent.size())) { break; }
+        int64_t time = original.sent[index] +
+            (speed > 0 ? static_cast<int64_t>((response.time_us - replay.sent[index]) * speed) : 0);
+        while (next + 1 < original.responses.size() && original.responses[next + 1].first.time_us <= time) {
+            next++;
+        }
+        const response_t *closest = nullptr;
+        for (size_t i = next; i < std::min(next + 2, original.responses.size()); i++) {
+            const response_t &candidate = original.responses[i].first;
+            if (candidate.type != response.type || std::abs(candidate.time_us - time) > REPLAY_MATCH_WINDOW) { continue; }
+            if (!closest || std::abs(candidate.time_us - time) < std::abs(closest->time_us - time)) {
+                closest = &candidate;
+            }
+        }
+        if (!closest) { continue; }
+        matched++;
+        for (int channel = 0; channel < std::min(response.channels, closest->channels); channel++) {
+            int difference = std::abs(static_cast<int>(response.pwm[channel]) - closest->pwm[channel]);
+            total += difference;
+            samples++;
+            max = std::max(max, difference);
+        }
+    }
+    printf("%s", std::format("Actuators: {} responses recorded, {} replayed, {} matched within {} ms, PWM difference mean {:.1f} us max {} us\n",
+        original.responses.size(), replay.responses.size(), matched, REPLAY_MATCH_WINDOW / 1000,
+        samples ? static_cast<double>(total) / samples : 0.0, max).c_str());
+}
@@ -0,0 +1,385 @@
+#include <XPLMDataAccess.h>
+#include <XPLMUtilities.h>
+#include <XPLMProcessing.h>
+#include <XPLMMenus.h>
+#include <XPLMDisplay.h>
+#include <XPWidgets.h>
+#include <XPStandardWidgets.h>
+#include <XPLMPlugin.h>
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <deque>
+#include <map>
+#include <unordered_map>
+#include <algorithm>
+#include "headless.hpp"
+
+#define DATAREF_SIZE 64
+// descriptor capacity reserved up front, so --alloc-check counts the plug-in and not the stand-in
+#define DESCRIPTOR_SIZE 256
+
+namespace Headless {
+    // read accessors of datarefs registered by the plug-in, writes are not supported
+    struct accessor_t {
+        XPLMDataTypeID type;
+        XPLMGetDatai_f read_int;
+        XPLMGetDataf_f read_float;
+        XPLMGetDatad_f read_double;
+        XPLMGetDatavf_f read_float_array;
+        void *refcon;
+    };
+    struct dataref_t {
+        std::string name;
+        double values[DATAREF_SIZE];
+        accessor_t accessor;
+    };
+    struct command_t {
+        std::string name;
+        int count;
+    };
+    struct flight_loop_t {
+        XPLMFlightLoop_f callback;
+        void *refcon;
+        XPLMFlightLoopPhaseType phase;
+        // intervals are not timed, any active loop runs every frame
+        bool active;
+        bool removed;
+    };
+    struct widget_t {
+        std::string initial;
+        std::string descriptor;
+        std::map<XPWidgetPropertyID, intptr_t> properties;
+        std::vector<XPWidgetFunc_t> callbacks;
+        bool visible;
+    };
+    struct name_hash_t {
+        using is_transparent = void;
+        size_t operator()(std::string_view name) const { return std::hash<std::string_view>{}(name); }
+    };
+    // handles point into these, deques never move their elements.
+    // The plug-in resolves datarefs from static initializers, so the store must
+    // be constructed on first use
+    struct store_t {
+        std::deque<dataref_t> datarefs;
+        // looked up by string_view, the flight model writes every frame
+        std::unordered_map<std::string, dataref_t *, name_hash_t, std::equal_to<>> by_name;
+        std::deque<command_t> commands;
+        std::deque<flight_loop_t> flight_loops;
+        bool single_phase = false;
+        std::deque<widget_t> widgets;
+        float elapsed = 0;
+        int counter = 0;
+        bool verbose = true;
+        std::string plugin_path;
+    };
+    store_t &Store() {
+        static store_t store;
+        return store;
+    }
+    dataref_t *Ref(XPLMDataRef ref) { return static_cast<dataref_t *>(ref); }
+    widget_t *Widget(XPWidgetID id) { return static_cast<widget_t *>(id); }
+}
+
+XPLMDataRef Headless::Find(std::string_view name) {
+    store_t &store = Store();
+    auto found = store.by_name.find(name);
+    if (found != store.by_name.end()) { return found->second; }
+    dataref_t &ref = store.datarefs.emplace_back(dataref_t{ std::string(name), {}, {} });
+    store.by_name.emplace(ref.name, &ref);
+    return &ref;
+}
+
+void Headless::Set(std::string_view name, double value, int index) {
+    Ref(Find(name))->values[index] = value;
+}
+
+double Headless::Get(std::string_view name, int index) {
+    return Ref(Find(name))->values[index];
+}
+
+int Headless::CommandCount(const std::string &name) {
+    for (command_t &command : Store().commands) {
+        if (command.name == name) { return command.count; }
+    }
+    return 0;
+}
+
+void Headless::RunFlightLoops(float dt, const std::function<void()> &flight_model) {
+    store_t &store = Store();
+    store.elapsed += dt;
+    store.counter++;
+    // callbacks may register others, those only run from the next frame
+    size_t count = store.flight_loops.size();
+    auto run = [&](XPLMFlightLoopPhaseType phase) {
+        for (size_t i = 0; i < count; i++) {
+            flight_loop_t &loop = store.flight_loops[i];
+            if (loop.removed || !loop.active || loop.phase != phase) { continue; }
+            loop.active = loop.callback(dt, dt, store.counter, loop.refcon) != 0;
+        }
+    };
+    if (!store.single_phase) {
+        run(xplm_FlightLoop_Phase_BeforeFlightModel);
+    }
+    if (flight_model) { flight_model(); }
+    if (store.single_phase) {
+        run(xplm_FlightLoop_Phase_BeforeFlightModel);
+    }
+    run(xplm_FlightLoop_Phase_AfterFlightModel);
+}
+
+void Headless::SetSinglePhase(bool state) {
+    Store().single_phase = state;
+}
+
+float Headless::ElapsedTime() {
+    return Store().elapsed;
+}
+
+XPWidgetID Headless::FindWidget(const std::string &descriptor) {
+    for (widget_t &widget : Store().widgets) {
+        if (widget.initial == descriptor) { return &widget; }
+    }
+    return nullptr;
+}
+
+std::string Headless::WidgetText(XPWidgetID widget) {
+    return Widget(widget)->descriptor;
+}
+
+int Headless::SendWidgetMessage(XPWidgetID widget, XPWidgetMessage message, intptr_t param1, intptr_t param2) {
+    if (message == xpMsg_ButtonStateChanged) {
+        Widget(widget)->properties[xpProperty_ButtonState] = param2;
+    }
+    for (XPWidgetFunc_t callback : Widget(widget)->callbacks) {
+        if (callback(message, widget, param1, param2)) { return 1; }
+    }
+    return 0;
+}
+
+void Headless::SetVerbose(bool state) {
+    Store().verbose = state;
+}
+
+void Headless::SetPluginPath(const std::string &path) {
+    Store().plugin_path = path;
+}
+
+// -- XPLMDataAccess --
+
+XPLMDataRef XPLMFindDataRef(const char *inDataRefName) {
+    return Headless::Find(inDataRefName);
+}
+
+// the stand-in keeps every dataref as a double array, so it answers to any type
+XPLMDataTypeID XPLMGetDataRefTypes(XPLMDataRef inDataRef) {
+    if (Headless::Ref(inDataRef)->accessor.type) { return Headless::Ref(inDataRef)->accessor.type; }
+    return xplmType_Int | xplmType_Float | xplmType_Double | xplmType_FloatArray | xplmType_IntArray;
+}
+
+int XPLMGetDatai(XPLMDataRef inDataRef) {
+    const Headless::accessor_t &accessor = Headless::Ref(inDataRef)->accessor;
+    if (accessor.read_int) { return accessor.read_int(accessor.refcon); }
+    return static_cast<int>(Headless::Ref(inDataRef)->values[0]);
+}
+
+float XPLMGetDataf(XPLMDataRef inDataRef) {
+    const Headless::accessor_t &accessor = Headless::Ref(inDataRef)->accessor;
+    if (accessor.read_float) { return accessor.read_float(accessor.refcon); }
+    return static_cast<float>(Headless::Ref(inDataRef)->values[0]);
+}
+
+double XPLMGetDatad(XPLMDataRef inDataRef) {
+    const Headless::accessor_t &accessor = Headless::Ref(inDataRef)->accessor;
+    if (accessor.read_double) { return accessor.read_double(accessor.refcon); }
+    return Headless::Ref(inDataRef)->values[0];
+}
+
+XPLMDataRef XPLMRegisterDataAccessor(const char *inDataName, XPLMDataTypeID inDataType, int /*inIsWritable*/,
+    XPLMGetDatai_f inReadInt, XPLMSetDatai_f /*inWriteInt*/, XPLMGetDataf_f inReadFloat, XPLMSetDataf_f /*inWriteFloat*/,
+    XPLMGetDatad_f inReadDouble, XPLMSetDatad_f /*inWriteDouble*/, XPLMGetDatavi_f /*inReadIntArray*/, XPLMSetDatavi_f /*inWriteIntArray*/,
+    XPLMGetDatavf_f inReadFloatArray, XPLMSetDatavf_f /*inWriteFloatArray*/, XPLMGetDatab_f /*inReadData*/, XPLMSetDatab_f /*inWriteData*/,
+    void *inReadRefcon, void * /*inWriteRefcon*/) {
+    XPLMDataRef ref = Headless::Find(inDataName);
+    Headless::Ref(ref)->accessor = { inDataType, inReadInt, inReadFloat, inReadDouble, inReadFloatArray, inReadRefcon };
+    return ref;
+}
+
+void XPLMUnregisterDataAccessor(XPLMDataRef inDataRef) {
+    Headless::Ref(inDataRef)->accessor = {};
+}
+
+void XPLMSetDatai(XPLMDataRef inDataRef, int inValue) {
+    Headless::Ref(inDataRef)->values[0] = inValue;
+}
+
+void XPLMSetDataf(XPLMDataRef inDataRef, float inValue) {
+    Headless::Ref(inDataRef)->values[0] = inValue;
+}
+
+void XPLMSetDatad(XPLMDataRef inDataRef, double inValue) {
+    Headless::Ref(inDataRef)->values[0] = inValue;
+}
+
+template<typename T>
+int GetArray(XPLMDataRef inDataRef, T *outValues, int inOffset, int inMax) {
+    if (!outValues) { return DATAREF_SIZE; }
+    int count = std::clamp(std::min(inMax, DATAREF_SIZE - inOffset), 0, DATAREF_SIZE);
+    for (int i = 0; i < count; i++) {
+        outValues[i] = static_cast<T>(Headless::Ref(inDataRef)->values[inOffset + i]);
+    }
+    return count;
+}
+
+template<typename T>
+void SetArray(XPLMDataRef inDataRef, const T *inValues, int inOffset, int inCount) {
+    int count = std::clamp(std::min(inCount, DATAREF_SIZE - inOffset), 0, DATAREF_SIZE);
+    for (int i = 0; i < count; i++) {
+        Headless::Ref(inDataRef)->values[inOffset + i] = inValues[i];
+    }
+}
+
+int XPLMGetDatavi(XPLMDataRef inDataRef, int *outValues, int inOffset, int inMax) {
+    return GetArray(inDataRef, outValues, inOffset, inMax);
+}
+
+int XPLMGetDatavf(XPLMDataRef inDataRef, float *outValues, int inOffset, int inMax) {
+    const Headless::accessor_t &accessor = Headless::Ref(inDataRef)->accessor;
+    if (accessor.read_float_array) { return accessor.read_float_array(accessor.refcon, outValues, inOffset, inMax); }
+    return GetArray(inDataRef, outValues, inOffset, inMax);
+}
+
+void XPLMSetDatavi(XPLMDataRef inDataRef, int *inValues, int inoffset, int inCount) {
+    SetArray(inDataRef, inValues, inoffset, inCount);
+}
+
+void XPLMSetDatavf(XPLMDataRef inDataRef, float *inValues, int inoffset, int inCount) {
+    SetArray(inDataRef, inValues, inoffset, inCount);
+}
+
+// -- XPLMUtilities --
+
+void XPLMDebugString(const char *inString) {
+    if (Headless::Store().verbose) {
+        fputs(inString, stdout);
+    }
+}
+
+XPLMCommandRef XPLMFindCommand(const char *inName) {
+    for (Headless::command_t &command : Headless::Store().commands) {
+        if (command.name == inName) { return &command; }
+    }
+    return &Headless::Store().commands.emplace_back(Headless::command_t{ inName, 0 });
+}
+
+void XPLMCommandOnce(XPLMCommandRef inCommand) {
+    static_cast<Headless::command_t *>(inCommand)->count++;
+}
+
+// -- XPLMPlugin --
+
+XPLMPluginID XPLMGetMyID(void) {
+    return 0;
+}
+
+void XPLMGetPluginInfo(XPLMPluginID /*inPlugin*/, char * /*outName*/, char *outFilePath, char * /*outSignature*/, char * /*outDescription*/) {
+    if (outFilePath) {
+        snprintf(outFilePath, 256, "%s", Headless::Store().plugin_path.c_str());
+    }
+}
+
+// -- XPLMProcessing --
+
+float XPLMGetElapsedTime(void) {
+    return Headless::Store().elapsed;
+}
+
+// the legacy API runs at the end of the frame, after the flight model
+void XPLMRegisterFlightLoopCallback(XPLMFlightLoop_f inFlightLoop, float inInterval, void *inRefcon) {
+    Headless::Store().flight_loops.push_back({ inFlightLoop, inRefcon,
+        xplm_FlightLoop_Phase_AfterFlightModel, inInterval != 0, false });
+}
+
+void XPLMUnregisterFlightLoopCallback(XPLMFlightLoop_f inFlightLoop, void *inRefcon) {
+    for (Headless::flight_loop_t &loop : Headless::Store().flight_loops) {
+        if (loop.callback == inFlightLoop && loop.refcon == inRefcon) { loop.removed = true; }
+    }
+}
+
+XPLMFlightLoopID XPLMCreateFlightLoop(XPLMCreateFlightLoop_t *inParams) {
+    return &Headless::Store().flight_loops.emplace_back(Headless::flight_loop_t{ inParams->callbackFunc,
+        inParams->refcon, inParams->phase, false, false });
+}
+
+void XPLMDestroyFlightLoop(XPLMFlightLoopID inFlightLoopID) {
+    static_cast<Headless::flight_loop_t *>(inFlightLoopID)->removed = true;
+}
+
+void XPLMScheduleFlightLoop(XPLMFlightLoopID inFlightLoopID, float inInterval, int /*inRelativeToNow*/) {
+    static_cast<Headless::flight_loop_t *>(inFlightLoopID)->active = inInterval != 0;
+}
+
+// -- XPLMMenus and XPLMDisplay --
+
+XPLMMenuID XPLMFindPluginsMenu(void) {
+    return nullptr;
+}
+
+int XPLMAppendMenuItem(XPLMMenuID /*inMenu*/, const char * /*inItemName*/, void * /*inItemRef*/, int /*inForceEnglish*/) {
+    return 0;
+}
+
+XPLMMenuID XPLMCreateMenu(const char * /*inName*/, XPLMMenuID /*inParentMenu*/, int /*inParentItem*/, XPLMMenuHandler_f /*inHandler*/, void * /*inMenuRef*/) {
+    return nullptr;
+}
+
+void XPLMGetScreenSize(int *outWidth, int *outHeight) {
+    if (outWidth) { *outWidth = 1920; }
+    if (outHeight) { *outHeight = 1080; }
+}
+
+// -- XPWidgets --
+
+XPWidgetID XPCreateWidget(int /*inLeft*/, int /*inTop*/, int /*inRight*/, int /*inBottom*/, int inVisible,
+    const char *inDescriptor, int /*inIsRoot*/, XPWidgetID /*inContainer*/, XPWidgetClass /*inClass*/) {
+    Headless::widget_t &widget = Headless::Store().widgets.emplace_back(Headless::widget_t{ inDescriptor, inDescriptor, {}, {}, inVisible != 0 });
+    widget.descriptor.reserve(DESCRIPTOR_SIZE);
+    return &widget;
+}
+
+void XPShowWidget(XPWidgetID inWidget) {
+    Headless::Widget(inWidget)->visible = true;
+}
+
+void XPHideWidget(XPWidgetID inWidget) {
+    Headless::Widget(inWidget)->visible = false;
+}
+
+void XPSetWidgetProperty(XPWidgetID inWidget, XPWidgetPropertyID inProperty, intptr_t inValue) {
+    Headless::Widget(inWidget)->properties[inProperty] = inValue;
+}
+
+void XPAddWidgetCallback(XPWidgetID inWidget, XPWidgetFunc_t inNewCallback) {
+    // newest callbacks get messages first, like in X-Plane
+    std::vector<XPWidgetFunc_t> &callbacks = Headless::Widget(inWidget)->callbacks;
+    callbacks.insert(callbacks.begin(), inNewCallback);
+}
+
+void XPSetWidgetDescriptor(XPWidgetID inWidget, const char *inDescriptor) {
+    Headless::Widget(inWidget)->descriptor = inDescriptor;
+}
+
+void XPSetWidgetGeometry(XPWidgetID /*inWidget*/, int /*inLeft*/, int /*inTop*/, int /*inRight*/, int /*inBottom*/) {}
+
+int XPGetWidgetDescriptor(XPWidgetID inWidget, char *outDescriptor, int inMaxDescLength) {
+    const std::string &descriptor = Headless::Widget(inWidget)->descriptor;
+    if (outDescriptor && inMaxDescLength > 0) {
+        size_t bytes = std::min(descriptor.size(), static_cast<size_t>(inMaxDescLength - 1));
+        memcpy(outDescriptor, descriptor.data(), bytes);
+        outDescriptor[bytes] = 0;
+    }
+    return static_cast<int>(descriptor.size());
+}
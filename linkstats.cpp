@@ -0,0 +1,207 @@
+#include <XPLMDataAccess.h>
+#include <format>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include "linkstats.hpp"
+#include "serial.hpp"
+#include "remote.hpp"
+#include "telemetry.hpp"
+#include "timesync.hpp"
+#include "ui.hpp"
+
+namespace LinkStats {
+    // Last published values, the datarefs read straight from here
+    struct {
+        int connected;
+        int baud;
+        int low_latency;
+        int tx_frames;
+        int tx_dropped;
+        int tx_stale;
+        double tx_bytes;
+        float tx_rate;
+        float tx_type_rate[Telemetry::MSG_COUNT];
+        int rx_frames;
+        int rx_bad_frames;
+        int rx_dropped;
+        int rx_duplicates;
+        int rx_resyncs;
+        double rx_discarded_bytes;
+        double rx_bytes;
+        float rx_rate;
+        float rx_type_rate[Remote::MSG_COUNT];
+        float rx_wait_us;
+        float rx_wait_p99_ms;
+        float usage;
+        float clock_offset_ms;
+        float uplink_p99_ms;
+        float downlink_p99_ms;
+    } values;
+    struct array_t {
+        float *values;
+        int count;
+    };
+    array_t tx_types = { values.tx_type_rate, Telemetry::MSG_COUNT };
+    array_t rx_types = { values.rx_type_rate, Remote::MSG_COUNT };
+    const char *tx_names[Telemetry::MSG_COUNT] = {
+        "SENSORS", "RESTART", "IMU", "BARO", "MAG", "GPS", "ASPD", "EFI", "PING",
+        "IMU", "ATT", "BARO", "MAG", "GPS", "GPSD", "ASPD", "EFI", "BAUD"
+    };
+    const char *rx_names[Remote::MSG_COUNT] = { "PING", "STATE", "PLANE", "HELI", "VERSION", "BAUD" };
+    // counters at the start of the current window
+    uint64_t tx_last[Telemetry::MSG_COUNT];
+    uint64_t rx_last[Remote::MSG_COUNT];
+    float timer = 0;
+    std::vector<XPLMDataRef> refs;
+
+    void Publish(const char *name, int *value);
+    void Publish(const char *name, float *value);
+    void Publish(const char *name, double *value);
+    void Publish(const char *name, array_t *array);
+    float Rate(uint64_t now, uint64_t &last);
+    std::string_view Rates(const float *rates, const char **names, int count, char (&text)[LABEL_SIZE]);
+    void UpdateUI();
+}
+
+void LinkStats::Register() {
+    Publish("hitl/link/connected", &values.connected);
+    Publish("hitl/link/baud", &values.baud);
+    Publish("hitl/link/low_latency", &values.low_latency);
+    Publish("hitl/link/tx_frames", &values.tx_frames);
+    Publish("hitl/link/tx_dropped", &values.tx_dropped);
+    Publish("hitl/link/tx_stale", &values.tx_stale);
+    Publish("hitl/link/tx_bytes", &values.tx_bytes);
+    Publish("hitl/link/tx_rate", &values.tx_rate);
+    Publish("hitl/link/tx_type_rate", &tx_types);
+    Publish("hitl/link/rx_frames", &values.rx_frames);
+    Publish("hitl/link/rx_bad_frames", &values.rx_bad_frames);
+    Publish("hitl/link/rx_dropped", &values.rx_dropped);
+    Publish("hitl/link/rx_duplicates", &values.rx_duplicates);
+    Publish("hitl/link/rx_resyncs", &values.rx_resyncs);
+    Publish("hitl/link/rx_discarded_bytes", &values.rx_discarded_bytes);
+    Publish("hitl/link/rx_bytes", &values.rx_bytes);
+    Publish("hitl/link/rx_rate", &values.rx_rate);
+    Publish("hitl/link/rx_type_rate", &rx_types);
+    Publish("hitl/link/rx_wait_us", &values.rx_wait_us);
+    Publish("hitl/link/rx_wait_p99_ms", &values.rx_wait_p99_ms);
+    Publish("hitl/link/usage", &values.usage);
+    Publish("hitl/link/clock_offset_ms", &values.clock_offset_ms);
+    Publish("hitl/link/uplink_p99_ms", &values.uplink_p99_ms);
+    Publish("hitl/link/downlink_p99_ms", &values.downlink_p99_ms);
+}
+
+void LinkStats::Unregister() {
+    for (XPLMDataRef ref : refs) {
+        XPLMUnregisterDataAccessor(ref);
+    }
+    refs.clear();
+}
+
+void LinkStats::Update(float dt) {
+    timer += dt;
+    if (timer < LINKSTATS_PERIOD) { return; }
+    serial_stats_t link = Serial::GetStats();
+    remote_stats_t remote = Remote::GetStats();
+    values.connected = Serial::IsOpen();
+    values.baud = static_cast<int>(Serial::GetBaudRate());
+    values.low_latency = Serial::IsLowLatency();
+    values.tx_frames = static_cast<int>(link.tx_frames);
+    values.tx_dropped = static_cast<int>(link.tx_dropped_frames);
+    values.tx_stale = static_cast<int>(link.tx_stale_frames);
+    values.tx_bytes = static_cast<double>(link.tx_bytes);
+    values.tx_rate = 0;
+    for (int type = 0; type < Telemetry::MSG_COUNT; type++) {
+        values.tx_type_rate[type] = Rate(Telemetry::FramesSent(static_cast<Telemetry::MSG_TYPE>(type)), tx_last[type]);
+        values.tx_rate += values.tx_type_rate[type];
+    }
+    values.rx_frames = static_cast<int>(remote.frames);
+    values.rx_bad_frames = static_cast<int>(remote.bad_frames);
+    values.rx_dropped = static_cast<int>(remote.dropped);
+    values.rx_duplicates = static_cast<int>(remote.duplicates);
+    values.rx_resyncs = static_cast<int>(remote.resyncs);
+    values.rx_discarded_bytes = static_cast<double>(remote.discarded_bytes);
+    values.rx_bytes = static_cast<double>(link.rx_bytes);
+    values.rx_rate = 0;
+    for (int type = 0; type < Remote::MSG_COUNT; type++) {
+        values.rx_type_rate[type] = Rate(remote.type_frames[type], rx_last[type]);
+        values.rx_rate += values.rx_type_rate[type];
+    }
+    values.rx_wait_us = static_cast<float>(link.rx_wait_mean_us);
+    values.rx_wait_p99_ms = link.rx_wait.Percentile(0.99) / 1000.0f;
+    values.usage = Telemetry::LinkUsage();
+    timesync_stats_t sync = Timesync::GetStats();
+    values.clock_offset_ms = sync.offset_us / 1000.0f;
+    values.uplink_p99_ms = sync.uplink.Percentile(0.99) / 1000.0f;
+    values.downlink_p99_ms = sync.downlink.Percentile(0.99) / 1000.0f;
+    if (values.connected) {
+        UpdateUI();
+    }
+    timer = 0;
+}
+
+// Counters restart with every link
+float LinkStats::Rate(uint64_t now, uint64_t &last) {
+    float rate = now >= last ? (now - last) / timer : now / timer;
+    last = now;
+    return rate;
+}
+
+void LinkStats::UpdateUI() {
+    char text[LABEL_SIZE];
+    UI::Window::LabelRx::SetText(UI::Format(text, "Rx {:.0f} Hz, {} bad {} lost {} dup {} resync {} B skipped",
+        values.rx_rate, values.rx_bad_frames, values.rx_dropped, values.rx_duplicates,
+        values.rx_resyncs, values.rx_discarded_bytes));
+    UI::Window::LabelRxTypes::SetText(Rates(values.rx_type_rate, rx_names, Remote::MSG_COUNT, text));
+    UI::Window::LabelTx::SetText(UI::Format(text, "Tx {:.0f} Hz, {} dropped {} stale",
+        values.tx_rate, values.tx_dropped, values.tx_stale));
+    UI::Window::LabelTxTypes::SetText(Rates(values.tx_type_rate, tx_names, Telemetry::MSG_COUNT, text));
+}
+
+// Only the types that were seen in the last window
+std::string_view LinkStats::Rates(const float *rates, const char **names, int count, char (&text)[LABEL_SIZE]) {
+    size_t size = 0;
+    for (int type = 0; type < count && size < LABEL_SIZE; type++) {
+        if (rates[type] < 0.5f) { continue; }
+        auto result = std::format_to_n(text + size, LABEL_SIZE - size, "{}{} {:.0f}", size ? " " : "", names[type], rates[type]);
+        size = result.out - text;
+    }
+    return { text, size };
+}
+
+void LinkStats::Publish(const char *name, int *value) {
+    refs.push_back(XPLMRegisterDataAccessor(name, xplmType_Int, 0,
+        [](void *ref) { return *static_cast<int *>(ref); }, nullptr,
+        nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr,
+        value, nullptr));
+}
+
+void LinkStats::Publish(const char *name, float *value) {
+    refs.push_back(XPLMRegisterDataAccessor(name, xplmType_Float, 0,
+        nullptr, nullptr,
+        [](void *ref) { return *static_cast<float *>(ref); }, nullptr,
+        nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr,
+        value, nullptr));
+}
+
+void LinkStats::Publish(const char *name, double *value) {
+    refs.push_back(XPLMRegisterDataAccessor(name, xplmType_Double, 0,
+        nullptr, nullptr, nullptr, nullptr,
+        [](void *ref) { return *static_cast<double *>(ref); }, nullptr,
+        nullptr, nullptr, nullptr, nullptr, nullptr, nullptr,
+        value, nullptr));
+}
+
+void LinkStats::Publish(const char *name, array_t *array) {
+    refs.push_back(XPLMRegisterDataAccessor(name, xplmType_FloatArray, 0,
+        nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr,
+        [](void *ref, float *values, int offset, int max) {
+            const array_t *array = static_cast<const array_t *>(ref);
+            if (!values) { return array->count; }
+            int count = std::clamp(std::min(max, array->count - offset), 0, array->count);
+            std::copy_n(array->values + offset, count, values);
+            return count;
+        }, nullptr,
+        nullptr, nullptr,
+        array, nullptr));
+}
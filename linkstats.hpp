@@ -0,0 +1,13 @@
+#pragma once
+
+// Link health published as hitl/link/* datarefs and in the settings window,
+// refreshed every LINKSTATS_PERIOD seconds
+#define LINKSTATS_PERIOD 1.0f
+
+namespace LinkStats {
+    // Create the datarefs, other plug-ins and DataRefTool can read them right away
+    void Register();
+    void Unregister();
+    // Called every frame, connected or not
+    void Update(float dt);
+}
@@ -0,0 +1,107 @@
+#include <XPLMUtilities.h>
+#include <format>
+#include <string>
+#include <utility>
+#include "logfile.hpp"
+#include "config.hpp"
+
+namespace LogFile {
+    void Run(std::stop_token stop, logfile_t &log);
+    void Write(logfile_t &log, logfile_t::buffer_t &buffer);
+}
+
+bool LogFile::Open(logfile_t &log, const char *extension) {
+    using namespace std::chrono;
+    std::filesystem::path folder = Config::Folder() / LOGFILE_FOLDER;
+    std::error_code error;
+    std::filesystem::create_directories(folder, error);
+    log.opened = system_clock::now();
+    std::string name = std::format("hitl-{:%Y%m%d-%H%M%S}", floor<seconds>(log.opened));
+    log.path = folder / std::format("{}.{}", name, extension);
+    // opened again within the same second
+    for (int i = 2; std::filesystem::exists(log.path); i++) {
+        log.path = folder / std::format("{}-{}.{}", name, i, extension);
+    }
+    log.file.open(log.path, std::ios::binary | std::ios::trunc);
+    if (!log.file) {
+        XPLMDebugString(std::format("HITL: Could not create {}\n", log.path.string()).c_str());
+        return false;
+    }
+    log.buffers[0].bytes = 0;
+    log.buffers[1].bytes = 0;
+    log.failed = false;
+    return true;
+}
+
+void LogFile::Write(logfile_t &log, const void *data, size_t bytes) {
+    log.file.write(static_cast<const char *>(data), bytes);
+    if (!log.file) {
+        log.failed = true;
+    }
+}
+
+void LogFile::Start(logfile_t &log, void (*written)(int buffer)) {
+    log.written = written;
+    log.thread = std::jthread(Run, std::ref(log));
+}
+
+void LogFile::Stop(logfile_t &log) {
+    if (!log.thread.joinable()) { return; }
+    log.thread.request_stop();
+    log.thread.join();
+}
+
+void LogFile::Close(logfile_t &log) {
+    log.file.close();
+}
+
+bool LogFile::IsRunning(const logfile_t &log) {
+    return log.thread.joinable();
+}
+
+uint8_t *LogFile::Reserve(logfile_t &log, size_t bytes) {
+    if (log.filling->bytes + bytes > LOGFILE_BUFFER_SIZE) { return nullptr; }
+    return log.filling->data + log.filling->bytes;
+}
+
+bool LogFile::Commit(logfile_t &log, size_t bytes) {
+    bool half = log.filling->bytes < LOGFILE_BUFFER_SIZE / 2 && log.filling->bytes + bytes >= LOGFILE_BUFFER_SIZE / 2;
+    log.filling->bytes += bytes;
+    return half;
+}
+
+int LogFile::Filling(const logfile_t &log) {
+    return log.filling == &log.buffers[0] ? 0 : 1;
+}
+
+void LogFile::Wake(logfile_t &log) {
+    log.wake.notify_one();
+}
+
+void LogFile::Run(std::stop_token stop, logfile_t &log) {
+    bool last = false;
+    while (!last) {
+        {
+            std::unique_lock guard(log.lock);
+            log.wake.wait_for(guard, stop, std::chrono::milliseconds(LOGFILE_FLUSH_PERIOD),
+                [&log] { return log.filling->bytes >= LOGFILE_BUFFER_SIZE / 2; });
+            // producers were done before Stop asked, nothing is added after this swap
+            last = stop.stop_requested();
+            std::swap(log.filling, log.writing);
+        }
+        Write(log, *log.writing);
+    }
+}
+
+void LogFile::Write(logfile_t &log, logfile_t::buffer_t &buffer) {
+    if (buffer.bytes == 0) { return; }
+    log.file.write(reinterpret_cast<const char *>(buffer.data), buffer.bytes);
+    log.file.flush();
+    if (!log.file) {
+        log.failed = true;
+    }
+    if (log.written) {
+        log.written(&buffer == &log.buffers[0] ? 0 : 1);
+    }
+    buffer.bytes = 0;
+}
@@ -0,0 +1,62 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <filesystem>
+#include <fstream>
+#include <mutex>
+#include <thread>
+#include <cstdint>
+#include <cstddef>
+
+// Double buffered file in the recordings folder next to hitl.cfg, written by the flight
+// data recorder and the link capture. Producers copy into the filling buffer under the
+// lock and never wait for the disk, a writer thread swaps the buffers and appends the
+// full one to the file
+#define LOGFILE_FOLDER "recordings"
+// Each of the two buffers, a 400 Hz IMU stream takes about 20 s to fill one
+#define LOGFILE_BUFFER_SIZE (256 * 1024)
+// Partly filled buffers are written this often too (ms)
+#define LOGFILE_FLUSH_PERIOD 500
+
+struct logfile_t {
+    struct buffer_t {
+        uint8_t data[LOGFILE_BUFFER_SIZE];
+        size_t bytes;
+    };
+    buffer_t buffers[2];
+    buffer_t *filling = &buffers[0];
+    buffer_t *writing = &buffers[1];
+    // held by producers while they fill, the writer thread only takes it to swap
+    std::mutex lock;
+    std::condition_variable_any wake;
+    // called by the writer thread once the buffer with this number is in the file
+    void (*written)(int buffer);
+    // wall clock when the file was opened, its name
+    std::chrono::system_clock::time_point opened;
+    std::filesystem::path path;
+    std::ofstream file;
+    // set when a write failed, reported when the file is closed
+    std::atomic<bool> failed = false;
+    std::jthread thread;
+};
+
+namespace LogFile {
+    // Create a new file named after the current time (UTC) with the extension, false if
+    // it could not be created
+    bool Open(logfile_t &log, const char *extension);
+    // Straight to the file, only before Start and after Stop
+    void Write(logfile_t &log, const void *data, size_t bytes);
+    void Start(logfile_t &log, void (*written)(int buffer) = nullptr);
+    // Write what is left and wait for the writer thread, producers must be done
+    void Stop(logfile_t &log);
+    void Close(logfile_t &log);
+    bool IsRunning(const logfile_t &log);
+    // Room for bytes more in the filling buffer, nullptr if the writer fell behind.
+    // Reserve, Commit and Filling are called under the lock
+    uint8_t *Reserve(logfile_t &log, size_t bytes);
+    // True once half a buffer is waiting, Wake the writer after letting go of the lock
+    bool Commit(logfile_t &log, size_t bytes);
+    int Filling(const logfile_t &log);
+    void Wake(logfile_t &log);
+}
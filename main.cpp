@@ -6,6 +6,8 @@
 #include <XPLMGraphics.h>
 #include <XPWidgets.h>
 #include <XPStandardWidgets.h>
+#include <cstring>
+#include <algorithm>
 
 #include "main.hpp"
 #include "serial.hpp"
@@ -13,6 +15,20 @@
 #include "telemetry.hpp"
 #include "calibration.hpp"
 #include "remote.hpp"
+#include "datarefs.hpp"
+#include "linkstats.hpp"
+#include "config.hpp"
+#include "recorder.hpp"
+#include "capture.hpp"
+
+namespace Flightloop {
+#if defined(XPLM210)
+    XPLMFlightLoopID before = nullptr;
+    XPLMFlightLoopID after = nullptr;
+    XPLMFlightLoopID Create(XPLMFlightLoopPhaseType phase, XPLMFlightLoop_f callback);
+#endif
+    loop_times_t times;
+}
 
 PLUGIN_API int XPluginStart(
     char *outName,
@@ -23,16 +39,41 @@ PLUGIN_API int XPluginStart(
     strcpy(outSig, "https://github.com/qgerman2/xplane-HITL");
     strcpy(outDesc, "A plugin to enable simple HITL testing with Ardupilot");
 
+    DataRefs::Resolve();
+    LinkStats::Register();
+
     UI::Menu::Create();
     UI::Window::Create();
 
+    // link settings from the last session
+    Config::Load();
+    const config_t &config = Config::Get();
+    Serial::SetAddress(config.address);
+    Serial::SetLowLatency(config.low_latency);
+    UI::Window::TextAddress::SetText(config.address);
+    UI::Window::ButtonLowLatency::SetState(config.low_latency);
+
+#if defined(XPLM210)
+    Flightloop::before = Flightloop::Create(xplm_FlightLoop_Phase_BeforeFlightModel, BeforeFlightModel);
+    Flightloop::after = Flightloop::Create(xplm_FlightLoop_Phase_AfterFlightModel, AfterFlightModel);
+#else
     XPLMRegisterFlightLoopCallback(Loop, -1, NULL);
+#endif
     return 1;
 }
 
 PLUGIN_API void	XPluginStop(void) {
     Serial::Disconnect();
     Serial::StopScan();
+    Recorder::Stop();
+    Capture::Stop();
+    LinkStats::Unregister();
+#if defined(XPLM210)
+    XPLMDestroyFlightLoop(Flightloop::before);
+    XPLMDestroyFlightLoop(Flightloop::after);
+#else
+    XPLMUnregisterFlightLoopCallback(Loop, NULL);
+#endif
 }
 
 PLUGIN_API int XPluginEnable(void) {
@@ -42,6 +83,10 @@ PLUGIN_API int XPluginEnable(void) {
 PLUGIN_API void XPluginDisable(void) {
     Serial::Disconnect();
     Serial::StopScan();
+    Recorder::Stop();
+    Capture::Stop();
+    UI::Window::ButtonRecord::SetState(false);
+    UI::Window::ButtonCapture::SetState(false);
 }
 
 PLUGIN_API void XPluginReceiveMessage(XPLMPluginID inFrom, int inMsg, void *inParam) {
@@ -56,6 +101,12 @@ PLUGIN_API void XPluginReceiveMessage(XPLMPluginID inFrom, int inMsg, void *inPa
     }
 }
 
+loop_times_t LoopTimes() {
+    return Flightloop::times;
+}
+
+// Single callback for SDKs without flight loop phases, outputs received now
+// only reach the flight model on the next frame
 float Loop(float dt, float, int, void *) {
     // cap deltatime in case of a long freeze
     dt = std::min(dt, 0.1f);
@@ -63,10 +114,49 @@ float Loop(float dt, float, int, void *) {
         Calibration::Loop(dt);
     }
     if (Serial::IsOpen()) {
+        Serial::Update();
         Remote::Update();
-        Telemetry::Send();
+        Flightloop::times.actuators = std::chrono::steady_clock::now();
+        Telemetry::Send(dt);
+        Flightloop::times.sensors = std::chrono::steady_clock::now();
     } else {
         Serial::Scan();
     }
+    LinkStats::Update(dt);
     return -1.0;
-}
\ No newline at end of file
+}
+
+#if defined(XPLM210)
+XPLMFlightLoopID Flightloop::Create(XPLMFlightLoopPhaseType phase, XPLMFlightLoop_f callback) {
+    XPLMCreateFlightLoop_t params = { sizeof(XPLMCreateFlightLoop_t), phase, callback, nullptr };
+    XPLMFlightLoopID id = XPLMCreateFlightLoop(&params);
+    XPLMScheduleFlightLoop(id, -1, 1);
+    return id;
+}
+
+float BeforeFlightModel(float, float, int, void *) {
+    if (Serial::IsOpen()) {
+        Serial::Update();
+        Remote::Update();
+        Flightloop::times.actuators = std::chrono::steady_clock::now();
+    } else {
+        Serial::Scan();
+    }
+    return -1.0;
+}
+
+float AfterFlightModel(float dt, float, int, void *) {
+    // cap deltatime in case of a long freeze
+    dt = std::min(dt, 0.1f);
+    // calibration holds the aircraft over what the flight model just did
+    if (Calibration::IsEnabled()) {
+        Calibration::Loop(dt);
+    }
+    if (Serial::IsOpen()) {
+        Telemetry::Send(dt);
+        Flightloop::times.sensors = std::chrono::steady_clock::now();
+    }
+    LinkStats::Update(dt);
+    return -1.0;
+}
+#endif
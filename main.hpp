@@ -1,7 +1,27 @@
 #pragma once
+#include <chrono>
 
 const char header[4] = { 'H', 'I', 'T', 'L' };
 
+// When the last frame applied actuator outputs and captured sensors
+struct loop_times_t {
+    std::chrono::steady_clock::time_point actuators;
+    std::chrono::steady_clock::time_point sensors;
+};
+
+loop_times_t LoopTimes();
+
 float Loop(
     float inElapsedSinceLastCall, float inElapsedTimeSinceLastFlightLoop,
-    int inCounter, void *inRefcon);
\ No newline at end of file
+    int inCounter, void *inRefcon);
+
+#if defined(XPLM210)
+// Actuators go in before the flight model integrates and sensors are read
+// right after it, so neither waits a frame
+float BeforeFlightModel(
+    float inElapsedSinceLastCall, float inElapsedTimeSinceLastFlightLoop,
+    int inCounter, void *inRefcon);
+float AfterFlightModel(
+    float inElapsedSinceLastCall, float inElapsedTimeSinceLastFlightLoop,
+    int inCounter, void *inRefcon);
+#endif
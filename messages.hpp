@@ -0,0 +1,67 @@
+#pragma once
+#include <Eigen/Geometry>
+#include <cstdint>
+#include "telemetry.hpp"
+
+// Data structures expected by ArduPilot
+namespace AP {
+    typedef struct {
+        uint8_t instance;
+        float pressure_pa;
+        float temperature;
+    } baro_data_message_t;
+    typedef struct {
+        Eigen::Vector3f field;
+    } mag_data_message_t;
+    typedef struct {
+        uint16_t gps_week;
+        uint32_t ms_tow;
+        uint8_t fix_type;
+        uint8_t satellites_in_view;
+        float horizontal_pos_accuracy;
+        float vertical_pos_accuracy;
+        float horizontal_vel_accuracy;
+        float hdop;
+        float vdop;
+        int32_t longitude;
+        int32_t latitude;
+        int32_t msl_altitude;
+        float ned_vel_north;
+        float ned_vel_east;
+        float ned_vel_down;
+    } gps_data_message_t;
+    typedef struct {
+        Eigen::Vector3f accel;
+        Eigen::Vector3f gyro;
+        float temperature;
+    } ins_data_message_t;
+    typedef struct {
+        float differential_pressure; // Pa
+        float temperature; // degC
+    } airspeed_data_message_t;
+}
+
+// SENSORS, every group at once
+struct sensors_msg_t {
+    AP::baro_data_message_t baro;
+    AP::mag_data_message_t mag;
+    AP::gps_data_message_t gps;
+    AP::ins_data_message_t ins;
+    AP::airspeed_data_message_t aspd;
+    float q1;
+    float q2;
+    float q3;
+    float q4;
+    EFI_State efi;
+};
+
+// IMU in multirate mode
+struct imu_msg_t {
+    // monotonic time the sample belongs to (microseconds)
+    uint64_t time_us;
+    AP::ins_data_message_t ins;
+    float q1;
+    float q2;
+    float q3;
+    float q4;
+};
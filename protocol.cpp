@@ -0,0 +1,114 @@
+#include <array>
+#include <atomic>
+#include <cstring>
+#include "protocol.hpp"
+
+namespace Protocol {
+    std::atomic<int> version = 1;
+    std::atomic<uint8_t> features = 0;
+    constexpr std::array<uint16_t, 256> crc_table = [] {
+        std::array<uint16_t, 256> table{};
+        for (int i = 0; i < 256; i++) {
+            uint16_t crc = static_cast<uint16_t>(i << 8);
+            for (int bit = 0; bit < 8; bit++) {
+                crc = (crc & 0x8000) ? static_cast<uint16_t>((crc << 1) ^ 0x1021) : static_cast<uint16_t>(crc << 1);
+            }
+            table[i] = crc;
+        }
+        return table;
+    }();
+}
+
+int Protocol::Version() {
+    return version;
+}
+
+uint8_t Protocol::Features() {
+    return features;
+}
+
+void Protocol::SetVersion(int version, uint8_t features) {
+    Protocol::features = features;
+    Protocol::version = version;
+}
+
+uint16_t Protocol::Crc16(const uint8_t *data, size_t bytes, uint16_t crc) {
+    for (size_t i = 0; i < bytes; i++) {
+        crc = static_cast<uint16_t>((crc << 8) ^ crc_table[(crc >> 8) ^ data[i]]);
+    }
+    return crc;
+}
+
+size_t Protocol::CobsEncode(const uint8_t *src, size_t bytes, uint8_t *dest) {
+    size_t code_pos = 0;
+    size_t out = 1;
+    uint8_t code = 1;
+    for (size_t i = 0; i < bytes; i++) {
+        if (src[i] != 0) {
+            dest[out++] = src[i];
+            code++;
+        }
+        if (src[i] == 0 || code == 0xFF) {
+            dest[code_pos] = code;
+            code = 1;
+            code_pos = out++;
+        }
+    }
+    dest[code_pos] = code;
+    return out;
+}
+
+size_t Protocol::CobsDecode(const uint8_t *src, size_t bytes, uint8_t *dest) {
+    size_t in = 0;
+    size_t out = 0;
+    while (in < bytes) {
+        uint8_t code = src[in++];
+        if (code == 0 || in + code - 1 > bytes) { return 0; }
+        memcpy(&dest[out], &src[in], code - 1);
+        in += code - 1;
+        out += code - 1;
+        // a full block is not followed by an implicit zero
+        if (code != 0xFF && in < bytes) {
+            dest[out++] = 0;
+        }
+    }
+    return out;
+}
+
+size_t Protocol::Encode(uint8_t type, uint16_t seq, const void *payload, size_t bytes, uint8_t *dest, const uint32_t *stamp) {
+    if (bytes > PROTOCOL_MAX_PAYLOAD) { return 0; }
+    uint8_t raw[PROTOCOL_MAX_RAW];
+    frame_header_t header = { PROTOCOL_VERSION, type, seq, static_cast<uint16_t>(bytes) };
+    memcpy(raw, &header, sizeof(header));
+    size_t size = sizeof(header);
+    if (stamp) {
+        memcpy(&raw[size], stamp, sizeof(*stamp));
+        size += sizeof(*stamp);
+    }
+    if (bytes > 0) {
+        memcpy(&raw[size], payload, bytes);
+        size += bytes;
+    }
+    uint16_t crc = Crc16(raw, size);
+    memcpy(&raw[size], &crc, sizeof(crc));
+    size = CobsEncode(raw, size + sizeof(crc), dest);
+    dest[size++] = 0;
+    return size;
+}
+
+const uint8_t *Protocol::Decode(const uint8_t *src, size_t bytes, uint8_t *raw, frame_header_t &header, uint32_t *stamp) {
+    if (bytes > PROTOCOL_MAX_FRAME) { return nullptr; }
+    size_t size = CobsDecode(src, bytes, raw);
+    if (size < sizeof(header) + sizeof(uint16_t)) { return nullptr; }
+    memcpy(&header, raw, sizeof(header));
+    if (header.version != PROTOCOL_VERSION) { return nullptr; }
+    size_t start = sizeof(header) + (stamp ? sizeof(*stamp) : 0);
+    if (size != start + header.len + sizeof(uint16_t)) { return nullptr; }
+    uint16_t crc;
+    memcpy(&crc, &raw[start + header.len], sizeof(crc));
+    if (crc != Crc16(raw, start + header.len)) { return nullptr; }
+    if (stamp) {
+        memcpy(stamp, &raw[sizeof(header)], sizeof(*stamp));
+    }
+    return &raw[start];
+}
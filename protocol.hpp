@@ -0,0 +1,49 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+
+// Wire format v2, negotiated during the PING exchange:
+// COBS(header + payload + crc16) followed by a zero delimiter,
+// a corrupted frame is always resolved at the next delimiter
+#define PROTOCOL_VERSION 2
+// Optional features offered along with the version
+#define FEATURE_COMPACT 0x01
+// Clock exchange in PING/STATE and a send time in every frame, see timesync.hpp
+#define FEATURE_TIMESYNC 0x02
+// Switching a serial link to a faster baud rate, see baud.hpp
+#define FEATURE_BAUD 0x04
+#define PROTOCOL_FEATURES (FEATURE_COMPACT | FEATURE_TIMESYNC | FEATURE_BAUD)
+#define PROTOCOL_MAX_PAYLOAD 512
+#define PROTOCOL_MAX_RAW (sizeof(frame_header_t) + sizeof(uint32_t) + PROTOCOL_MAX_PAYLOAD + sizeof(uint16_t))
+// COBS adds one byte every 254, plus the delimiter
+#define PROTOCOL_MAX_FRAME (PROTOCOL_MAX_RAW + PROTOCOL_MAX_RAW / 254 + 2)
+
+#pragma pack(push, 1)
+struct frame_header_t {
+    uint8_t version;
+    uint8_t type;
+    uint16_t seq;
+    uint16_t len;
+};
+#pragma pack(pop)
+static_assert(sizeof(frame_header_t) == 6);
+
+namespace Protocol {
+    // Version in use on the current link, 1 until the autopilot accepts v2
+    int Version();
+    // Features both sides agreed on
+    uint8_t Features();
+    void SetVersion(int version, uint8_t features = 0);
+    // CRC-16/CCITT-FALSE
+    uint16_t Crc16(const uint8_t *data, size_t bytes, uint16_t crc = 0xFFFF);
+    size_t CobsEncode(const uint8_t *src, size_t bytes, uint8_t *dest);
+    // Returns 0 if the input is not valid COBS
+    size_t CobsDecode(const uint8_t *src, size_t bytes, uint8_t *dest);
+    // Build a v2 frame with its delimiter into dest, which must hold PROTOCOL_MAX_FRAME bytes.
+    // A stamp goes between the header and the payload, it is not counted in header.len
+    size_t Encode(uint8_t type, uint16_t seq, const void *payload, size_t bytes, uint8_t *dest, const uint32_t *stamp = nullptr);
+    // Check the bytes found between two delimiters, the decoded frame is written to raw
+    // which must hold PROTOCOL_MAX_FRAME bytes. Frames must carry a stamp if one is asked for.
+    // Returns the payload or nullptr if the frame is damaged
+    const uint8_t *Decode(const uint8_t *src, size_t bytes, uint8_t *raw, frame_header_t &header, uint32_t *stamp = nullptr);
+}
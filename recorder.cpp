@@ -0,0 +1,187 @@
+#include <XPLMUtilities.h>
+#include <atomic>
+#include <chrono>
+#include <format>
+#include <vector>
+#include <cstring>
+#include "recorder.hpp"
+#include "logfile.hpp"
+#include "timesync.hpp"
+
+namespace Recorder {
+    // The last record of each direction and type, copied into every keyframe
+    struct last_t {
+        record_t record;
+        uint8_t payload[PROTOCOL_MAX_PAYLOAD];
+        bool valid;
+    };
+    static_assert(static_cast<int>(Remote::MSG_COUNT) <= static_cast<int>(Telemetry::MSG_COUNT));
+    logfile_t log;
+    std::atomic<bool> recording = false;
+    // the rest is filled under log.lock
+    uint32_t seq = 0;
+    last_t last[2][Telemetry::MSG_COUNT];
+    uint64_t next_keyframe = 0;
+    recorder_stats_t stats;
+    // keyframes in each buffer, added to the index once it is written
+    recording_index_t keyframes[2][RECORDER_BUFFER_KEYFRAMES];
+    int keyframe_count[2];
+    // kept by the writer thread, written after the last record
+    std::vector<recording_index_t> index;
+    void Add(uint8_t direction, int type, const void *msg, size_t bytes);
+    void AddKeyframe(uint64_t time_us);
+    void Written(int buffer);
+    void WriteIndex();
+}
+
+bool Recorder::Start() {
+    using namespace std::chrono;
+    if (LogFile::IsRunning(log)) { return true; }
+    if (!LogFile::Open(log, "rec")) { return false; }
+    recording_header_t header = { RECORDER_MAGIC, RECORDER_VERSION, Timesync::Now(),
+        duration_cast<microseconds>(log.opened.time_since_epoch()).count() };
+    LogFile::Write(log, &header, sizeof(header));
+    {
+        std::lock_guard guard(log.lock);
+        keyframe_count[0] = 0;
+        keyframe_count[1] = 0;
+        for (auto &types : last) {
+            for (last_t &message : types) {
+                message.valid = false;
+            }
+        }
+        seq = 0;
+        next_keyframe = header.start_us + RECORDER_KEYFRAME_PERIOD * 1000;
+        stats = { 0, 0, sizeof(header) };
+        recording = true;
+    }
+    index.clear();
+    LogFile::Start(log, Written);
+    XPLMDebugString(std::format("HITL: Recording to {}\n", log.path.string()).c_str());
+    return true;
+}
+
+void Recorder::Stop() {
+    if (!LogFile::IsRunning(log)) { return; }
+    {
+        std::lock_guard guard(log.lock);
+        recording = false;
+    }
+    LogFile::Stop(log);
+    WriteIndex();
+    LogFile::Close(log);
+    recorder_stats_t recorded = GetStats();
+    XPLMDebugString(std::format("HITL: Recorded {} messages, {} bytes, {} keyframes to {}{}{}\n", recorded.records, recorded.bytes,
+        index.size(), log.path.string(), recorded.dropped ? std::format(", {} dropped", recorded.dropped) : "",
+        log.failed ? ", the file could not be written" : "").c_str());
+}
+
+bool Recorder::IsRecording() {
+    return recording;
+}
+
+std::string Recorder::GetPath() {
+    return log.path.string();
+}
+
+recorder_stats_t Recorder::GetStats() {
+    std::lock_guard guard(log.lock);
+    return stats;
+}
+
+void Recorder::Sent(int type, const void *msg, size_t bytes) {
+    Add(RECORD_SENT, type, msg, bytes);
+}
+
+void Recorder::Received(int type, const void *msg, size_t bytes) {
+    Add(RECORD_RECEIVED, type, msg, bytes);
+}
+
+// Only a copy under the lock, the writer wakes up early once half a buffer is waiting
+void Recorder::Add(uint8_t direction, int type, const void *msg, size_t bytes) {
+    if (!recording.load(std::memory_order_relaxed)) { return; }
+    record_t record = { 0, 0, direction, static_cast<uint8_t>(type), static_cast<uint16_t>(bytes) };
+    bool half;
+    {
+        std::lock_guard guard(log.lock);
+        if (!recording) { return; }
+        // taken under the lock so the threads stay in time order in the file
+        record.time_us = Timesync::Now();
+        if (record.time_us >= next_keyframe) {
+            AddKeyframe(record.time_us);
+        }
+        record.seq = seq++;
+        // kept even when the buffer is full, the next keyframe has it
+        if (type < Telemetry::MSG_COUNT && bytes <= PROTOCOL_MAX_PAYLOAD) {
+            last_t &message = last[direction][type];
+            message.record = record;
+            if (bytes > 0) {
+                memcpy(message.payload, msg, bytes);
+            }
+            message.valid = true;
+        }
+        size_t size = sizeof(record) + bytes;
+        uint8_t *data = LogFile::Reserve(log, size);
+        if (!data) {
+            stats.dropped++;
+            return;
+        }
+        memcpy(data, &record, sizeof(record));
+        if (bytes > 0) {
+            memcpy(data + sizeof(record), msg, bytes);
+        }
+        half = LogFile::Commit(log, size);
+        stats.records++;
+        stats.bytes += size;
+    }
+    if (half) {
+        LogFile::Wake(log);
+    }
+}
+
+// Called from Add under the lock
+void Recorder::AddKeyframe(uint64_t time_us) {
+    next_keyframe = time_us + RECORDER_KEYFRAME_PERIOD * 1000;
+    size_t size = sizeof(record_t);
+    for (const auto &types : last) {
+        for (const last_t &message : types) {
+            if (message.valid) { size += sizeof(record_t) + message.record.size; }
+        }
+    }
+    uint8_t *data = LogFile::Reserve(log, size);
+    if (!data) {
+        stats.dropped++;
+        return;
+    }
+    record_t record = { time_us, seq++, RECORD_KEYFRAME, 0, static_cast<uint16_t>(size - sizeof(record_t)) };
+    memcpy(data, &record, sizeof(record));
+    data += sizeof(record);
+    for (const auto &types : last) {
+        for (const last_t &message : types) {
+            if (!message.valid) { continue; }
+            memcpy(data, &message.record, sizeof(message.record));
+            memcpy(data + sizeof(message.record), message.payload, message.record.size);
+            data += sizeof(message.record) + message.record.size;
+        }
+    }
+    int buffer = LogFile::Filling(log);
+    if (keyframe_count[buffer] < RECORDER_BUFFER_KEYFRAMES) {
+        keyframes[buffer][keyframe_count[buffer]++] = { time_us, stats.bytes };
+    }
+    LogFile::Commit(log, size);
+    stats.bytes += size;
+}
+
+// On the writer thread, nothing fills the buffer until it returns
+void Recorder::Written(int buffer) {
+    index.insert(index.end(), keyframes[buffer], keyframes[buffer] + keyframe_count[buffer]);
+    keyframe_count[buffer] = 0;
+}
+
+// Offsets are only right if every buffer made it to the file
+void Recorder::WriteIndex() {
+    if (log.failed) { return; }
+    recording_footer_t footer = { static_cast<uint64_t>(log.file.tellp()), static_cast<uint32_t>(index.size()), RECORDER_INDEX_MAGIC };
+    LogFile::Write(log, index.data(), index.size() * sizeof(recording_index_t));
+    LogFile::Write(log, &footer, sizeof(footer));
+}
@@ -0,0 +1,85 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include "telemetry.hpp"
+#include "remote.hpp"
+#include "protocol.hpp"
+
+// Flight data recorder. Every message sent to and received from the autopilot is copied
+// into a log file (see logfile.hpp) by the thread that writes or parses it. Stopping writes
+// whatever is left and an index of the keyframes after the last record
+#define RECORDER_MAGIC { 'H', 'I', 'T', 'L', 'R', 'E', 'C', 0 }
+#define RECORDER_INDEX_MAGIC { 'H', 'I', 'T', 'L', 'I', 'D', 'X', 0 }
+// 2 added keyframes and the index
+#define RECORDER_VERSION 2
+// A keyframe with the last message of every type goes before the first record this
+// long after the previous keyframe (ms), so reading can start at any of them
+#define RECORDER_KEYFRAME_PERIOD 1000
+// Largest keyframe, each message as a record_t and its payload
+#define RECORDER_KEYFRAME_SIZE ((static_cast<int>(Telemetry::MSG_COUNT) + static_cast<int>(Remote::MSG_COUNT)) * (sizeof(record_t) + PROTOCOL_MAX_PAYLOAD))
+// Keyframes indexed per buffer, more than that are only found by reading
+#define RECORDER_BUFFER_KEYFRAMES 8
+#define RECORD_SENT 0
+#define RECORD_RECEIVED 1
+#define RECORD_KEYFRAME 2
+
+#pragma pack(push, 1)
+// Start of the file
+struct recording_header_t {
+    char magic[8];
+    uint32_t version;
+    // Timesync::Now() when recording started and the wall clock then, microseconds since 1970
+    uint64_t start_us;
+    int64_t unix_us;
+};
+// Before each message, followed by size bytes of the message as handed to Protocol::Encode
+// or as received, without the framing. A keyframe holds the last record of each direction
+// and type before it, each one with its record_t
+struct record_t {
+    // Timesync::Now() when its frame was taken to be written, or when it was parsed
+    uint64_t time_us;
+    // every record of the file, a gap is records dropped because the writer fell behind
+    uint32_t seq;
+    uint8_t direction;
+    // Telemetry::MSG_TYPE when sent, Remote::MSG_TYPE when received, 0 for keyframes
+    uint8_t type;
+    uint16_t size;
+};
+// Where each keyframe is, after the last record
+struct recording_index_t {
+    // time of the keyframe's record
+    uint64_t time_us;
+    // from the start of the file
+    uint64_t offset;
+};
+// End of the file, missing when the plug-in did not stop recording
+struct recording_footer_t {
+    // of the first recording_index_t
+    uint64_t offset;
+    uint32_t count;
+    char magic[8];
+};
+#pragma pack(pop)
+static_assert(sizeof(recording_header_t) == 28);
+static_assert(sizeof(record_t) == 16);
+static_assert(sizeof(recording_index_t) == 16);
+static_assert(sizeof(recording_footer_t) == 20);
+
+struct recorder_stats_t {
+    uint64_t records;
+    uint64_t dropped;
+    uint64_t bytes;
+};
+
+namespace Recorder {
+    // Open a new file named after the current time, false if it could not be created
+    bool Start();
+    void Stop();
+    bool IsRecording();
+    std::string GetPath();
+    recorder_stats_t GetStats();
+    // Called from the serial I/O thread and the sim thread, never block on the file
+    void Sent(int type, const void *msg, size_t bytes);
+    void Received(int type, const void *msg, size_t bytes);
+}
@@ -2,35 +2,42 @@
 #include <XPLMUtilities.h>
 #include <algorithm>
 #include <format>
+#include <cstring>
 #include "remote.hpp"
 #include "serial.hpp"
 #include "ui.hpp"
+#include "protocol.hpp"
+#include "datarefs.hpp"
+#include "timesync.hpp"
+#include "baud.hpp"
+#include "config.hpp"
+#include "recorder.hpp"
 
 namespace Remote {
     namespace DataRef {
-        XPLMDataRef override_roll = XPLMFindDataRef("sim/operation/override/override_joystick_roll");
-        XPLMDataRef override_pitch = XPLMFindDataRef("sim/operation/override/override_joystick_pitch");
-        XPLMDataRef override_yaw = XPLMFindDataRef("sim/operation/override/override_joystick_heading");
-        XPLMDataRef override_throttle = XPLMFindDataRef("sim/operation/override/override_throttles");
-        XPLMDataRef override_prop_pitch = XPLMFindDataRef("sim/operation/override/override_prop_pitch");
-        XPLMDataRef roll = XPLMFindDataRef("sim/joystick/yoke_roll_ratio");
-        XPLMDataRef pitch = XPLMFindDataRef("sim/joystick/yoke_pitch_ratio");
-        XPLMDataRef yaw = XPLMFindDataRef("sim/joystick/yoke_heading_ratio");
-        XPLMDataRef throttle = XPLMFindDataRef("sim/flightmodel/engine/ENGN_thro_use");
-        XPLMDataRef brake = XPLMFindDataRef("sim/flightmodel/controls/parkbrake");
-        XPLMDataRef prop_pitch = XPLMFindDataRef("sim/flightmodel/engine/POINT_pitch_deg_use");
-        XPLMDataRef engine_running = XPLMFindDataRef("sim/flightmodel/engine/ENGN_running");
-
-        XPLMDataRef max_prop_pitch = XPLMFindDataRef("sim/aircraft/prop/acf_max_pitch");
-        XPLMDataRef min_prop_pitch = XPLMFindDataRef("sim/aircraft/prop/acf_min_pitch");
-
-        XPLMDataRef governor = XPLMFindDataRef("sim/cockpit2/engine/actuators/governor_on");
-
-        XPLMDataRef fuel_remaining = XPLMFindDataRef("sim/flightmodel/weight/m_fuel_total");
+        dataref_t override_roll{ "sim/operation/override/override_joystick_roll", xplmType_Int };
+        dataref_t override_pitch{ "sim/operation/override/override_joystick_pitch", xplmType_Int };
+        dataref_t override_yaw{ "sim/operation/override/override_joystick_heading", xplmType_Int };
+        dataref_t override_throttle{ "sim/operation/override/override_throttles", xplmType_Int };
+        dataref_t override_prop_pitch{ "sim/operation/override/override_prop_pitch", xplmType_Int };
+        dataref_t roll{ "sim/joystick/yoke_roll_ratio", xplmType_Float };
+        dataref_t pitch{ "sim/joystick/yoke_pitch_ratio", xplmType_Float };
+        dataref_t yaw{ "sim/joystick/yoke_heading_ratio", xplmType_Float };
+        dataref_t throttle{ "sim/flightmodel/engine/ENGN_thro_use", xplmType_FloatArray };
+        dataref_t brake{ "sim/flightmodel/controls/parkbrake", xplmType_Float };
+        dataref_t prop_pitch{ "sim/flightmodel/engine/POINT_pitch_deg_use", xplmType_FloatArray };
+        dataref_t engine_running{ "sim/flightmodel/engine/ENGN_running", xplmType_IntArray };
+
+        dataref_t max_prop_pitch{ "sim/aircraft/prop/acf_max_pitch", xplmType_FloatArray };
+        dataref_t min_prop_pitch{ "sim/aircraft/prop/acf_min_pitch", xplmType_FloatArray };
+
+        dataref_t governor{ "sim/cockpit2/engine/actuators/governor_on", xplmType_IntArray };
+
+        dataref_t fuel_remaining{ "sim/flightmodel/weight/m_fuel_total", xplmType_Float };
     }
     namespace Commands {
-        XPLMCommandRef starter = XPLMFindCommand("sim/operation/auto_start");
-        XPLMCommandRef shutdown = XPLMFindCommand("sim/starters/shut_down");
+        command_t starter{ "sim/operation/auto_start" };
+        command_t shutdown{ "sim/starters/shut_down" };
     }
 
     struct {
@@ -43,18 +50,12 @@ namespace Remote {
         char postamble[3] = { 'E','N','D' };
     } footer;
 
-    enum MSG_TYPE {
-        PING,
-        STATE,
-        PLANE,
-        HELI
-    };
-
     struct {
         uint8_t state;
         uint32_t ahrs_count;
         uint16_t starter;
     } state_msg;
+    state_sync_t state_sync;
 
     struct {
         uint16_t roll;
@@ -71,15 +72,33 @@ namespace Remote {
         uint16_t throttle;
     } heli_msg;
 
-    size_t msg_size[4]{
+    // answer to our PING from firmware that can speak a newer protocol
+    struct {
+        uint8_t version;
+        uint8_t features;
+    } version_msg;
+
+    baud_msg_t baud_msg;
+
+    size_t msg_size[MSG_COUNT]{
         0,
         sizeof(state_msg),
         sizeof(plane_msg),
-        sizeof(heli_msg)
+        sizeof(heli_msg),
+        sizeof(version_msg),
+        sizeof(baud_msg)
     };
 
-    int pos = 0;
-    uint8_t buffer[400];
+    // v2 frames carry a sequence number per message type
+    uint16_t last_seq[MSG_COUNT];
+    bool seq_valid[MSG_COUNT];
+    remote_stats_t stats;
+    // in the middle of a run of discarded bytes
+    bool discarding = false;
+
+    // received bytes not parsed yet
+    size_t len = 0;
+    uint8_t buffer[1024];
 
     float max_collective = 0;
     float min_collective = 0;
@@ -92,9 +111,21 @@ namespace Remote {
 
     int state = -1;
     bool override_joy = true;
+    // v2 frame being decoded
+    uint8_t raw[PROTOCOL_MAX_FRAME];
+    // STATE grows by the clock exchange when timesync is on
+    size_t MsgSize(int type);
+
+    size_t ParseV1(size_t start);
+    size_t ParseV2(size_t start);
+    void Discard(size_t bytes);
+    // false for frames that were already seen
+    bool CheckSequence(int type, uint16_t seq);
+    void Dispatch(int type, const uint8_t *payload);
     void OnState();
     void OnPlane();
     void OnHeli();
+    void OnVersion();
 }
 
 void Remote::SetOverride(bool state) {
@@ -126,61 +157,197 @@ void Remote::Update() {
     Receive();
 }
 
+void Remote::Reset() {
+    len = 0;
+    std::fill_n(seq_valid, MSG_COUNT, false);
+    stats = {};
+    discarding = false;
+}
+
+remote_stats_t Remote::GetStats() {
+    return stats;
+}
+
 void Remote::Receive() {
-    int nbytes = Serial::Available();
-    while (nbytes-- > 0) {
-        // read a single byte into the buffer
-        if (!Serial::Read(&buffer[pos])) {
-            continue;
+    // take everything the I/O thread has received at once
+    len += Serial::Read(&buffer[len], sizeof(buffer) - len);
+    // the version may change halfway through the buffer
+    size_t start = 0;
+    if (Protocol::Version() < 2) {
+        start = ParseV1(start);
+    }
+    if (Protocol::Version() >= 2) {
+        start = ParseV2(start);
+    }
+    // keep an incomplete frame for the next call
+    len -= start;
+    memmove(buffer, &buffer[start], len);
+}
+
+// HITL + type + payload + length + END, returns where parsing stopped
+size_t Remote::ParseV1(size_t start) {
+    while (start < len) {
+        // jump to the next possible preamble
+        uint8_t *found = static_cast<uint8_t *>(memchr(&buffer[start], header.preamble[0], len - start));
+        if (!found) {
+            Discard(len - start);
+            return len;
         }
+        Discard(found - &buffer[start]);
+        start = found - buffer;
+        // wait for the rest of the header
+        if (len - start < sizeof(header)) { break; }
         // check if the first bytes of the message match predefined header
-        if (pos < sizeof(header.preamble)) {
-            if (buffer[pos] != header.preamble[pos]) {
-                pos = 0;
-                continue;
-            }
+        if (memcmp(&buffer[start], header.preamble, sizeof(header.preamble)) != 0) {
+            Discard(1);
+            start++;
+            continue;
         }
-        pos++;
         // check if header received is valid
-        if (pos == sizeof(header)) {
-            memcpy(&header, buffer, sizeof(header));
-            if (header.type < 0 || header.type > 3) {
-                pos = 0;
-                header.type = 0;
-                continue;
-            }
+        memcpy(&header, &buffer[start], sizeof(header));
+        if (header.type < 0 || header.type > VERSION) {
+            header.type = 0;
+            Discard(1);
+            start++;
+            continue;
         }
         // check if there are enough bytes for the packet type
-        if (pos == sizeof(header) + msg_size[header.type] + sizeof(footer)) {
-            pos = 0;
-            // check footer
-            memcpy(&footer, &buffer[sizeof(header) + msg_size[header.type]], sizeof(footer));
-            if (footer.len != sizeof(header) + msg_size[header.type]) { break; };
-            if (strncmp(footer.postamble, "END", 3) != 0) { break; };
-            // process message
-            switch (header.type) {
-            case PING:
-                break;
-            case STATE:
-                memcpy(&state_msg, &buffer[sizeof(header)], msg_size[header.type]);
-                OnState();
-                break;
-            case PLANE:
-                memcpy(&plane_msg, &buffer[sizeof(header)], msg_size[header.type]);
-                OnPlane();
-                break;
-            case HELI:
-                memcpy(&heli_msg, &buffer[sizeof(header)], msg_size[header.type]);
-                OnHeli();
-                break;
+        size_t size = sizeof(header) + msg_size[header.type] + sizeof(footer);
+        if (len - start < size) { break; }
+        // check footer, on mismatch resync from the next byte
+        const uint8_t *payload = &buffer[start + sizeof(header)];
+        memcpy(&footer, payload + msg_size[header.type], sizeof(footer));
+        if (static_cast<size_t>(footer.len) != sizeof(header) + msg_size[header.type] ||
+            strncmp(footer.postamble, "END", 3) != 0) {
+            stats.bad_frames++;
+            Discard(1);
+            start++;
+            continue;
+        }
+        start += size;
+        discarding = false;
+        stats.frames++;
+        stats.type_frames[header.type]++;
+        Dispatch(header.type, payload);
+        // everything after the version answer is v2
+        if (header.type == VERSION && Protocol::Version() >= 2) { break; }
+    }
+    return start;
+}
+
+// COBS frames split by zero bytes, returns where parsing stopped
+size_t Remote::ParseV2(size_t start) {
+    while (start < len) {
+        uint8_t *found = static_cast<uint8_t *>(memchr(&buffer[start], 0, len - start));
+        if (!found) {
+            // no frame can be this long, drop it
+            if (len - start > PROTOCOL_MAX_FRAME) {
+                stats.bad_frames++;
+                Discard(len - start);
+                return len;
             }
+            break;
         }
+        size_t size = found - &buffer[start];
+        size_t next = start + size + 1;
+        if (size == 0) {
+            start = next;
+            continue;
+        }
+        frame_header_t frame;
+        uint32_t stamp;
+        bool stamped = Timesync::IsEnabled();
+        const uint8_t *payload = Protocol::Decode(&buffer[start], size, raw, frame, stamped ? &stamp : nullptr);
+        start = next;
+        if (!payload || frame.type >= MSG_COUNT || frame.len != MsgSize(frame.type)) {
+            stats.bad_frames++;
+            Discard(size + 1);
+            continue;
+        }
+        discarding = false;
+        Baud::OnFrame();
+        if (!CheckSequence(frame.type, frame.seq)) { continue; }
+        stats.frames++;
+        stats.type_frames[frame.type]++;
+        if (stamped) {
+            Timesync::OnFrame(stamp, Timesync::Now());
+        }
+        Dispatch(frame.type, payload);
+    }
+    return start;
+}
+
+void Remote::Discard(size_t bytes) {
+    if (bytes == 0) { return; }
+    if (!discarding) {
+        stats.resyncs++;
+        discarding = true;
+    }
+    stats.discarded_bytes += bytes;
+}
+
+// Sequence gaps are frames lost on the way, a stale number is a duplicate
+// unless it is so far behind that the autopilot must have started over
+bool Remote::CheckSequence(int type, uint16_t seq) {
+    if (seq_valid[type]) {
+        uint16_t ahead = static_cast<uint16_t>(seq - last_seq[type]);
+        uint16_t behind = static_cast<uint16_t>(last_seq[type] - seq);
+        if (ahead == 0 || (ahead >= 0x8000 && behind <= SEQ_REORDER_WINDOW)) {
+            stats.duplicates++;
+            return false;
+        }
+        if (ahead < 0x8000) {
+            stats.dropped += ahead - 1;
+        }
+    }
+    last_seq[type] = seq;
+    seq_valid[type] = true;
+    return true;
+}
+
+size_t Remote::MsgSize(int type) {
+    if (type == STATE && Timesync::IsEnabled()) {
+        return msg_size[type] + sizeof(state_sync);
+    }
+    return msg_size[type];
+}
+
+// process message straight from the receive buffer
+void Remote::Dispatch(int type, const uint8_t *payload) {
+    Recorder::Received(type, payload, MsgSize(type));
+    switch (type) {
+    case PING:
+        break;
+    case STATE:
+        memcpy(&state_msg, payload, msg_size[type]);
+        if (Timesync::IsEnabled()) {
+            memcpy(&state_sync, payload + msg_size[type], sizeof(state_sync));
+            Timesync::OnState(state_sync, Timesync::Now());
+        }
+        OnState();
+        break;
+    case PLANE:
+        memcpy(&plane_msg, payload, msg_size[type]);
+        OnPlane();
+        break;
+    case HELI:
+        memcpy(&heli_msg, payload, msg_size[type]);
+        OnHeli();
+        break;
+    case VERSION:
+        memcpy(&version_msg, payload, msg_size[type]);
+        OnVersion();
+        break;
+    case BAUD:
+        memcpy(&baud_msg, payload, msg_size[type]);
+        Baud::OnMessage(baud_msg);
+        break;
     }
 }
 
 void Remote::OnState() {
     // armed ui text
-    std::string armed = "";
+    const char *armed = "";
     switch (state_msg.state) {
     case 0:
         armed = "Safety on";
@@ -192,7 +359,7 @@ void Remote::OnState() {
         armed = "Armed";
         break;
     }
-    UI::Window::LabelRemoteArmed::SetText(armed.c_str());
+    UI::Window::LabelRemoteArmed::SetText(armed);
     // start engine if armed
     // park brake when unarmed
     if (override_joy) {
@@ -225,7 +392,8 @@ void Remote::OnState() {
         }
     }
     // packet rate
-    UI::Window::LabelAHRSCount::SetText(std::format("AHRS: {} Hz", state_msg.ahrs_count));
+    char text[LABEL_SIZE];
+    UI::Window::LabelAHRSCount::SetText(UI::Format(text, "AHRS: {} Hz", state_msg.ahrs_count));
 }
 
 void Remote::OnPlane() {
@@ -233,15 +401,16 @@ void Remote::OnPlane() {
         XPLMSetDataf(DataRef::roll, map_value(pwm, std::pair(-1.0f, 1.0f), static_cast<float>(plane_msg.roll)));
         XPLMSetDataf(DataRef::pitch, map_value(pwm, std::pair(-1.0f, 1.0f), static_cast<float>(plane_msg.pitch)));
         XPLMSetDataf(DataRef::yaw, map_value(pwm, std::pair(-1.0f, 1.0f), static_cast<float>(plane_msg.yaw)));
-        float throttle[8];
-        std::fill_n(throttle, 8, map_value(pwm, std::pair(0.0f, 1.0f), static_cast<float>(plane_msg.throttle)));
-        XPLMSetDatavf(DataRef::throttle, &throttle[0], 0, 8);
+        float throttle[ENGINE_COUNT];
+        std::fill_n(throttle, ENGINE_COUNT, map_value(pwm, std::pair(0.0f, 1.0f), static_cast<float>(plane_msg.throttle)));
+        XPLMSetDatavf(DataRef::throttle, &throttle[0], 0, ENGINE_COUNT);
     }
 }
 
 void Remote::OnHeli() {
     if (override_joy) {
-        XPLMSetDatai(DataRef::governor, 0);
+        int governor[ENGINE_COUNT] = {};
+        XPLMSetDatavi(DataRef::governor, governor, 0, ENGINE_COUNT);
         XPLMSetDataf(DataRef::roll, map_value(pwm, std::pair(-1.0f, 1.0f), static_cast<float>(heli_msg.roll_cyclic)));
         XPLMSetDataf(DataRef::pitch, map_value(pwm, std::pair(-1.0f, 1.0f), static_cast<float>(heli_msg.pitch_cyclic)));
 
@@ -251,8 +420,17 @@ void Remote::OnHeli() {
         XPLMSetDatavf(DataRef::prop_pitch, &collective, 0, 1);
         XPLMSetDatavf(DataRef::prop_pitch, &tail, 1, 1);
 
-        float throttle[8];
-        std::fill_n(throttle, 8, map_value(pwm, std::pair(0.0f, 1.0f), static_cast<float>(heli_msg.throttle)));
-        XPLMSetDatavf(DataRef::throttle, &throttle[0], 0, 8);
+        float throttle[ENGINE_COUNT];
+        std::fill_n(throttle, ENGINE_COUNT, map_value(pwm, std::pair(0.0f, 1.0f), static_cast<float>(heli_msg.throttle)));
+        XPLMSetDatavf(DataRef::throttle, &throttle[0], 0, ENGINE_COUNT);
     }
+}
+
+void Remote::OnVersion() {
+    int version = std::min<int>(version_msg.version, PROTOCOL_VERSION);
+    if (version <= Protocol::Version()) { return; }
+    uint8_t features = version_msg.features & PROTOCOL_FEATURES;
+    Protocol::SetVersion(version, features);
+    Config::SetProtocol(version, features);
+    XPLMDebugString(std::format("HITL: Switched to protocol v{}, features {:#04x}\n", version, features).c_str());
 }
\ No newline at end of file
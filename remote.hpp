@@ -1,7 +1,43 @@
 #pragma once
 #include <utility>
+#include <cstdint>
+
+// A frame older than this many behind the last one is taken as the autopilot restarting its sequence
+#define SEQ_REORDER_WINDOW 64
+
+namespace Remote {
+    // Messages the firmware sends
+    enum MSG_TYPE {
+        PING,
+        STATE,
+        PLANE,
+        HELI,
+        VERSION,
+        // serial speed negotiation, see baud.hpp
+        BAUD,
+        MSG_COUNT
+    };
+}
+
+// Inbound link counters
+struct remote_stats_t {
+    uint64_t frames;
+    // frames that failed the checks and were skipped
+    uint64_t bad_frames;
+    // frames missing from the sequence, v2 only
+    uint64_t dropped;
+    // frames with a sequence number already seen, they are not applied. v2 only
+    uint64_t duplicates;
+    // times the parser lost the frame boundaries and had to search for the next frame
+    uint64_t resyncs;
+    // bytes thrown away while searching
+    uint64_t discarded_bytes;
+    uint64_t type_frames[Remote::MSG_COUNT];
+};
 
 namespace Remote {
+    void Reset();
+    remote_stats_t GetStats();
     void SetOverride(bool state);
     void Update();
     void Receive();
@@ -0,0 +1,93 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+
+// Single producer single consumer lock-free byte ring.
+// Exactly one thread may write to it and exactly one other thread may read from it,
+// neither side ever blocks or allocates.
+template<size_t N>
+class Ring {
+    static_assert(N > 0 && (N & (N - 1)) == 0, "Ring size must be a power of two");
+public:
+    size_t Size() const { return head.load(std::memory_order_acquire) - tail.load(std::memory_order_acquire); }
+    size_t Free() const { return N - Size(); }
+    size_t HighWater() const { return high_water.load(std::memory_order_relaxed); }
+
+    // -- Producer side --
+
+    // Copy bytes after the last staged ones without making them visible to the consumer,
+    // returns false and leaves the ring untouched if they don't fit
+    bool Stage(const void *src, size_t bytes) {
+        size_t tail_ = tail.load(std::memory_order_acquire);
+        if (staged + bytes - tail_ > N) { return false; }
+        CopyIn(staged, static_cast<const uint8_t *>(src), bytes);
+        staged += bytes;
+        return true;
+    }
+    // Publish all staged bytes at once
+    void Commit() {
+        head.store(staged, std::memory_order_release);
+        size_t used = staged - tail.load(std::memory_order_acquire);
+        if (used > high_water.load(std::memory_order_relaxed)) {
+            high_water.store(used, std::memory_order_relaxed);
+        }
+    }
+    // Forget staged bytes that were not commited
+    void Discard() { staged = head.load(std::memory_order_relaxed); }
+    bool Push(const void *src, size_t bytes) {
+        if (!Stage(src, bytes)) { return false; }
+        Commit();
+        return true;
+    }
+
+    // -- Consumer side --
+
+    // Copy up to max bytes starting offset bytes in without consuming them
+    size_t Peek(void *dest, size_t max, size_t offset = 0) const {
+        size_t tail_ = tail.load(std::memory_order_relaxed);
+        size_t used = head.load(std::memory_order_acquire) - tail_;
+        if (offset >= used) { return 0; }
+        size_t bytes = std::min(max, used - offset);
+        CopyOut(tail_ + offset, static_cast<uint8_t *>(dest), bytes);
+        return bytes;
+    }
+    // Copy and consume up to max bytes, dest may be null to just skip them
+    size_t Pop(void *dest, size_t max) {
+        size_t tail_ = tail.load(std::memory_order_relaxed);
+        size_t bytes = std::min(max, head.load(std::memory_order_acquire) - tail_);
+        if (dest) { CopyOut(tail_, static_cast<uint8_t *>(dest), bytes); }
+        tail.store(tail_ + bytes, std::memory_order_release);
+        return bytes;
+    }
+
+    // Only safe while neither side is running
+    void Clear() {
+        head.store(0);
+        tail.store(0);
+        high_water.store(0);
+        staged = 0;
+    }
+
+private:
+    void CopyIn(size_t at, const uint8_t *src, size_t bytes) {
+        size_t i = at & (N - 1);
+        size_t first = std::min(bytes, N - i);
+        memcpy(&data[i], src, first);
+        memcpy(&data[0], src + first, bytes - first);
+    }
+    void CopyOut(size_t at, uint8_t *dest, size_t bytes) const {
+        size_t i = at & (N - 1);
+        size_t first = std::min(bytes, N - i);
+        memcpy(dest, &data[i], first);
+        memcpy(dest + first, &data[0], bytes - first);
+    }
+    // cursors only ever increase, the index into data is masked
+    alignas(64) std::atomic<size_t> head = 0;
+    alignas(64) std::atomic<size_t> tail = 0;
+    std::atomic<size_t> high_water = 0;
+    size_t staged = 0;
+    uint8_t data[N];
+};
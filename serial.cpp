@@ -1,4 +1,3 @@
-#include <serialib.h>
 #include <XPLMUtilities.h>
 #include <cstdint>
 #include <thread>
@@ -8,24 +7,115 @@
 #include <format>
 #include <thread>
 #include <optional>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <condition_variable>
 #include "main.hpp"
 #include "serial.hpp"
+#include "ring.hpp"
 #include "ui.hpp"
 #include "remote.hpp"
 #include "telemetry.hpp"
+#include "protocol.hpp"
+#include "discovery.hpp"
+#include "transport.hpp"
+#include "timesync.hpp"
+#include "baud.hpp"
+#include "config.hpp"
+#include "capture.hpp"
+#include "recorder.hpp"
 
-#define SCAN_TIMEOUT 3000
-#define SCAN_MAXBYTES 200
+// sizes must be powers of two
+#define TX_RING_SIZE 8192
+#define RX_RING_SIZE 4096
+// largest chunk moved to or from the device at once
+#define IO_BUFFER_SIZE 2048
+#define IO_READ_TIMEOUT 100
+#define IO_IDLE_SLEEP std::chrono::microseconds(500)
+// keyed frames that waited longer than this are left out, the autopilot is better off without them (us)
+#define TX_MAX_AGE 20000
+// how much may sit in the OS queue before frames wait in the rings instead,
+// where they can still be dropped. In ms at the baud rate for serial links, in bytes for sockets
+#define TX_MAX_BACKLOG_MS 5
+#define TX_MAX_BACKLOG_BYTES 4096
+// between attempts to reach a fixed address
+#define DIAL_PERIOD std::chrono::seconds(1)
+// how long the last port is given to answer before scanning them all (ms),
+// the autopilot pings again once it noticed the link went quiet
+#define RECONNECT_TIMEOUT 2000
+// how long closing waits for frames still queued to be written, RESTART is sent right before (ms)
+#define DRAIN_TIMEOUT 200
 
 namespace Serial {
-    serialib serial;
-    int Available() { return serial.available(); };
-    bool IsOpen() { return serial.isDeviceOpen(); };
+    // only touched by the I/O thread while it is running, Start and Disconnect set it up and
+    // tear it down around it. Other threads go by open and serial instead
+    std::unique_ptr<Transport> transport;
+    std::atomic<bool> open = false;
+    // whether the last link was paced by a baud rate, kept after it closed
+    std::atomic<bool> serial = true;
+    // fixed link picked by the user, empty to look for the autopilot on the serial ports
+    std::string address;
+#pragma pack(push, 1)
+    // in front of every frame in the tx rings
+    struct frame_header_t {
+        uint16_t len;
+        int8_t key;
+        // low bits of Timesync::Now() when queued
+        uint32_t queued_us;
+        // message to record, its message_len bytes follow the frame. Only while recording
+        int8_t type;
+        uint16_t message_len;
+    };
+#pragma pack(pop)
+    // frames to the I/O thread
+    Ring<TX_RING_SIZE> tx;
+    Ring<TX_RING_SIZE> tx_imu;
+    // raw bytes from the I/O thread to the flight loop
+    Ring<RX_RING_SIZE> rx;
+    std::jthread io_thread;
+    std::atomic<const char *> io_error = nullptr;
+    // asked for by Disconnect, set by the I/O thread once everything queued before is written
+    // or it stopped on an error
+    std::atomic<bool> drain = false;
+    std::atomic<bool> drained = false;
+    std::atomic<uint64_t> tx_frames = 0;
+    std::atomic<uint64_t> tx_dropped_frames = 0;
+    std::atomic<uint64_t> tx_stale_frames = 0;
+    std::atomic<uint64_t> tx_writes = 0;
+    std::atomic<uint64_t> tx_partial_writes = 0;
+    std::atomic<uint64_t> tx_bytes = 0;
+    std::atomic<uint64_t> rx_bytes = 0;
+    // speed of a serial link, and the one the I/O thread should switch to or 0
+    std::atomic<unsigned int> baud_rate = BAUD_RATE;
+    std::atomic<unsigned int> baud_request = 0;
+    // asked for by the user, and whether the driver went along with it on the open link
+    std::atomic<bool> low_latency = false;
+    std::atomic<bool> driver_low_latency = false;
+    std::atomic<bool> low_latency_changed = false;
+    std::atomic<uint32_t> rx_wait_counts[HISTOGRAM_BINS];
+    std::atomic<uint64_t> rx_reads = 0;
+    std::atomic<uint64_t> rx_wait_total_us = 0;
+    std::atomic<uint64_t> rx_wait_max_us = 0;
+    int Available() { return static_cast<int>(rx.Size()); };
+    size_t Queued() { return tx.Size() + tx_imu.Size(); };
+    bool IsOpen() { return open; };
+    bool HasBaudRate() { return serial; };
+    std::string GetAddress() { return address; };
+    void SetBaudRate(unsigned int baud) { baud_request = baud; };
+    unsigned int GetBaudRate() { return baud_rate; };
+    bool IsChangingBaudRate() { return baud_request != 0; };
+    bool IsLowLatency() { return low_latency; };
     void Error(std::string what);
-    void Connect(std::string port);
-    char ping_msg[] = "PINGHITLPINGHITLPING";
+    void Start(std::unique_ptr<Transport> link);
+    std::unique_ptr<Transport> Find(std::string address, std::string last_port, std::stop_token stop);
+    void IOLoop(std::stop_token stop);
+    size_t PopFrames(uint8_t *dest, size_t len, size_t max, uint32_t now);
+    bool Front(Ring<TX_RING_SIZE> &ring, frame_header_t &frame, uint32_t now);
+    bool IsStale(const Ring<TX_RING_SIZE> &ring, const frame_header_t &frame, uint32_t now);
+    void RecordWait(int64_t us);
     std::stop_source stop_scan;
-    std::future<std::optional<std::string>> port_future;
+    std::future<std::unique_ptr<Transport>> port_future;
 }
 
 void Serial::StopScan() {
@@ -37,78 +127,388 @@ void Serial::StopScan() {
 void Serial::Scan() {
     if (!port_future.valid()) {
         stop_scan = std::stop_source{};
-        port_future = std::async(std::launch::async,
-            []() -> std::optional<std::string> {
-                int i = 0;
-                while (true) {
-                    i++;
-                    if (i > MAX_SERIAL_PORTS) { i = 1; }
-                    if (stop_scan.stop_requested()) { return std::optional<std::string>(); }
-                    // Attempt connection
-                    serialib temp_serial;
-                    std::string device = std::format("\\\\.\\COM{}", i);
-                    if (temp_serial.openDevice(device.c_str(), BAUD_RATE) != 1) { continue; }
-                    temp_serial.setDTR();
-                    temp_serial.clearRTS();
-                    // Scan for header
-                    char c;
-                    int pos = 0;
-                    int bytes_read = 0;
-                    while (bytes_read < SCAN_MAXBYTES && temp_serial.readBytes(&c, 1, SCAN_TIMEOUT) == 1) {
-                        bytes_read++;
-                        if (c == ping_msg[pos]) { pos++; } else { pos = 0; };
-                        if (pos == sizeof(ping_msg)) {
-                            // Header found, return device name
-                            temp_serial.closeDevice();
-                            return std::optional<std::string>(device);
-                        }
-                    }
-                }
-            });
+        port_future = std::async(std::launch::async, Find, address, Config::Get().port, stop_scan.get_token());
     }
     if (!port_future.valid()) { return; }
     if (port_future.wait_for(std::chrono::seconds(0)) != std::future_status::ready) { return; }
-    std::optional<std::string> port = port_future.get();
-    if (port.has_value()) {
-        Connect(port.value());
+    std::unique_ptr<Transport> link = port_future.get();
+    if (link) {
+        Start(std::move(link));
+    }
+}
+
+// Runs off the flight loop, opening a link may take a while
+std::unique_ptr<Transport> Serial::Find(std::string address, std::string last_port, std::stop_token stop) {
+    // the autopilot is most likely where it was, scanning every port can take seconds
+    if (address.empty() && !last_port.empty() && Discovery::Probe(last_port, RECONNECT_TIMEOUT, stop)) {
+        address = last_port;
     }
+    if (address.empty()) {
+        std::optional<std::string> port = Discovery::Find(stop);
+        if (!port.has_value()) { return nullptr; }
+        address = port.value();
+    }
+    while (!stop.stop_requested()) {
+        std::unique_ptr<Transport> link = Transport::Create(address);
+        if (link->Open()) { return link; }
+        std::condition_variable_any wake;
+        std::mutex lock;
+        std::unique_lock guard(lock);
+        wake.wait_for(guard, stop, DIAL_PERIOD, [] { return false; });
+    }
+    return nullptr;
+}
+
+// Use a fixed link instead of scanning the serial ports, empty to scan again
+void Serial::SetAddress(std::string address) {
+    if (address == Serial::address) { return; }
+    Serial::address = address;
+    Config::SetAddress(address);
+    Disconnect();
+    StopScan();
+}
+
+// Applied by the I/O thread, and kept for the next session
+void Serial::SetLowLatency(bool state) {
+    low_latency = state;
+    Config::SetLowLatency(state);
 }
 
-void Serial::Connect(std::string port) {
-    if (serial.openDevice(port.c_str(), BAUD_RATE) != 1) { return; };
-    serial.setDTR();
-    serial.clearRTS();
-    XPLMDebugString(std::format("HITL: Connected to {}\n", port).c_str());
+void Serial::Connect(std::string address) {
+    std::unique_ptr<Transport> link = Transport::Create(address);
+    if (!link->Open()) { return; }
+    Start(std::move(link));
+}
+
+void Serial::Start(std::unique_ptr<Transport> link) {
+    transport = std::move(link);
+    tx.Clear();
+    tx_imu.Clear();
+    rx.Clear();
+    tx_frames = 0;
+    tx_dropped_frames = 0;
+    tx_stale_frames = 0;
+    tx_writes = 0;
+    tx_partial_writes = 0;
+    tx_bytes = 0;
+    rx_bytes = 0;
+    baud_rate = BAUD_RATE;
+    baud_request = 0;
+    driver_low_latency = false;
+    low_latency_changed = false;
+    for (std::atomic<uint32_t> &count : rx_wait_counts) {
+        count = 0;
+    }
+    rx_reads = 0;
+    rx_wait_total_us = 0;
+    rx_wait_max_us = 0;
+    io_error = nullptr;
+    drain = false;
+    drained = false;
+    serial = transport->IsSerial();
+    open = true;
+    // what was agreed last time on this port is where this link starts
+    if (transport->IsSerial()) {
+        Config::SetPort(transport->Address());
+    }
+    Protocol::SetVersion(1);
+    Remote::Reset();
+    Timesync::Reset();
+    Baud::Reset(transport->IsSerial() ? Config::Get().baud : 0);
+    Telemetry::Reset();
+    XPLMDebugString(std::format("HITL: Connected to {}\n", transport->Address()).c_str());
     Remote::UpdateDataRefs();
-    UI::OnSerialConnect(port);
+    UI::OnSerialConnect(transport->Address());
+    io_thread = std::jthread(IOLoop);
 }
 
 void Serial::Disconnect() {
-    if (IsOpen()) {
-        serial.closeDevice();
+    // nothing may queue frames while the link is torn down
+    Telemetry::Stop();
+    if (io_thread.joinable()) {
+        // whatever was queued last, like RESTART, still goes out
+        drain = true;
+        std::chrono::steady_clock::time_point give_up = std::chrono::steady_clock::now() + std::chrono::milliseconds(DRAIN_TIMEOUT);
+        while (!drained && std::chrono::steady_clock::now() < give_up) {
+            std::this_thread::sleep_for(IO_IDLE_SLEEP);
+        }
+        io_thread.request_stop();
+        io_thread.join();
+    }
+    // the I/O thread is gone, the transport is ours again
+    if (transport && transport->IsOpen()) {
+        open = false;
+        transport->Close();
+        serial_stats_t stats = GetStats();
+        remote_stats_t remote = Remote::GetStats();
+        XPLMDebugString(std::format(
+            "HITL: Link closed, {} frames sent in {} writes, {} dropped, {} stale, tx ring peak {} bytes, rx ring peak {} bytes\n",
+            stats.tx_frames, stats.tx_writes, stats.tx_dropped_frames, stats.tx_stale_frames, stats.tx_high_water, stats.rx_high_water).c_str());
+        XPLMDebugString(std::format(
+            "HITL: Received bytes waited {} us on average, at most {} us, p99 below {:g} ms{}\n",
+            stats.rx_wait_mean_us, stats.rx_wait_max_us, stats.rx_wait.Percentile(0.99) / 1000.0,
+            low_latency ? " in low latency mode" : "").c_str());
+        XPLMDebugString(std::format(
+            "HITL: {} frames received, {} damaged, {} lost\n",
+            remote.frames, remote.bad_frames, remote.dropped).c_str());
+        timesync_stats_t sync = Timesync::GetStats();
+        if (sync.synced) {
+            XPLMDebugString(std::format(
+                "HITL: Clock offset {:.1f} ms, drift {}, p99 latency below {:g} ms up and {:g} ms down\n",
+                sync.offset_us / 1000.0, sync.drift_valid ? std::format("{:.0f} ppm", sync.drift_ppm) : "not known yet",
+                sync.uplink.Percentile(0.99) / 1000.0,
+                sync.downlink.Percentile(0.99) / 1000.0).c_str());
+        }
         UI::OnSerialDisconnect();
     }
+    Config::Save();
     Remote::UpdateDataRefs();
 }
 
+// Called from the flight loop, reports errors raised by the I/O thread
+void Serial::Update() {
+    if (low_latency_changed.exchange(false)) {
+        XPLMDebugString(std::format("HITL: Low latency mode {}{}\n", low_latency ? "on" : "off",
+            low_latency && !driver_low_latency ? ", the driver still batches received bytes" : "").c_str());
+    }
+    const char *what = io_error.exchange(nullptr);
+    if (what) {
+        Error(what);
+    }
+}
+
 void Serial::Send(void *buffer, size_t bytes) {
-    if (IsOpen()) {
-        if (serial.writeBytes(buffer, bytes) == -1) {
-            Error("Failed to write");
+    Send({ { buffer, bytes } });
+}
+
+void Serial::Send(std::initializer_list<serial_chunk_t> frame, Queue queue, int key, const serial_message_t *message) {
+    if (!IsOpen()) { return; }
+    Ring<TX_RING_SIZE> &tx = queue == Queue::Imu ? tx_imu : Serial::tx;
+    size_t bytes = 0;
+    for (const serial_chunk_t &chunk : frame) {
+        bytes += chunk.bytes;
+    }
+    bool record = message && message->bytes <= PROTOCOL_MAX_PAYLOAD && Recorder::IsRecording();
+    frame_header_t header = { static_cast<uint16_t>(bytes), static_cast<int8_t>(key), static_cast<uint32_t>(Timesync::Now()),
+        static_cast<int8_t>(record ? message->type : SERIAL_TYPE_NONE), static_cast<uint16_t>(record ? message->bytes : 0) };
+    bool queued = bytes <= IO_BUFFER_SIZE && tx.Stage(&header, sizeof(header));
+    for (const serial_chunk_t &chunk : frame) {
+        queued = queued && tx.Stage(chunk.data, chunk.bytes);
+    }
+    if (record && message->bytes > 0) {
+        queued = queued && tx.Stage(message->data, message->bytes);
+    }
+    if (!queued) {
+        // link is backed up, never wait for it on the sim thread
+        tx.Discard();
+        tx_dropped_frames++;
+        return;
+    }
+    tx.Commit();
+    tx_frames++;
+}
+
+// Move as many received bytes as fit in dest
+size_t Serial::Read(uint8_t *dest, size_t max) {
+    if (!IsOpen()) { return 0; }
+    return rx.Pop(dest, max);
+}
+
+serial_stats_t Serial::GetStats() {
+    histogram_t rx_wait = {};
+    for (int bin = 0; bin < HISTOGRAM_BINS; bin++) {
+        rx_wait.counts[bin] = rx_wait_counts[bin];
+        rx_wait.total += rx_wait.counts[bin];
+    }
+    return {
+        std::max(tx.HighWater(), tx_imu.HighWater()),
+        rx.HighWater(),
+        tx_frames,
+        tx_dropped_frames,
+        tx_stale_frames,
+        tx_writes,
+        tx_partial_writes,
+        tx_bytes,
+        rx_bytes,
+        rx_wait,
+        rx_reads > 0 ? rx_wait_total_us / rx_reads : 0,
+        rx_wait_max_us
+    };
+}
+
+// Owns the device while connected, moves bytes between it and the rings
+void Serial::IOLoop(std::stop_token stop) {
+    uint8_t buffer[IO_BUFFER_SIZE];
+    // frames taken from the rings, sent bytes of it already went out
+    uint8_t pending[IO_BUFFER_SIZE];
+    size_t pending_len = 0;
+    size_t pending_sent = 0;
+    bool serial = Serial::serial;
+    size_t max_backlog = serial ? baud_rate / 10 * TX_MAX_BACKLOG_MS / 1000 : TX_MAX_BACKLOG_BYTES;
+    // when the last byte written leaves the wire at the baud rate, ptys and
+    // USB adapters keep part of the queue where TIOCOUTQ can't see it
+    std::chrono::steady_clock::time_point wire_free = std::chrono::steady_clock::now();
+    std::chrono::duration<double> byte_time(10.0 / baud_rate);
+    // whatever is read next arrived after this
+    std::chrono::steady_clock::time_point rx_empty = std::chrono::steady_clock::now();
+    bool applied_low_latency = false;
+    while (!stop.stop_requested()) {
+        bool idle = true;
+        if (low_latency != applied_low_latency) {
+            applied_low_latency = low_latency;
+            driver_low_latency = transport->SetLowLatency(applied_low_latency) && applied_low_latency;
+            low_latency_changed = true;
+        }
+        // inbound, never read more than the flight loop has room for
+        int available = transport->Available();
+        if (available < 0) {
+            io_error = "Connection lost";
+            drained = true;
+            return;
+        }
+        size_t nbytes = std::min({ static_cast<size_t>(available), rx.Free(), sizeof(buffer) });
+        if (nbytes > 0) {
+            int read = transport->Read(buffer, nbytes, IO_READ_TIMEOUT);
+            if (read < 0) {
+                io_error = "Failed to read";
+                drained = true;
+                return;
+            }
+            rx.Push(buffer, read);
+            Capture::Received(buffer, read);
+            rx_bytes += read;
+            idle = false;
+            std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+            RecordWait(std::chrono::duration_cast<std::chrono::microseconds>(now - rx_empty).count());
+            rx_empty = now;
+        } else if (available == 0) {
+            rx_empty = std::chrono::steady_clock::now();
+        }
+        // outbound, new frames are only taken once the last ones are written
+        // and the OS queue is short, until then stale ones are dropped from the rings
+        size_t room = 0;
+        if (pending_sent == pending_len) {
+            int backlog = transport->Backlog();
+            if (serial) {
+                std::chrono::duration<double> queued = wire_free - std::chrono::steady_clock::now();
+                backlog = std::max(backlog, static_cast<int>(queued / byte_time));
+            }
+            room = backlog < static_cast<int>(max_backlog) ? std::min(max_backlog - backlog, sizeof(pending)) : 0;
+            pending_len = 0;
+            pending_sent = 0;
+            // new frames wait for the new speed, what was written before must leave at the old one
+            unsigned int baud = baud_request;
+            if (baud != 0) {
+                room = 0;
+            }
+            if (baud != 0 && backlog == 0) {
+                if (transport->SetBaudRate(baud)) {
+                    baud_rate = baud;
+                    max_backlog = baud / 10 * TX_MAX_BACKLOG_MS / 1000;
+                    byte_time = std::chrono::duration<double>(10.0 / baud);
+                }
+                baud_request = 0;
+            }
+        }
+        pending_len = PopFrames(pending, pending_len, room, static_cast<uint32_t>(Timesync::Now()));
+        if (pending_sent < pending_len) {
+            // a busy link takes part of it, the rest goes on the next pass
+            int written = transport->Write(&pending[pending_sent], pending_len - pending_sent);
+            if (written < 0) {
+                io_error = "Failed to write";
+                drained = true;
+                return;
+            }
+            Capture::Sent(&pending[pending_sent], written);
+            pending_sent += written;
+            tx_bytes += written;
+            if (written > 0) {
+                tx_writes++;
+            }
+            if (written > 0 && pending_sent < pending_len) {
+                tx_partial_writes++;
+            }
+            wire_free = std::max(wire_free, std::chrono::steady_clock::now()) +
+                std::chrono::duration_cast<std::chrono::steady_clock::duration>(written * byte_time);
+            idle = idle && written == 0;
+        }
+        // what the sim thread agreed on with the autopilot is written here, never on the sim thread
+        Config::Save();
+        // checked after the request was seen, so anything queued before it is counted
+        if (drain && pending_sent == pending_len && tx.Size() == 0 && tx_imu.Size() == 0) {
+            drained = true;
+        }
+        if (idle && applied_low_latency) {
+            // new frames to send don't wake it up, IO_IDLE_SLEEP still bounds how long they wait.
+            // It returns right as bytes arrive, so they have not waited yet either way
+            transport->Wait(IO_IDLE_SLEEP);
+            rx_empty = std::chrono::steady_clock::now();
+        } else if (idle) {
+            std::this_thread::sleep_for(IO_IDLE_SLEEP);
         }
     }
 }
 
-bool Serial::Read(uint8_t *dest) {
-    if (!IsOpen()) { return false; }
-    if (serial.readBytes(dest, 1) <= 0) {
-        Error("Failed to read");
-        return false;
+// Append whole frames to the len bytes in dest so they never get cut or mixed on the wire,
+// up to max bytes but at least one frame unless max is 0. The oldest frame of both queues
+// goes first, IMU samples on a tie, so neither one can starve the other on a slow link.
+// Messages are recorded here, as their frames are taken to be written
+size_t Serial::PopFrames(uint8_t *dest, size_t len, size_t max, uint32_t now) {
+    frame_header_t imu, main;
+    uint8_t message[PROTOCOL_MAX_PAYLOAD];
+    while (true) {
+        bool has_imu = Front(tx_imu, imu, now);
+        bool has_main = Front(tx, main, now);
+        if (!has_imu && !has_main) { break; }
+        bool take_imu = has_imu && (!has_main || static_cast<int32_t>(main.queued_us - imu.queued_us) >= 0);
+        Ring<TX_RING_SIZE> &ring = take_imu ? tx_imu : tx;
+        const frame_header_t &frame = take_imu ? imu : main;
+        if (max == 0 || (len > 0 && len + frame.len > max)) { break; }
+        ring.Pop(nullptr, sizeof(frame_header_t));
+        len += ring.Pop(&dest[len], frame.len);
+        if (frame.type != SERIAL_TYPE_NONE) {
+            ring.Pop(message, frame.message_len);
+            Recorder::Sent(frame.type, message, frame.message_len);
+        }
+    }
+    return len;
+}
+
+// Header of the first frame worth sending, stale ones in front of it are dropped
+bool Serial::Front(Ring<TX_RING_SIZE> &ring, frame_header_t &frame, uint32_t now) {
+    while (ring.Peek(&frame, sizeof(frame)) == sizeof(frame)) {
+        if (!IsStale(ring, frame, now)) { return true; }
+        ring.Pop(nullptr, sizeof(frame) + frame.len + frame.message_len);
+        tx_stale_frames++;
+    }
+    return false;
+}
+
+// Too old to be worth sending, or a newer frame with the same key is queued behind it.
+// Frames without a key always go out
+bool Serial::IsStale(const Ring<TX_RING_SIZE> &ring, const frame_header_t &frame, uint32_t now) {
+    if (frame.key == SERIAL_KEY_NONE) { return false; }
+    if (now - frame.queued_us > TX_MAX_AGE) { return true; }
+    frame_header_t next;
+    size_t offset = sizeof(frame) + frame.len + frame.message_len;
+    while (ring.Peek(&next, sizeof(next), offset) == sizeof(next)) {
+        if (next.key == frame.key) { return true; }
+        offset += sizeof(next) + next.len + next.message_len;
+    }
+    return false;
+}
+
+// Counted on the I/O thread, GetStats copies them
+void Serial::RecordWait(int64_t us) {
+    rx_wait_counts[histogram_t::Bin(us)]++;
+    rx_reads++;
+    rx_wait_total_us += us;
+    if (static_cast<uint64_t>(us) > rx_wait_max_us) {
+        rx_wait_max_us = us;
     }
-    return true;
 }
 
 void Serial::Error(std::string what) {
     XPLMDebugString(std::format("HITL: Serial error {}.\n", what).c_str());
     Disconnect();
-}
\ No newline at end of file
+}
@@ -4,21 +4,91 @@
 #include <memory>
 #include <optional>
 #include <stop_token>
+#include <initializer_list>
+#include <cstdint>
+#include "timesync.hpp"
 
 #define MAX_SERIAL_PORTS 99
 #define BAUD_RATE 115200
+// Key of frames that never replace each other
+#define SERIAL_KEY_NONE -1
+// Type of frames that carry nothing to record
+#define SERIAL_TYPE_NONE -1
 
 struct serial_ports_t {
     std::vector<std::string> names;
     std::vector<std::string> display_names;
 };
 
+// Piece of an outgoing frame
+struct serial_chunk_t {
+    const void *data;
+    size_t bytes;
+};
+
+// Message a frame carries as handed to the encoder, recorded once the frame is taken to be written
+struct serial_message_t {
+    int type;
+    const void *data;
+    size_t bytes;
+};
+
+// Link counters, ring usage is in bytes
+struct serial_stats_t {
+    size_t tx_high_water;
+    size_t rx_high_water;
+    uint64_t tx_frames;
+    uint64_t tx_dropped_frames;
+    // left out by the I/O thread, too old or replaced by a newer one
+    uint64_t tx_stale_frames;
+    // write calls that moved bytes, and how many of those the link cut short
+    uint64_t tx_writes;
+    uint64_t tx_partial_writes;
+    uint64_t tx_bytes;
+    uint64_t rx_bytes;
+    // how long received bytes sat in the OS before the I/O thread took them, at most.
+    // Time since it last found nothing to read, taken on every read that got bytes
+    histogram_t rx_wait;
+    uint64_t rx_wait_mean_us;
+    uint64_t rx_wait_max_us;
+};
+
 namespace Serial {
+    // Outbound queues, each one may only be fed by a single thread
+    enum class Queue {
+        Main, // flight loop
+        Imu // IMU emitter thread
+    };
+    // Queue a whole frame for the I/O thread, it is dropped if the queue is full.
+    // While the link is backed up only the newest queued frame of each key is sent,
+    // and only if it is still fresh. The message is recorded by the I/O thread when the frame
+    // goes out, frames dropped or left out on the way never show up in the recording
     void Send(void *buffer, size_t bytes);
+    void Send(std::initializer_list<serial_chunk_t> frame, Queue queue = Queue::Main, int key = SERIAL_KEY_NONE,
+        const serial_message_t *message = nullptr);
     int Available();
+    // Bytes waiting in the outbound queues
+    size_t Queued();
+    // Open any transport address right away, see transport.hpp
+    void Connect(std::string address);
+    void SetAddress(std::string address);
+    std::string GetAddress();
     void Disconnect();
-    bool Read(uint8_t *dest);
+    size_t Read(uint8_t *dest, size_t max);
     bool IsOpen();
+    // false on network links, which have no fixed capacity
+    bool HasBaudRate();
+    // Switch the serial speed once everything queued so far has left at the current one,
+    // the rate stays the same if the port does not take it
+    void SetBaudRate(unsigned int baud);
+    unsigned int GetBaudRate();
+    bool IsChangingBaudRate();
+    // Low latency mode, the I/O thread wakes up as soon as bytes arrive instead of
+    // polling and the serial driver is asked not to batch received bytes
+    void SetLowLatency(bool state);
+    bool IsLowLatency();
+    void Update();
     void Scan();
     void StopScan();
-}
\ No newline at end of file
+    serial_stats_t GetStats();
+}
@@ -17,6 +17,23 @@ This is a licence-free software, it can be used by anyone who try to build a bet
 
 #include "serialib.h"
 
+#if defined (__linux__)
+// struct termios2 from asm/termbits.h, which can't be included along with termios.h
+struct serialib_termios2 {
+    tcflag_t c_iflag;
+    tcflag_t c_oflag;
+    tcflag_t c_cflag;
+    tcflag_t c_lflag;
+    cc_t c_line;
+    cc_t c_cc[19];
+    speed_t c_ispeed;
+    speed_t c_ospeed;
+};
+#define SERIALIB_TCGETS2 _IOR('T', 0x2A, struct serialib_termios2)
+#define SERIALIB_TCSETS2 _IOW('T', 0x2B, struct serialib_termios2)
+#define SERIALIB_BOTHER 0010000
+#endif
+
 
 
 //_____________________________________
@@ -183,7 +200,8 @@ char serialib::openDevice(const char *Device, const unsigned int Bauds,
     case 115200 :   dcbSerialParams.BaudRate=CBR_115200; break;
     case 128000 :   dcbSerialParams.BaudRate=CBR_128000; break;
     case 256000 :   dcbSerialParams.BaudRate=CBR_256000; break;
-    default : return -4;
+    // Any other speed is up to the driver
+    default :       dcbSerialParams.BaudRate=Bauds; break;
     }
     //select data size
     BYTE bytesize = 0;
@@ -255,8 +273,9 @@ char serialib::openDevice(const char *Device, const unsigned int Bauds,
     // Clear all the options
     bzero(&options, sizeof(options));
 
-    // Prepare speed (Bauds)
+    // Prepare speed (Bauds), other speeds are set once the port is configured
     speed_t         Speed;
+    bool            customSpeed = false;
     switch (Bauds)
     {
     case 110  :     Speed=B110; break;
@@ -309,7 +328,7 @@ char serialib::openDevice(const char *Device, const unsigned int Bauds,
 #if defined (B4000000)
     case 4000000 :   Speed=B4000000; break;
 #endif
-    default : return -4;
+    default :       Speed=B115200; customSpeed=true; break;
     }
     int databits_flag = 0;
     switch(Databits) {
@@ -349,12 +368,78 @@ char serialib::openDevice(const char *Device, const unsigned int Bauds,
     options.c_cc[VMIN]=0;
     // Activate the settings
     tcsetattr(fd, TCSANOW, &options);
+    if (customSpeed && setBaudRate(Bauds) != 1) return -4;
     // Success
     return (1);
 #endif
 
 }
 
+
+
+/*!
+     \brief Change the speed of an open device, any speed the driver accepts
+     \param Bauds : Speed of the serial device in bauds, not limited to the standard ones
+     \return 1 success
+     \return -3 error while getting port parameters
+     \return -5 error while writing port parameters, the speed is not supported
+  */
+char serialib::setBaudRate(const unsigned int Bauds)
+{
+#if defined (_WIN32) || defined( _WIN64)
+    DCB dcbSerialParams;
+    dcbSerialParams.DCBlength=sizeof(dcbSerialParams);
+    if (!GetCommState(hSerial, &dcbSerialParams)) return -3;
+    dcbSerialParams.BaudRate=Bauds;
+    if(!SetCommState(hSerial, &dcbSerialParams)) return -5;
+    return 1;
+#endif
+#if defined (__linux__)
+    // BOTHER takes the speed as a number instead of one of the Bxxx constants
+    struct serialib_termios2 options;
+    if (ioctl(fd, SERIALIB_TCGETS2, &options) != 0) return -3;
+    options.c_cflag &= ~CBAUD;
+    options.c_cflag |= SERIALIB_BOTHER;
+    options.c_ispeed = Bauds;
+    options.c_ospeed = Bauds;
+    if (ioctl(fd, SERIALIB_TCSETS2, &options) != 0) return -5;
+    return 1;
+#elif defined (__APPLE__)
+    // speed_t is the speed itself
+    struct termios options;
+    if (tcgetattr(fd, &options) != 0) return -3;
+    cfsetispeed(&options, Bauds);
+    cfsetospeed(&options, Bauds);
+    if (tcsetattr(fd, TCSANOW, &options) != 0) return -5;
+    return 1;
+#endif
+}
+
+/*!
+     \brief Ask the driver to hand received bytes over as soon as they arrive instead of batching them,
+            on USB adapters such as FTDI this drops the latency timer from 16 ms to 1 ms (Linux only)
+     \param enabled : true for low latency, false for the driver default
+     \return 1 success
+     \return -1 the driver or the platform does not support it
+  */
+char serialib::setLowLatency(bool enabled)
+{
+#if defined (__linux__)
+    struct serial_struct serial;
+    if (ioctl(fd, TIOCGSERIAL, &serial) != 0) return -1;
+    if (enabled)
+        serial.flags |= ASYNC_LOW_LATENCY;
+    else
+        serial.flags &= ~ASYNC_LOW_LATENCY;
+    if (ioctl(fd, TIOCSSERIAL, &serial) != 0) return -1;
+    return 1;
+#else
+    // Windows drivers keep it in their own settings, such as the FTDI latency timer in the device manager
+    UNUSED(enabled);
+    return -1;
+#endif
+}
+
 bool serialib::isDeviceOpen()
 {
 #if defined (_WIN32) || defined( _WIN64)
@@ -399,6 +484,8 @@ int serialib::writeChar(const char Byte)
 #if defined (_WIN32) || defined( _WIN64)
     // Number of bytes written
     DWORD dwBytesWritten;
+    // Blocking again after writeSome
+    if (setWriteTimeout(MAXDWORD) != 1) return -1;
     // Write the char to the serial device
     // Return -1 if an error occured
     if(!WriteFile(hSerial,&Byte,1,&dwBytesWritten,NULL)) return -1;
@@ -431,6 +518,8 @@ int serialib::writeString(const char *receivedString)
 #if defined (_WIN32) || defined( _WIN64)
     // Number of bytes written
     DWORD dwBytesWritten;
+    // Blocking again after writeSome
+    if (setWriteTimeout(MAXDWORD) != 1) return -1;
     // Write the string
     if(!WriteFile(hSerial,receivedString,strlen(receivedString),&dwBytesWritten,NULL))
         // Error while writing, return -1
@@ -465,6 +554,8 @@ int serialib::writeBytes(const void *Buffer, const unsigned int NbBytes)
 #if defined (_WIN32) || defined( _WIN64)
     // Number of bytes written
     DWORD dwBytesWritten;
+    // Blocking again after writeSome
+    if (setWriteTimeout(MAXDWORD) != 1) return -1;
     // Write data
     if(!WriteFile(hSerial, Buffer, NbBytes, &dwBytesWritten, NULL))
         // Error while writing, return -1
@@ -482,6 +573,62 @@ int serialib::writeBytes(const void *Buffer, const unsigned int NbBytes)
 
 
 
+/*!
+     \brief Write an array of data on the current serial port without waiting for room in the output buffer.
+            On Windows the write gives up after WRITE_SOME_TIMEOUT_MS, the shortest write timeout there is
+     \param Buffer : array of bytes to send on the port
+     \param NbBytes : number of byte to send
+     \return The number of bytes written, possibly less than NbBytes or 0 when the output buffer is full
+     \return -1 error while writting data
+  */
+int serialib::writeSome(const void *Buffer, const unsigned int NbBytes)
+{
+#if defined (_WIN32) || defined( _WIN64)
+    // Number of bytes written
+    DWORD dwBytesWritten = 0;
+    if (setWriteTimeout(WRITE_SOME_TIMEOUT_MS) != 1) return -1;
+    // Write data, what the driver took before the timeout counts
+    if(!WriteFile(hSerial, Buffer, NbBytes, &dwBytesWritten, NULL))
+    {
+        DWORD error = GetLastError();
+        if (error == ERROR_TIMEOUT || error == ERROR_SEM_TIMEOUT) return dwBytesWritten;
+        // Error while writing, return -1
+        return -1;
+    }
+    return dwBytesWritten;
+#endif
+#if defined (__linux__) || defined(__APPLE__)
+    // Write data, the port was opened non blocking
+    ssize_t written = write(fd, Buffer, NbBytes);
+    if (written >= 0) return written;
+    // Output buffer full
+    if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) return 0;
+    return -1;
+#endif
+}
+
+
+
+#if defined (_WIN32) || defined( _WIN64)
+/*!
+     \brief Set how long writes wait for room in the output buffer, the read timeouts are kept
+     \param timeOut_ms : MAXDWORD to wait as long as it takes
+     \return 1 success
+     \return -1 error while setting the Timeout
+  */
+int serialib::setWriteTimeout(DWORD timeOut_ms)
+{
+    if (timeouts.WriteTotalTimeoutConstant == timeOut_ms) return 1;
+    timeouts.WriteTotalTimeoutConstant = timeOut_ms;
+    timeouts.WriteTotalTimeoutMultiplier = 0;
+    // Write the parameters, return -1 if an error occured
+    if(!SetCommTimeouts(hSerial, &timeouts)) return -1;
+    return 1;
+}
+#endif
+
+
+
 /*!
      \brief Wait for a byte from the serial device and return the data read
      \param pByte : data read on the serial device
@@ -658,9 +805,7 @@ int serialib::readString(char *receivedString,char finalChar,unsigned int maxNbB
      \param buffer : array of bytes read from the serial device
      \param maxNbBytes : maximum allowed number of bytes read
      \param timeOut_ms : delay of timeout before giving up the reading
-     \param sleepDuration_us : delay of CPU relaxing in microseconds (Linux only)
-            In the reading loop, a sleep can be performed after each reading
-            This allows CPU to perform other tasks
+     \param sleepDuration_us : no longer used, the reading loop waits for bytes with poll()
      \return >=0 return the number of bytes read before timeout or
                 requested data is completed
      \return -1 error while setting the Timeout
@@ -689,6 +834,7 @@ int serialib::readBytes (void *buffer,unsigned int maxNbBytes,unsigned int timeO
     return dwBytesRead;
 #endif
 #if defined (__linux__) || defined(__APPLE__)
+    UNUSED(sleepDuration_us);
     // Timer used for timeout
     timeOut          timer;
     // Initialise the timer
@@ -701,8 +847,8 @@ int serialib::readBytes (void *buffer,unsigned int maxNbBytes,unsigned int timeO
         unsigned char* Ptr=(unsigned char*)buffer+NbByteRead;
         // Try to read a byte on the device
         int Ret=read(fd,(void*)Ptr,maxNbBytes-NbByteRead);
-        // Error while reading
-        if (Ret==-1) return -2;
+        // Error while reading, the port is non-blocking so nothing to read yet is not one
+        if (Ret==-1 && errno!=EAGAIN && errno!=EINTR) return -2;
 
         // One or several byte(s) has been read on the device
         if (Ret>0)
@@ -713,8 +859,11 @@ int serialib::readBytes (void *buffer,unsigned int maxNbBytes,unsigned int timeO
             if (NbByteRead>=maxNbBytes)
                 return NbByteRead;
         }
-        // Suspend the loop to avoid charging the CPU
-        usleep (sleepDuration_us);
+        // Wait for the next bytes or the end of the timeout, whichever comes first
+        unsigned long int elapsed = timer.elapsedTime_ms();
+        if (timeOut_ms!=0 && elapsed>=timeOut_ms) break;
+        struct pollfd entry = { fd, POLLIN, 0 };
+        if (poll(&entry, 1, timeOut_ms==0 ? -1 : (int)(timeOut_ms-elapsed)) < 0 && errno!=EINTR) return -2;
     }
     // Timeout reached, return the number of bytes read
     return NbByteRead;
@@ -777,6 +926,63 @@ int serialib::available()
 
 
 
+/*!
+    \brief     Return the number of bytes written to the port but not sent yet
+    \return The number of bytes still in the output buffer of the driver.
+*/
+int serialib::pending()
+{
+#if defined (_WIN32) || defined(_WIN64)
+    // Device errors
+    DWORD commErrors;
+    // Device status
+    COMSTAT commStatus;
+    // Read status
+    ClearCommError(hSerial, &commErrors, &commStatus);
+    // Return the number of bytes waiting to be sent
+    return commStatus.cbOutQue;
+#endif
+#if defined (__linux__) || defined(__APPLE__)
+    int nBytes=0;
+    // Return number of bytes left in the transmitter
+    ioctl(fd, TIOCOUTQ, &nBytes);
+    return nBytes;
+#endif
+}
+
+
+
+/*!
+    \brief     Wait until bytes are received or the timeout runs out
+    \param timeOut_us : longest wait in microseconds
+    \return 1 bytes can be read
+    \return 0 timeout reached
+    \return -1 error while waiting
+*/
+int serialib::waitReadable(unsigned int timeOut_us)
+{
+#if defined (_WIN32) || defined(_WIN64)
+    // A blocking handle can't wait without reading, check before and after sleeping
+    if (available()>0) return 1;
+    Sleep((timeOut_us+999)/1000);
+    return available()>0;
+#endif
+#if defined (__linux__)
+    struct pollfd entry = { fd, POLLIN, 0 };
+    struct timespec timeout = { (time_t)(timeOut_us/1000000), (long)(timeOut_us%1000000)*1000 };
+    int Ret=ppoll(&entry, 1, &timeout, NULL);
+    if (Ret<0) return errno==EINTR ? 0 : -1;
+    return Ret>0;
+#elif defined (__APPLE__)
+    struct pollfd entry = { fd, POLLIN, 0 };
+    int Ret=poll(&entry, 1, (int)((timeOut_us+999)/1000));
+    if (Ret<0) return errno==EINTR ? 0 : -1;
+    return Ret>0;
+#endif
+}
+
+
+
 // __________________
 // ::: I/O Access :::
 
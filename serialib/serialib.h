@@ -35,6 +35,8 @@ This is a licence-free software, it can be used by anyone who try to build a bet
 #endif
     // Accessing to the serial port under Windows
     #include <windows.h>
+    // Windows has no write timeout that returns at once, writeSome gives up after this (ms)
+    #define WRITE_SOME_TIMEOUT_MS 1
 #endif
 
 // Include for Linux
@@ -50,6 +52,12 @@ This is a licence-free software, it can be used by anyone who try to build a bet
     #include <fcntl.h>
     #include <unistd.h>
     #include <sys/ioctl.h>
+    #include <errno.h>
+    #include <poll.h>
+#endif
+#if defined (__linux__)
+    // ASYNC_LOW_LATENCY
+    #include <linux/serial.h>
 #endif
 
 /*! To avoid unused parameters */
@@ -116,6 +124,12 @@ public:
                     SerialParity Parity = SERIAL_PARITY_NONE,
                     SerialStopBits Stopbits = SERIAL_STOPBITS_1);
 
+    // Change the speed of an open device
+    char setBaudRate(const unsigned int Bauds);
+
+    // Ask the driver to pass received bytes on right away
+    char setLowLatency(bool enabled);
+
     // Check device opening state
     bool isDeviceOpen();
 
@@ -160,6 +174,9 @@ public:
     // Write an array of bytes
     int     writeBytes  (const void *Buffer, const unsigned int NbBytes);
 
+    // Write as many bytes as the port takes without waiting (at most WRITE_SOME_TIMEOUT_MS on Windows)
+    int     writeSome   (const void *Buffer, const unsigned int NbBytes);
+
     // Read an array of byte (with timeout)
     int     readBytes   (void *buffer,unsigned int maxNbBytes,const unsigned int timeOut_ms=0, unsigned int sleepDuration_us=100);
 
@@ -176,6 +193,12 @@ public:
     // Return the number of bytes in the received buffer
     int     available();
 
+    // Return the number of bytes written but not sent yet
+    int     pending();
+
+    // Wait until bytes can be read
+    int     waitReadable(unsigned int timeOut_us);
+
 
 
 
@@ -229,6 +252,8 @@ private:
     HANDLE          hSerial;
     // For setting serial port timeouts
     COMMTIMEOUTS    timeouts;
+    // Switch the write timeout, only calls the driver when it changes
+    int             setWriteTimeout(DWORD timeOut_ms);
 #endif
 #if defined (__linux__) || defined(__APPLE__)
     int             fd;
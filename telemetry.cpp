@@ -6,82 +6,83 @@
 #include <format>
 #include <cmath>
 #include <numbers>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <thread>
+#include <algorithm>
+#include <cstring>
 #include "main.hpp"
 #include "telemetry.hpp"
 #include "calibration.hpp"
 #include "ui.hpp"
 #include "serial.hpp"
 #include "util.hpp"
-
-// Data structures expected by ArduPilot
-namespace AP {
-    typedef struct {
-        uint8_t instance;
-        float pressure_pa;
-        float temperature;
-    } baro_data_message_t;
-    typedef struct {
-        Eigen::Vector3f field;
-    } mag_data_message_t;
-    typedef struct {
-        uint16_t gps_week;
-        uint32_t ms_tow;
-        uint8_t fix_type;
-        uint8_t satellites_in_view;
-        float horizontal_pos_accuracy;
-        float vertical_pos_accuracy;
-        float horizontal_vel_accuracy;
-        float hdop;
-        float vdop;
-        int32_t longitude;
-        int32_t latitude;
-        int32_t msl_altitude;
-        float ned_vel_north;
-        float ned_vel_east;
-        float ned_vel_down;
-    } gps_data_message_t;
-    typedef struct {
-        Eigen::Vector3f accel;
-        Eigen::Vector3f gyro;
-        float temperature;
-    } ins_data_message_t;
-    typedef struct {
-        float differential_pressure; // Pa
-        float temperature; // degC
-    } airspeed_data_message_t;
-}
+#include "protocol.hpp"
+#include "compact.hpp"
+#include "messages.hpp"
+#include "datarefs.hpp"
+#include "timesync.hpp"
+#include "baud.hpp"
+#include "config.hpp"
 
 namespace Telemetry {
     namespace DataRef {
-        XPLMDataRef accel_x = XPLMFindDataRef("sim/flightmodel/forces/g_axil");
-        XPLMDataRef accel_y = XPLMFindDataRef("sim/flightmodel/forces/g_side");
-        XPLMDataRef accel_z = XPLMFindDataRef("sim/flightmodel/forces/g_nrml");
-        XPLMDataRef gyro_x = XPLMFindDataRef("sim/flightmodel/position/P");
-        XPLMDataRef gyro_y = XPLMFindDataRef("sim/flightmodel/position/Q");
-        XPLMDataRef gyro_z = XPLMFindDataRef("sim/flightmodel/position/R");
-        XPLMDataRef quat = XPLMFindDataRef("sim/flightmodel/position/q");
-        XPLMDataRef baro = XPLMFindDataRef("sim/weather/barometer_current_inhg");
-        XPLMDataRef temperature = XPLMFindDataRef("sim/weather/temperature_ambient_c");
-        XPLMDataRef days = XPLMFindDataRef("sim/time/local_date_days");
-        XPLMDataRef seconds = XPLMFindDataRef("sim/time/local_time_sec");
-        XPLMDataRef latitude = XPLMFindDataRef("sim/flightmodel/position/latitude");
-        XPLMDataRef longitude = XPLMFindDataRef("sim/flightmodel/position/longitude");
-        XPLMDataRef elevation = XPLMFindDataRef("sim/flightmodel/position/elevation");
-        XPLMDataRef local_vx = XPLMFindDataRef("sim/flightmodel/position/local_vx");
-        XPLMDataRef local_vy = XPLMFindDataRef("sim/flightmodel/position/local_vy");
-        XPLMDataRef local_vz = XPLMFindDataRef("sim/flightmodel/position/local_vz");
-        XPLMDataRef speed = XPLMFindDataRef("sim/flightmodel/position/groundspeed");
-        XPLMDataRef airspeed = XPLMFindDataRef("sim/flightmodel/position/true_airspeed");
-        XPLMDataRef density = XPLMFindDataRef("sim/weather/rho");
-        XPLMDataRef engine_running = XPLMFindDataRef("sim/flightmodel/engine/ENGN_running");
-        XPLMDataRef engine_rads = XPLMFindDataRef("sim/flightmodel/engine/ENGN_tacrad");
-        XPLMDataRef engine_power = XPLMFindDataRef("sim/flightmodel/engine/ENGN_power");
-        XPLMDataRef engine_max_power = XPLMFindDataRef("sim/aircraft/engine/acf_pmax_per_engine");
-        XPLMDataRef throttle = XPLMFindDataRef("sim/flightmodel/engine/ENGN_thro_use");
-        XPLMDataRef fuel_total = XPLMFindDataRef("sim/aircraft/weight/acf_m_fuel_tot");
-        XPLMDataRef fuel_remaining = XPLMFindDataRef("sim/flightmodel/weight/m_fuel_total");
-        XPLMDataRef fuel_flow_s = XPLMFindDataRef("sim/cockpit2/engine/indicators/fuel_flow_kg_sec");
+        dataref_t accel_x{ "sim/flightmodel/forces/g_axil", xplmType_Float };
+        dataref_t accel_y{ "sim/flightmodel/forces/g_side", xplmType_Float };
+        dataref_t accel_z{ "sim/flightmodel/forces/g_nrml", xplmType_Float };
+        dataref_t gyro_x{ "sim/flightmodel/position/P", xplmType_Float };
+        dataref_t gyro_y{ "sim/flightmodel/position/Q", xplmType_Float };
+        dataref_t gyro_z{ "sim/flightmodel/position/R", xplmType_Float };
+        dataref_t quat{ "sim/flightmodel/position/q", xplmType_FloatArray };
+        dataref_t baro{ "sim/weather/barometer_current_inhg", xplmType_Float };
+        dataref_t temperature{ "sim/weather/temperature_ambient_c", xplmType_Float };
+        dataref_t days{ "sim/time/local_date_days", xplmType_Int };
+        dataref_t seconds{ "sim/time/local_time_sec", xplmType_Float };
+        dataref_t zulu_seconds{ "sim/time/zulu_time_sec", xplmType_Float };
+        dataref_t latitude{ "sim/flightmodel/position/latitude", xplmType_Double };
+        dataref_t longitude{ "sim/flightmodel/position/longitude", xplmType_Double };
+        dataref_t elevation{ "sim/flightmodel/position/elevation", xplmType_Double };
+        dataref_t local_vx{ "sim/flightmodel/position/local_vx", xplmType_Float };
+        dataref_t local_vy{ "sim/flightmodel/position/local_vy", xplmType_Float };
+        dataref_t local_vz{ "sim/flightmodel/position/local_vz", xplmType_Float };
+        dataref_t airspeed{ "sim/flightmodel/position/true_airspeed", xplmType_Float };
+        dataref_t density{ "sim/weather/rho", xplmType_Float };
+        dataref_t engine_running{ "sim/flightmodel/engine/ENGN_running", xplmType_IntArray };
+        dataref_t engine_rads{ "sim/flightmodel/engine/ENGN_tacrad", xplmType_FloatArray };
+        dataref_t engine_power{ "sim/flightmodel/engine/ENGN_power", xplmType_FloatArray };
+        dataref_t engine_max_power{ "sim/aircraft/engine/acf_pmax_per_engine", xplmType_Float };
+        dataref_t throttle{ "sim/flightmodel/engine/ENGN_thro_use", xplmType_FloatArray };
+        dataref_t fuel_total{ "sim/aircraft/weight/acf_m_fuel_tot", xplmType_Float };
+        dataref_t fuel_remaining{ "sim/flightmodel/weight/m_fuel_total", xplmType_Float };
+        dataref_t fuel_flow_s{ "sim/cockpit2/engine/indicators/fuel_flow_kg_sec", xplmType_FloatArray };
     }
+    // Every dataref telemetry reads, copied in a single pass per frame
+    struct snapshot_t {
+        float accel[3];
+        float gyro[3];
+        float quat[4];
+        float local_vel[3];
+        float baro;
+        float temperature;
+        float seconds;
+        float zulu_seconds;
+        float airspeed;
+        float density;
+        int day;
+        double latitude;
+        double longitude;
+        double elevation;
+        int engine_running[ENGINE_COUNT];
+        float engine_rads[ENGINE_COUNT];
+        float engine_power[ENGINE_COUNT];
+        float throttle[ENGINE_COUNT];
+        float fuel_flow[ENGINE_COUNT];
+        float engine_max_power;
+        float fuel_total;
+        float fuel_remaining;
+    } snapshot;
     struct {
         Eigen::Vector3f accel;
         Eigen::Vector3f gyro;
@@ -90,6 +91,7 @@ namespace Telemetry {
         float temperature;
         int day;
         float seconds;
+        float zulu_seconds;
         double latitude;
         double longitude;
         double elevation;
@@ -97,142 +99,636 @@ namespace Telemetry {
         uint8_t gps_fix;
         float dynamic_pressure;
     } state;
+    // Sensor groups sent on their own in multirate mode
+    struct group_t {
+        MSG_TYPE type;
+        float rate; // Hz
+        float timer;
+    };
+    std::array<group_t, 7> groups = { {
+        { IMU, IMU_RATE, 0 },
+        { ATTITUDE_COMPACT, ATTITUDE_RATE, 0 },
+        { BARO, BARO_RATE, 0 },
+        { MAG, MAG_RATE, 0 },
+        { GPS, GPS_RATE, 0 },
+        { AIRSPEED, AIRSPEED_RATE, 0 },
+        { EFI, EFI_RATE, 0 }
+    } };
+    bool multirate = false;
+    // IMU samples produced at a fixed rate on their own thread,
+    // in between the sim frames the values are interpolated
+    namespace Emitter {
+        struct snapshot_t {
+            std::chrono::steady_clock::time_point time;
+            Eigen::Vector3f accel;
+            Eigen::Vector3f gyro;
+            Eigen::Quaternionf rot;
+        };
+        std::mutex lock;
+        // previous and last sim frames
+        std::array<snapshot_t, 2> snapshots;
+        int count = 0;
+        std::atomic<float> rate = IMU_RATE;
+        std::jthread thread;
+        void Push();
+        void Start();
+        void Stop();
+        void Run(std::stop_token stop);
+        bool Sample(std::chrono::steady_clock::time_point time, imu_msg_t &msg);
+    }
+    // state of the delta and on-change compact messages
+    namespace Compact {
+        int gps_count = 0;
+        gps_compact_t gps_last;
+        efi_compact_t efi_last;
+        float efi_timer = 0;
+        bool IsEnabled() { return Protocol::Features() & FEATURE_COMPACT; }
+        void SendImu(const imu_msg_t &imu);
+        void SendAttitude();
+        void SendBaro();
+        void SendMag();
+        void SendGps();
+        void SendAirspeed();
+        void SendEfi(float dt);
+    }
+    // v2 sequence numbers, one per message type
+    std::atomic<uint16_t> seq[MSG_COUNT];
+    // frames handed to the serial queues, v1 included
+    std::atomic<uint64_t> sent[MSG_COUNT];
+    float ping_timer = 0;
+    // bytes queued during the current link usage window
+    std::atomic<size_t> link_bytes = 0;
+    float link_time = 0;
+    float link_usage = 0;
     int reset = false;
     float reset_timer = 0;
     void UpdateState();
     void ProcessState();
+    void ProcessGroups(float dt);
+    void SendPing(float dt);
+    void SendBaud(float dt);
+    void UpdateLinkUsage(float dt);
+    void SendMsg(MSG_TYPE type, const void *msg, size_t bytes, Serial::Queue queue = Serial::Queue::Main);
+    bool IsSnapshot(MSG_TYPE type);
+    void FillIns(AP::ins_data_message_t &ins);
+    void FillBaro(AP::baro_data_message_t &baro);
+    void FillMag(AP::mag_data_message_t &mag);
+    void FillGps(AP::gps_data_message_t &gps);
+    void FillAirspeed(AP::airspeed_data_message_t &aspd);
+    void FillEfi(EFI_State &efi);
 }
 
-void Telemetry::Send() {
+void Telemetry::Send(float dt) {
     UpdateState();
-    ProcessState();
+    if (multirate) {
+        Emitter::Push();
+        Emitter::Start();
+        ProcessGroups(dt);
+    } else {
+        Emitter::Stop();
+        ProcessState();
+    }
+    SendPing(dt);
+    SendBaud(dt);
+    UpdateLinkUsage(dt);
+}
+
+void Telemetry::SendLink(float dt) {
+    SendPing(dt);
+    SendBaud(dt);
+}
+
+void Telemetry::Replay(MSG_TYPE type, const void *msg, size_t bytes) {
+    SendMsg(type, msg, bytes);
+}
+
+// New link, firmware that took v2 on this port last time gets the offer right away.
+// The new peer has no GPS fix to add deltas to and no EFI frame yet, so both start over
+void Telemetry::Reset() {
+    ping_timer = Config::Get().version >= PROTOCOL_VERSION ? PING_PERIOD : 0;
+    Compact::gps_count = 0;
+    Compact::gps_last = {};
+    Compact::efi_last = {};
+    Compact::efi_timer = EFI_KEEPALIVE;
+}
+
+// Must be called before the serial link is torn down
+void Telemetry::Stop() {
+    Emitter::Stop();
+}
+
+void Telemetry::SetMultirate(bool state) {
+    multirate = state;
+    for (group_t &group : groups) {
+        group.timer = 0;
+    }
+}
+
+void Telemetry::SetRate(MSG_TYPE type, float hz) {
+    for (group_t &group : groups) {
+        if (group.type == type) {
+            group.rate = hz;
+        }
+    }
+    if (type == IMU) {
+        Emitter::rate = hz;
+    }
+}
+
+uint64_t Telemetry::FramesSent(MSG_TYPE type) {
+    return sent[type].load(std::memory_order_relaxed);
+}
+
+float Telemetry::GetRate(MSG_TYPE type) {
+    for (group_t &group : groups) {
+        if (group.type == type) {
+            return group.rate;
+        }
+    }
+    return 0;
+}
+
+float Telemetry::LinkUsage() {
+    return link_usage;
+}
+
+// Read all telemetry inputs from xplane, array datarefs are fetched whole
+void Telemetry::ReadSnapshot() {
+    snapshot.accel[0] = XPLMGetDataf(DataRef::accel_x);
+    snapshot.accel[1] = XPLMGetDataf(DataRef::accel_y);
+    snapshot.accel[2] = XPLMGetDataf(DataRef::accel_z);
+    snapshot.gyro[0] = XPLMGetDataf(DataRef::gyro_x);
+    snapshot.gyro[1] = XPLMGetDataf(DataRef::gyro_y);
+    snapshot.gyro[2] = XPLMGetDataf(DataRef::gyro_z);
+    XPLMGetDatavf(DataRef::quat, snapshot.quat, 0, 4);
+    snapshot.local_vel[0] = XPLMGetDataf(DataRef::local_vx);
+    snapshot.local_vel[1] = XPLMGetDataf(DataRef::local_vy);
+    snapshot.local_vel[2] = XPLMGetDataf(DataRef::local_vz);
+    snapshot.baro = XPLMGetDataf(DataRef::baro);
+    snapshot.temperature = XPLMGetDataf(DataRef::temperature);
+    snapshot.seconds = XPLMGetDataf(DataRef::seconds);
+    snapshot.zulu_seconds = XPLMGetDataf(DataRef::zulu_seconds);
+    snapshot.airspeed = XPLMGetDataf(DataRef::airspeed);
+    snapshot.density = XPLMGetDataf(DataRef::density);
+    snapshot.day = XPLMGetDatai(DataRef::days);
+    snapshot.latitude = XPLMGetDatad(DataRef::latitude);
+    snapshot.longitude = XPLMGetDatad(DataRef::longitude);
+    snapshot.elevation = XPLMGetDatad(DataRef::elevation);
+    XPLMGetDatavi(DataRef::engine_running, snapshot.engine_running, 0, ENGINE_COUNT);
+    XPLMGetDatavf(DataRef::engine_rads, snapshot.engine_rads, 0, ENGINE_COUNT);
+    XPLMGetDatavf(DataRef::engine_power, snapshot.engine_power, 0, ENGINE_COUNT);
+    XPLMGetDatavf(DataRef::throttle, snapshot.throttle, 0, ENGINE_COUNT);
+    XPLMGetDatavf(DataRef::fuel_flow_s, snapshot.fuel_flow, 0, ENGINE_COUNT);
+    snapshot.engine_max_power = XPLMGetDataf(DataRef::engine_max_power);
+    snapshot.fuel_total = XPLMGetDataf(DataRef::fuel_total);
+    snapshot.fuel_remaining = XPLMGetDataf(DataRef::fuel_remaining);
 }
 
-// get raw data from xplane
 void Telemetry::UpdateState() {
-    state.accel = {
-        XPLMGetDataf(DataRef::accel_x),
-        XPLMGetDataf(DataRef::accel_y),
-        XPLMGetDataf(DataRef::accel_z)
-    };
-    state.gyro = {
-        XPLMGetDataf(DataRef::gyro_x),
-        XPLMGetDataf(DataRef::gyro_y),
-        XPLMGetDataf(DataRef::gyro_z)
-    };
-    XPLMGetDatavf(DataRef::quat, &state.rot.w(), 0, 1);
-    XPLMGetDatavf(DataRef::quat, state.rot.vec().data(), 1, 3);
-    state.pressure = XPLMGetDataf(DataRef::baro);
-    state.temperature = XPLMGetDataf(DataRef::temperature);
-    state.day = XPLMGetDatai(DataRef::days);
-    state.seconds = XPLMGetDataf(DataRef::seconds);
-    state.latitude = XPLMGetDatad(DataRef::latitude);
-    state.longitude = XPLMGetDatad(DataRef::longitude);
-    state.elevation = XPLMGetDatad(DataRef::elevation);
-    state.gps_vel = {
-        XPLMGetDataf(DataRef::local_vx),
-        XPLMGetDataf(DataRef::local_vy),
-        XPLMGetDataf(DataRef::local_vz)
-    };
+    ReadSnapshot();
+    state.accel = Eigen::Vector3f(snapshot.accel);
+    state.gyro = Eigen::Vector3f(snapshot.gyro);
+    state.rot = Eigen::Quaternionf(snapshot.quat[0], snapshot.quat[1], snapshot.quat[2], snapshot.quat[3]);
+    state.pressure = snapshot.baro;
+    state.temperature = snapshot.temperature;
+    state.day = snapshot.day;
+    state.seconds = snapshot.seconds;
+    state.zulu_seconds = snapshot.zulu_seconds;
+    state.latitude = snapshot.latitude;
+    state.longitude = snapshot.longitude;
+    state.elevation = snapshot.elevation;
+    state.gps_vel = Eigen::Vector3f(snapshot.local_vel);
     state.gps_fix = 3;
-    state.dynamic_pressure = XPLMGetDataf(DataRef::density) * pow(XPLMGetDataf(DataRef::airspeed), 2) / 2;
+    state.dynamic_pressure = snapshot.density * pow(snapshot.airspeed, 2) / 2;
 }
 
-// convert raw xplane data to ardupilot and send
+// convert raw xplane data to ardupilot and send it as a single message
 void Telemetry::ProcessState() {
+    sensors_msg_t msg;
+    msg.q1 = state.rot.w();
+    msg.q2 = state.rot.x();
+    msg.q3 = state.rot.y();
+    msg.q4 = state.rot.z();
+    FillIns(msg.ins);
+    FillBaro(msg.baro);
+    FillMag(msg.mag);
+    FillGps(msg.gps);
+    FillAirspeed(msg.aspd);
+    FillEfi(msg.efi);
+    SendMsg(SENSORS, &msg, sizeof(msg));
+}
+
+// send each sensor group that is due as its own message
+void Telemetry::ProcessGroups(float dt) {
+    for (group_t &group : groups) {
+        // IMU samples come from the emitter thread
+        if (group.type == IMU) { continue; }
+        if (group.rate <= 0) { continue; }
+        group.timer += dt;
+        float period = 1.0f / group.rate;
+        if (group.timer < period) { continue; }
+        // samples missed between frames are not made up for
+        group.timer = std::fmod(group.timer, period);
+        if (Compact::IsEnabled()) {
+            switch (group.type) {
+            case ATTITUDE_COMPACT:
+                Compact::SendAttitude();
+                break;
+            case BARO:
+                Compact::SendBaro();
+                break;
+            case MAG:
+                Compact::SendMag();
+                break;
+            case GPS:
+                Compact::SendGps();
+                break;
+            case AIRSPEED:
+                Compact::SendAirspeed();
+                break;
+            case EFI:
+                Compact::SendEfi(period);
+                break;
+            default:
+                break;
+            }
+            continue;
+        }
+        switch (group.type) {
+        case BARO: {
+            AP::baro_data_message_t msg;
+            FillBaro(msg);
+            SendMsg(BARO, &msg, sizeof(msg));
+            break;
+        }
+        case MAG: {
+            AP::mag_data_message_t msg;
+            FillMag(msg);
+            SendMsg(MAG, &msg, sizeof(msg));
+            break;
+        }
+        case GPS: {
+            AP::gps_data_message_t msg;
+            FillGps(msg);
+            SendMsg(GPS, &msg, sizeof(msg));
+            break;
+        }
+        case AIRSPEED: {
+            AP::airspeed_data_message_t msg;
+            FillAirspeed(msg);
+            SendMsg(AIRSPEED, &msg, sizeof(msg));
+            break;
+        }
+        case EFI: {
+            EFI_State msg;
+            FillEfi(msg);
+            SendMsg(EFI, &msg, sizeof(msg));
+            break;
+        }
+        default:
+            // attitude goes with the IMU samples
+            break;
+        }
+    }
+}
+
+void Telemetry::Compact::SendImu(const imu_msg_t &imu) {
+    imu_compact_t msg;
+    msg.time_us = static_cast<uint16_t>(imu.time_us);
+    for (int i = 0; i < 3; i++) {
+        msg.accel[i] = ToFixed<int16_t>(imu.ins.accel[i], ACCEL_SCALE);
+        msg.gyro[i] = ToFixed<int16_t>(imu.ins.gyro[i], GYRO_SCALE);
+    }
+    SendMsg(IMU_COMPACT, &msg, sizeof(msg), Serial::Queue::Imu);
+}
+
+void Telemetry::Compact::SendAttitude() {
+    attitude_compact_t msg;
+    msg.quat[0] = ToFixed<int16_t>(state.rot.w(), QUAT_SCALE);
+    msg.quat[1] = ToFixed<int16_t>(state.rot.x(), QUAT_SCALE);
+    msg.quat[2] = ToFixed<int16_t>(state.rot.y(), QUAT_SCALE);
+    msg.quat[3] = ToFixed<int16_t>(state.rot.z(), QUAT_SCALE);
+    SendMsg(ATTITUDE_COMPACT, &msg, sizeof(msg));
+}
+
+void Telemetry::Compact::SendBaro() {
+    AP::baro_data_message_t baro;
+    FillBaro(baro);
+    baro_compact_t msg;
+    msg.instance = baro.instance;
+    msg.pressure = ToFixed24(baro.pressure_pa, PRESSURE_SCALE);
+    msg.temperature = ToFixed<int16_t>(baro.temperature, TEMPERATURE_SCALE);
+    SendMsg(BARO_COMPACT, &msg, sizeof(msg));
+}
+
+void Telemetry::Compact::SendMag() {
+    AP::mag_data_message_t mag;
+    FillMag(mag);
+    mag_compact_t msg;
+    for (int i = 0; i < 3; i++) {
+        msg.field[i] = ToFixed<int16_t>(mag.field[i], MAG_SCALE);
+    }
+    SendMsg(MAG_COMPACT, &msg, sizeof(msg));
+}
+
+// full fix every GPS_KEYFRAME_PERIOD messages or when the position jumped too far,
+// otherwise only the change since the previous message
+void Telemetry::Compact::SendGps() {
+    AP::gps_data_message_t gps;
+    FillGps(gps);
+    gps_compact_t msg;
+    msg.gps_week = gps.gps_week;
+    msg.ms_tow = gps.ms_tow;
+    msg.fix_type = gps.fix_type;
+    msg.satellites_in_view = gps.satellites_in_view;
+    msg.horizontal_pos_accuracy = ToFixed<uint16_t>(gps.horizontal_pos_accuracy, ACCURACY_SCALE);
+    msg.vertical_pos_accuracy = ToFixed<uint16_t>(gps.vertical_pos_accuracy, ACCURACY_SCALE);
+    msg.horizontal_vel_accuracy = ToFixed<uint16_t>(gps.horizontal_vel_accuracy, ACCURACY_SCALE);
+    msg.hdop = ToFixed<uint16_t>(gps.hdop, ACCURACY_SCALE);
+    msg.vdop = ToFixed<uint16_t>(gps.vdop, ACCURACY_SCALE);
+    msg.longitude = gps.longitude;
+    msg.latitude = gps.latitude;
+    msg.msl_altitude = gps.msl_altitude;
+    msg.ned_vel[0] = ToFixed<int16_t>(gps.ned_vel_north, VELOCITY_SCALE);
+    msg.ned_vel[1] = ToFixed<int16_t>(gps.ned_vel_east, VELOCITY_SCALE);
+    msg.ned_vel[2] = ToFixed<int16_t>(gps.ned_vel_down, VELOCITY_SCALE);
+    int64_t dlon = static_cast<int64_t>(msg.longitude) - gps_last.longitude;
+    int64_t dlat = static_cast<int64_t>(msg.latitude) - gps_last.latitude;
+    int64_t dalt = static_cast<int64_t>(msg.msl_altitude) - gps_last.msl_altitude;
+    auto fits = [](int64_t value) { return value >= INT16_MIN && value <= INT16_MAX; };
+    bool keyframe = gps_count % GPS_KEYFRAME_PERIOD == 0 || !fits(dlon) || !fits(dlat) || !fits(dalt);
+    gps_count = keyframe ? 1 : gps_count + 1;
+    gps_last = msg;
+    if (keyframe) {
+        SendMsg(GPS_COMPACT, &msg, sizeof(msg));
+        return;
+    }
+    gps_delta_t delta;
+    delta.ms_tow = msg.ms_tow;
+    delta.longitude = static_cast<int16_t>(dlon);
+    delta.latitude = static_cast<int16_t>(dlat);
+    delta.msl_altitude = static_cast<int16_t>(dalt);
+    std::copy_n(msg.ned_vel, 3, delta.ned_vel);
+    SendMsg(GPS_DELTA, &delta, sizeof(delta));
+}
+
+void Telemetry::Compact::SendAirspeed() {
+    AP::airspeed_data_message_t aspd;
+    FillAirspeed(aspd);
+    airspeed_compact_t msg;
+    msg.differential_pressure = ToFixed<int16_t>(aspd.differential_pressure, DIFF_PRESSURE_SCALE);
+    msg.temperature = ToFixed<int16_t>(aspd.temperature, TEMPERATURE_SCALE);
+    SendMsg(AIRSPEED_COMPACT, &msg, sizeof(msg));
+}
+
+// only sent when something changed, or every EFI_KEEPALIVE seconds
+void Telemetry::Compact::SendEfi(float dt) {
+    EFI_State efi;
+    FillEfi(efi);
+    efi_compact_t msg;
+    msg.engine_state = static_cast<uint8_t>(efi.engine_state);
+    msg.engine_load_percent = efi.engine_load_percent;
+    msg.engine_speed_rpm = static_cast<uint16_t>(std::min<uint32_t>(efi.engine_speed_rpm, UINT16_MAX));
+    msg.throttle_position_percent = efi.throttle_position_percent;
+    msg.throttle_out = ToFixed<uint16_t>(efi.throttle_out, THROTTLE_SCALE);
+    msg.estimated_consumed_fuel_volume_cm3 = efi.estimated_consumed_fuel_volume_cm3;
+    msg.fuel_consumption_rate_cm3pm = efi.fuel_consumption_rate_cm3pm;
+    efi_timer += dt;
+    if (efi_timer < EFI_KEEPALIVE && memcmp(&msg, &efi_last, sizeof(msg)) == 0) { return; }
+    efi_timer = 0;
+    efi_last = msg;
+    SendMsg(EFI_COMPACT, &msg, sizeof(msg));
+}
+
+void Telemetry::SendMsg(MSG_TYPE type, const void *msg, size_t bytes, Serial::Queue queue) {
+    sent[type].fetch_add(1, std::memory_order_relaxed);
+    serial_message_t message = { type, msg, bytes };
+    if (Protocol::Version() >= 2) {
+        uint8_t frame[PROTOCOL_MAX_FRAME];
+        uint32_t stamp = static_cast<uint32_t>(Timesync::Now());
+        size_t size = Protocol::Encode(type, seq[type]++, msg, bytes, frame, Timesync::IsEnabled() ? &stamp : nullptr);
+        Serial::Send({ { frame, size } }, queue, IsSnapshot(type) ? type : SERIAL_KEY_NONE, &message);
+        link_bytes += size;
+        return;
+    }
     struct {
         char header[4] = { 'H', 'I', 'T', 'L' };
-        int type = 0;
+        int type;
     } header;
     struct {
-        AP::baro_data_message_t baro;
-        AP::mag_data_message_t mag;
-        AP::gps_data_message_t gps;
-        AP::ins_data_message_t ins;
-        AP::airspeed_data_message_t aspd;
-        float q1 = state.rot.w();
-        float q2 = state.rot.x();
-        float q3 = state.rot.y();
-        float q4 = state.rot.z();
-        EFI_State efi;
-    } msg;
-    struct {
-        int len = static_cast<int>(sizeof(header) + sizeof(msg));
+        int len;
         char postamble[3] = { 'E','N','D' };
     } footer;
-    // Inertial sensor
+    header.type = type;
+    footer.len = static_cast<int>(sizeof(header) + bytes);
+    Serial::Send({
+        { &header, sizeof(header) },
+        { msg, bytes },
+        { &footer, sizeof(footer) }
+    }, queue, IsSnapshot(type) ? type : SERIAL_KEY_NONE, &message);
+    link_bytes += sizeof(header) + bytes + sizeof(footer);
+}
+
+// Only the newest one matters when the link is backed up. GPS deltas build on
+// each other and the clock exchange needs every PING it can get
+bool Telemetry::IsSnapshot(MSG_TYPE type) {
+    return type != RESTART && type != PING && type != GPS_COMPACT && type != GPS_DELTA && type != BAUD;
+}
+
+// offer the newest protocol version until the autopilot takes it,
+// older firmware ignores the message. Afterwards it carries the clock exchange
+void Telemetry::SendPing(float dt) {
+    bool sync = Timesync::IsEnabled();
+    if (Protocol::Version() >= PROTOCOL_VERSION && !sync) { return; }
+    ping_timer += dt;
+    if (ping_timer < (sync ? TIMESYNC_PERIOD : PING_PERIOD)) { return; }
+    ping_timer = 0;
+    if (sync) {
+        ping_sync_t msg = Timesync::Ping();
+        SendMsg(PING, &msg, sizeof(msg));
+        return;
+    }
+    struct {
+        uint8_t version = PROTOCOL_VERSION;
+        uint8_t features = PROTOCOL_FEATURES;
+    } msg;
+    SendMsg(PING, &msg, sizeof(msg));
+}
+
+// the test burst goes out all at once
+void Telemetry::SendBaud(float dt) {
+    baud_test_t msg;
+    while (size_t bytes = Baud::Poll(dt, msg)) {
+        SendMsg(BAUD, &msg, bytes);
+        dt = 0;
+    }
+}
+
+// share of the link capacity used by telemetry, refreshed every second
+void Telemetry::UpdateLinkUsage(float dt) {
+    link_time += dt;
+    if (link_time < 1.0f) { return; }
+    // 8N1 framing puts 10 bits on the wire per byte
+    size_t bytes = link_bytes.exchange(0);
+    link_usage = bytes * 10 / (Serial::GetBaudRate() * link_time);
+    // network links have no fixed capacity, show the throughput instead
+    char text[LABEL_SIZE];
+    if (Serial::HasBaudRate()) {
+        UI::Window::LabelLink::SetText(UI::Format(text, "Link: {:.0f}% of {}", link_usage * 100, Serial::GetBaudRate()));
+    } else {
+        UI::Window::LabelLink::SetText(UI::Format(text, "Link: {:.1f} kB/s", bytes / link_time / 1000));
+    }
+    Timesync::UpdateUI();
+    link_time = 0;
+}
+
+// Hand the current sim frame to the emitter thread
+void Telemetry::Emitter::Push() {
+    AP::ins_data_message_t ins;
+    FillIns(ins);
+    std::lock_guard guard(lock);
+    snapshots[0] = snapshots[1];
+    snapshots[1] = { std::chrono::steady_clock::now(), ins.accel, ins.gyro, state.rot };
+    count = std::min(count + 1, 2);
+}
+
+void Telemetry::Emitter::Start() {
+    if (thread.joinable()) { return; }
+    count = 0;
+    thread = std::jthread(Run);
+}
+
+void Telemetry::Emitter::Stop() {
+    if (!thread.joinable()) { return; }
+    thread.request_stop();
+    thread.join();
+}
+
+void Telemetry::Emitter::Run(std::stop_token stop) {
+    using namespace std::chrono;
+    steady_clock::time_point next = steady_clock::now();
+    while (!stop.stop_requested()) {
+        steady_clock::duration period = duration_cast<steady_clock::duration>(duration<float>(1.0f / std::max(rate.load(), 1.0f)));
+        next += period;
+        std::this_thread::sleep_until(next);
+        steady_clock::time_point now = steady_clock::now();
+        // keep a steady rate after being descheduled instead of bursting to catch up
+        if (now - next > period) {
+            next = now;
+        }
+        imu_msg_t msg;
+        if (!Sample(now, msg)) { continue; }
+        if (Compact::IsEnabled()) {
+            Compact::SendImu(msg);
+        } else {
+            SendMsg(IMU, &msg, sizeof(msg), Serial::Queue::Imu);
+        }
+    }
+}
+
+// Estimate the IMU at any time from the last two sim frames
+bool Telemetry::Emitter::Sample(std::chrono::steady_clock::time_point time, imu_msg_t &msg) {
+    snapshot_t a;
+    snapshot_t b;
+    {
+        std::lock_guard guard(lock);
+        if (count < 2) { return false; }
+        a = snapshots[0];
+        b = snapshots[1];
+    }
+    // samples are taken after the last frame, so this mostly extrapolates,
+    // up to IMU_MAX_EXTRAPOLATION frames ahead, then the last frame is held
+    float frame = std::chrono::duration<float>(b.time - a.time).count();
+    float t = frame > 0 ? std::chrono::duration<float>(time - a.time).count() / frame : 1.0f;
+    t = std::clamp(t, 0.0f, 1.0f + IMU_MAX_EXTRAPOLATION);
+    msg.time_us = Timesync::Micros(time);
+    msg.ins.accel = a.accel + (b.accel - a.accel) * t;
+    msg.ins.gyro = a.gyro + (b.gyro - a.gyro) * t;
+    msg.ins.temperature = 25;
+    Eigen::Quaternionf rot = a.rot.slerp(t, b.rot).normalized();
+    msg.q1 = rot.w();
+    msg.q2 = rot.x();
+    msg.q3 = rot.y();
+    msg.q4 = rot.z();
+    return true;
+}
+
+void Telemetry::FillIns(AP::ins_data_message_t &ins) {
     if (!Calibration::IsEnabled()) {
-        msg.ins.accel = -state.accel * GRAVITY_MSS;
+        ins.accel = -state.accel * GRAVITY_MSS;
     } else {
         // plane has no acceleration when frozen mid air during calibration,
         // so here it is faked
         Eigen::Vector3f down = { 0, 0, -GRAVITY_MSS };
-        msg.ins.accel = state.rot.conjugate() * down;
+        ins.accel = state.rot.conjugate() * down;
     }
-    msg.ins.gyro = state.gyro * deg_to_rad;
-    msg.ins.temperature = 25;
-    // Barometer
-    msg.baro.instance = 0;
-    msg.baro.pressure_pa = state.pressure * inhg_to_pa;
-    msg.baro.temperature = state.temperature;
-    // Compass
+    ins.gyro = state.gyro * deg_to_rad;
+    ins.temperature = 25;
+}
+
+void Telemetry::FillBaro(AP::baro_data_message_t &baro) {
+    baro.instance = 0;
+    baro.pressure_pa = state.pressure * inhg_to_pa;
+    baro.temperature = state.temperature;
+}
+
+void Telemetry::FillMag(AP::mag_data_message_t &mag) {
     Eigen::Vector3f north = { 1, 0, 0 };
-    msg.mag.field = state.rot.conjugate() * north;
-    // GPS
-    msg.gps.gps_week = 0xFFFF;
-    msg.gps.ms_tow = 0;
-    msg.gps.fix_type = state.gps_fix;
-    msg.gps.satellites_in_view = 10;
-    msg.gps.horizontal_pos_accuracy = 1;
-    msg.gps.vertical_pos_accuracy = 1;
-    msg.gps.horizontal_vel_accuracy = 1;
-    msg.gps.hdop = 1;
-    msg.gps.vdop = 1;
-    msg.gps.latitude = state.latitude * decimaldeg_to_deg;
-    msg.gps.longitude = state.longitude * decimaldeg_to_deg;
-    msg.gps.msl_altitude = state.elevation * m_to_cm;
-    msg.gps.ned_vel_north = -state.gps_vel.z();
-    msg.gps.ned_vel_east = state.gps_vel.x();
-    msg.gps.ned_vel_down = -state.gps_vel.y();
-    // Airspeed
-    msg.aspd.differential_pressure = state.dynamic_pressure;
-    msg.aspd.temperature = state.temperature;
-    // EFI
-    int engine_running;
-    XPLMGetDatavi(DataRef::engine_running, &engine_running, 0, 1);
-    msg.efi.engine_state = engine_running == 2 ? Engine_State::RUNNING : Engine_State::STOPPED;
-    msg.efi.general_error = false;
-    msg.efi.crankshaft_sensor_status = Crankshaft_Sensor_Status::NOT_SUPPORTED;
-    msg.efi.temperature_status = Temperature_Status::NOT_SUPPORTED;
-    msg.efi.fuel_pressure_status = Fuel_Pressure_Status::NOT_SUPPORTED;
-    msg.efi.oil_pressure_status = Oil_Pressure_Status::NOT_SUPPORTED;
-    msg.efi.detonation_status = Detonation_Status::NOT_SUPPORTED;
-    msg.efi.misfire_status = Misfire_Status::NOT_SUPPORTED;
-    msg.efi.debris_status = Debris_Status::NOT_SUPPORTED;
-    float engine_power;
-    float engine_max_power;
-    XPLMGetDatavf(DataRef::engine_power, &engine_power, 0, 1);
-    XPLMGetDatavf(DataRef::engine_max_power, &engine_max_power, 0, 1);
-    msg.efi.engine_load_percent = engine_power / engine_max_power;
-    float engine_rads;
-    XPLMGetDatavf(DataRef::engine_rads, &engine_rads, 0, 1);
-    msg.efi.engine_speed_rpm = static_cast<uint32_t>(engine_rads * 60.0f / (2 * std::numbers::pi));
-    XPLMGetDatavf(DataRef::throttle, &msg.efi.throttle_out, 0, 1);
-    msg.efi.throttle_position_percent = static_cast<uint8_t>(msg.efi.throttle_out * 100);
-    msg.efi.ignition_voltage = -1;
-    float fuel_used = (XPLMGetDataf(DataRef::fuel_total) - XPLMGetDataf(DataRef::fuel_remaining)) * (1 / KGPERCM3);
-    msg.efi.estimated_consumed_fuel_volume_cm3 = fuel_used;
-    float fuel_flow = XPLMGetDataf(DataRef::fuel_flow_s) * 60 * (1 / KGPERCM3);
-    msg.efi.fuel_consumption_rate_cm3pm = fuel_flow;
-    Serial::Send(&header, sizeof(header));
-    Serial::Send(&msg, sizeof(msg));
-    Serial::Send(&footer, sizeof(footer));
+    mag.field = state.rot.conjugate() * north;
+}
+
+void Telemetry::FillGps(AP::gps_data_message_t &gps) {
+    GpsTime(state.day, state.seconds, state.zulu_seconds, gps.gps_week, gps.ms_tow);
+    gps.fix_type = state.gps_fix;
+    gps.satellites_in_view = 10;
+    gps.horizontal_pos_accuracy = 1;
+    gps.vertical_pos_accuracy = 1;
+    gps.horizontal_vel_accuracy = 1;
+    gps.hdop = 1;
+    gps.vdop = 1;
+    gps.latitude = state.latitude * decimaldeg_to_deg;
+    gps.longitude = state.longitude * decimaldeg_to_deg;
+    gps.msl_altitude = state.elevation * m_to_cm;
+    gps.ned_vel_north = -state.gps_vel.z();
+    gps.ned_vel_east = state.gps_vel.x();
+    gps.ned_vel_down = -state.gps_vel.y();
+}
+
+void Telemetry::FillAirspeed(AP::airspeed_data_message_t &aspd) {
+    aspd.differential_pressure = state.dynamic_pressure;
+    aspd.temperature = state.temperature;
+}
+
+void Telemetry::FillEfi(EFI_State &efi) {
+    efi.engine_state = snapshot.engine_running[0] == 2 ? Engine_State::RUNNING : Engine_State::STOPPED;
+    efi.general_error = false;
+    efi.crankshaft_sensor_status = Crankshaft_Sensor_Status::NOT_SUPPORTED;
+    efi.temperature_status = Temperature_Status::NOT_SUPPORTED;
+    efi.fuel_pressure_status = Fuel_Pressure_Status::NOT_SUPPORTED;
+    efi.oil_pressure_status = Oil_Pressure_Status::NOT_SUPPORTED;
+    efi.detonation_status = Detonation_Status::NOT_SUPPORTED;
+    efi.misfire_status = Misfire_Status::NOT_SUPPORTED;
+    efi.debris_status = Debris_Status::NOT_SUPPORTED;
+    efi.engine_load_percent = snapshot.engine_power[0] / snapshot.engine_max_power;
+    efi.engine_speed_rpm = static_cast<uint32_t>(snapshot.engine_rads[0] * 60.0f / (2 * std::numbers::pi));
+    efi.throttle_out = snapshot.throttle[0];
+    efi.throttle_position_percent = static_cast<uint8_t>(efi.throttle_out * 100);
+    efi.ignition_voltage = -1;
+    float fuel_used = (snapshot.fuel_total - snapshot.fuel_remaining) * (1 / KGPERCM3);
+    efi.estimated_consumed_fuel_volume_cm3 = fuel_used;
+    float fuel_flow = snapshot.fuel_flow[0] * 60 * (1 / KGPERCM3);
+    efi.fuel_consumption_rate_cm3pm = fuel_flow;
 }
 
 void Telemetry::RestartArdupilot() {
+    if (Protocol::Version() >= 2) {
+        SendMsg(RESTART, nullptr, 0);
+        return;
+    }
     struct {
         char header[4] = { 'H', 'I', 'T', 'L' };
-        int type = 1;
+        int type = RESTART;
     } msg;
-    Serial::Send(&msg, sizeof(msg));
+    serial_message_t message = { RESTART, nullptr, 0 };
+    Serial::Send({ { &msg, sizeof(msg) } }, Serial::Queue::Main, SERIAL_KEY_NONE, &message);
 }
\ No newline at end of file
@@ -1,12 +1,66 @@
 #pragma once
+#include <cstdint>
 
 #define GRAVITY_MSS 9.80665f
 // https://forums.x-plane.org/index.php?/forums/topic/297040-measurement-unit-of-fuel-in-cockpit-data-output/#comment-2634247
 #define KGPERCM3 0.0007033811f
 
+// Default rates of each sensor group in multirate mode (Hz),
+// only the IMU can go faster than the sim framerate
+#define IMU_RATE 400
+#define BARO_RATE 50
+#define MAG_RATE 50
+#define GPS_RATE 10
+#define AIRSPEED_RATE 50
+#define EFI_RATE 5
+// only sent on its own with compact encoding, otherwise it goes with every IMU sample
+#define ATTITUDE_RATE 50
+// Protocol negotiation pings while the link is not on the latest version (s)
+#define PING_PERIOD 1.0f
+// How far past the last sim frame IMU samples are extrapolated (frames)
+#define IMU_MAX_EXTRAPOLATION 1.0f
+
 namespace Telemetry {
-    void Send();
+    enum MSG_TYPE {
+        SENSORS,
+        RESTART,
+        IMU,
+        BARO,
+        MAG,
+        GPS,
+        AIRSPEED,
+        EFI,
+        PING,
+        // compact encoding, see compact.hpp
+        IMU_COMPACT,
+        ATTITUDE_COMPACT,
+        BARO_COMPACT,
+        MAG_COMPACT,
+        GPS_COMPACT,
+        GPS_DELTA,
+        AIRSPEED_COMPACT,
+        EFI_COMPACT,
+        // serial speed negotiation, see baud.hpp
+        BAUD,
+        MSG_COUNT
+    };
+    void Send(float dt);
+    // Link upkeep without the sim: version offers, the clock exchange and baud rate offers
+    void SendLink(float dt);
+    // Queue a recorded message, encoded for the current link like the ones from the sim
+    void Replay(MSG_TYPE type, const void *msg, size_t bytes);
     void RestartArdupilot();
+    // New link, the first PING goes out right away if the autopilot took v2 last time
+    void Reset();
+    void Stop();
+    void SetMultirate(bool state);
+    void SetRate(MSG_TYPE type, float hz);
+    float GetRate(MSG_TYPE type);
+    // Frames of this type queued since the plug-in started
+    uint64_t FramesSent(MSG_TYPE type);
+    float LinkUsage();
+    // Copy the sim state telemetry works from, done by Send every frame
+    void ReadSnapshot();
 }
 
 enum class Engine_State : uint8_t {
@@ -0,0 +1,288 @@
+#include <algorithm>
+#include <format>
+#include <string>
+#include <cstdlib>
+#include <cmath>
+#include "timesync.hpp"
+#include "protocol.hpp"
+#include "ui.hpp"
+
+// Longest bin edge text in the window
+#define MILLISECONDS_SIZE 16
+
+namespace Timesync {
+    struct sample_t {
+        // plug-in time halfway through the exchange
+        uint64_t local_us;
+        int64_t offset_us;
+        int64_t rtt_us;
+    };
+    const std::chrono::steady_clock::time_point epoch = std::chrono::steady_clock::now();
+    sample_t samples[TIMESYNC_WINDOW];
+    size_t count = 0;
+    size_t next = 0;
+    // fastest exchange of each drift bucket
+    sample_t buckets[TIMESYNC_DRIFT_BUCKETS];
+    size_t bucket_count = 0;
+    size_t bucket_next = 0;
+    // offset = base + drift * (local - reference)
+    uint64_t reference = 0;
+    double base = 0;
+    double drift = 0;
+    uint64_t last_ping = 0;
+    int64_t last_uplink = -1;
+    int64_t last_downlink = -1;
+    timesync_stats_t stats;
+
+    void Fit();
+    void AddBucket(const sample_t &sample);
+    void FitDrift(uint64_t now_us);
+    double Weight(const sample_t &sample);
+    double Offset(uint64_t local_us);
+    void AddLatency(histogram_t &latency, histogram_t &jitter, int64_t &last, int64_t us);
+    void Row(void (*set)(std::string_view), const char *name, const histogram_t &histogram);
+    std::string_view Bars(const histogram_t &histogram, char (&bars)[HISTOGRAM_BINS]);
+    std::string_view Milliseconds(int64_t us, char (&text)[MILLISECONDS_SIZE]);
+}
+
+void histogram_t::Add(int64_t us) {
+    counts[Bin(us)]++;
+    total++;
+}
+
+int histogram_t::Bin(int64_t us) {
+    int bin = 0;
+    while (bin < HISTOGRAM_BINS - 1 && us >= (static_cast<int64_t>(HISTOGRAM_FIRST_BIN) << bin)) {
+        bin++;
+    }
+    return bin;
+}
+
+int64_t histogram_t::Percentile(double p) const {
+    if (total == 0) { return 0; }
+    uint32_t target = static_cast<uint32_t>(std::max(1.0, p * total));
+    uint32_t seen = 0;
+    for (int bin = 0; bin < HISTOGRAM_BINS; bin++) {
+        seen += counts[bin];
+        if (seen >= target) { return static_cast<int64_t>(HISTOGRAM_FIRST_BIN) << bin; }
+    }
+    return static_cast<int64_t>(HISTOGRAM_FIRST_BIN) << (HISTOGRAM_BINS - 1);
+}
+
+uint64_t Timesync::Now() {
+    return Micros(std::chrono::steady_clock::now());
+}
+
+uint64_t Timesync::Micros(std::chrono::steady_clock::time_point time) {
+    return std::chrono::duration_cast<std::chrono::microseconds>(time - epoch).count();
+}
+
+bool Timesync::IsEnabled() {
+    return Protocol::Version() >= 2 && (Protocol::Features() & FEATURE_TIMESYNC);
+}
+
+void Timesync::Reset() {
+    count = 0;
+    next = 0;
+    bucket_count = 0;
+    bucket_next = 0;
+    base = 0;
+    drift = 0;
+    last_ping = 0;
+    last_uplink = -1;
+    last_downlink = -1;
+    stats = {};
+}
+
+ping_sync_t Timesync::Ping() {
+    return { PROTOCOL_VERSION, PROTOCOL_FEATURES, Now() };
+}
+
+// t0 PING sent, t1 PING received, t2 STATE sent, t3 STATE received
+void Timesync::OnState(const state_sync_t &sync, uint64_t received_us) {
+    int64_t t0 = sync.ping_time_us;
+    int64_t t1 = sync.ping_rx_us;
+    int64_t t2 = sync.time_us;
+    int64_t t3 = received_us;
+    // nothing echoed yet, or an echo of something older than this link
+    if (t0 == 0 || t0 > t3) { return; }
+    int64_t rtt = (t3 - t0) - (t2 - t1);
+    if (rtt < 0) { return; }
+    sample_t sample = { static_cast<uint64_t>((t0 + t3) / 2), ((t1 - t0) + (t2 - t3)) / 2, rtt };
+    samples[next] = sample;
+    AddBucket(sample);
+    next = (next + 1) % TIMESYNC_WINDOW;
+    count = std::min<size_t>(count + 1, TIMESYNC_WINDOW);
+    stats.rtt_us = rtt;
+    FitDrift(sample.local_us);
+    Fit();
+    // STATE repeats the same echo until the next PING gets through
+    if (sync.ping_time_us == last_ping) { return; }
+    last_ping = sync.ping_time_us;
+    int64_t uplink = t1 - (t0 + static_cast<int64_t>(Offset(t0)));
+    AddLatency(stats.uplink, stats.uplink_jitter, last_uplink, uplink);
+}
+
+void Timesync::OnFrame(uint32_t stamp, uint64_t received_us) {
+    if (!stats.synced) { return; }
+    // only the low bits of the autopilot clock are sent, compare against where it should be now
+    uint64_t expected = received_us + static_cast<int64_t>(Offset(received_us));
+    int64_t downlink = static_cast<int32_t>(static_cast<uint32_t>(expected) - stamp);
+    AddLatency(stats.downlink, stats.downlink_jitter, last_downlink, downlink);
+}
+
+timesync_stats_t Timesync::GetStats() {
+    stats.offset_us = static_cast<int64_t>(Offset(Now()));
+    stats.drift_ppm = drift * 1e6;
+    return stats;
+}
+
+void Timesync::UpdateUI() {
+    if (!stats.synced) {
+        UI::Window::LabelClock::SetText("Not synced");
+        return;
+    }
+    timesync_stats_t now = GetStats();
+    char text[LABEL_SIZE];
+    if (now.drift_valid) {
+        UI::Window::LabelClock::SetText(UI::Format(text, "{:+.1f} ms {:+.0f} ppm rtt {:.1f} ms",
+            now.offset_us / 1000.0, now.drift_ppm, now.rtt_us / 1000.0));
+    } else {
+        UI::Window::LabelClock::SetText(UI::Format(text, "{:+.1f} ms ? ppm rtt {:.1f} ms",
+            now.offset_us / 1000.0, now.rtt_us / 1000.0));
+    }
+    Row(UI::Window::LabelUplink::SetText, "Up    ", now.uplink);
+    Row(UI::Window::LabelUplinkJitter::SetText, "Jitter ", now.uplink_jitter);
+    Row(UI::Window::LabelDownlink::SetText, "Down  ", now.downlink);
+    Row(UI::Window::LabelDownlinkJitter::SetText, "Jitter ", now.downlink_jitter);
+}
+
+// Median and p99 bin edges then the histogram
+void Timesync::Row(void (*set)(std::string_view), const char *name, const histogram_t &histogram) {
+    char text[LABEL_SIZE];
+    char p50[MILLISECONDS_SIZE];
+    char p99[MILLISECONDS_SIZE];
+    char bars[HISTOGRAM_BINS];
+    set(UI::Format(text, "{}{:>5} {:>5} [{}]", name, Milliseconds(histogram.Percentile(0.5), p50),
+        Milliseconds(histogram.Percentile(0.99), p99), Bars(histogram, bars)));
+}
+
+// Mean offset of the exchanges with the shortest round trips, queueing only ever adds
+// delay so those are the most symmetric ones. The drift comes from FitDrift
+void Timesync::Fit() {
+    int64_t min_rtt = samples[0].rtt_us;
+    for (size_t i = 1; i < count; i++) {
+        min_rtt = std::min(min_rtt, samples[i].rtt_us);
+    }
+    int64_t max_rtt = std::max<int64_t>(min_rtt * TIMESYNC_RTT_FACTOR, HISTOGRAM_FIRST_BIN);
+    // relative to the newest sample so the sums stay small
+    uint64_t origin = samples[(next + TIMESYNC_WINDOW - 1) % TIMESYNC_WINDOW].local_us;
+    double n = 0, sx = 0, sy = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (samples[i].rtt_us > max_rtt) { continue; }
+        n++;
+        sx += static_cast<double>(static_cast<int64_t>(samples[i].local_us - origin));
+        sy += static_cast<double>(samples[i].offset_us);
+    }
+    reference = origin + static_cast<int64_t>(sx / n);
+    base = sy / n;
+    stats.synced = true;
+}
+
+// Keep the fastest exchange of the bucket it falls in, starting a new bucket when it is past the newest one
+void Timesync::AddBucket(const sample_t &sample) {
+    const uint64_t period = static_cast<uint64_t>(TIMESYNC_DRIFT_BUCKET) * 1000000;
+    sample_t &newest = buckets[(bucket_next + TIMESYNC_DRIFT_BUCKETS - 1) % TIMESYNC_DRIFT_BUCKETS];
+    if (bucket_count > 0 && sample.local_us / period == newest.local_us / period) {
+        if (sample.rtt_us < newest.rtt_us) {
+            newest = sample;
+        }
+        return;
+    }
+    buckets[bucket_next] = sample;
+    bucket_next = (bucket_next + 1) % TIMESYNC_DRIFT_BUCKETS;
+    bucket_count = std::min<size_t>(bucket_count + 1, TIMESYNC_DRIFT_BUCKETS);
+}
+
+// Least squares line through the buckets, weighted by the inverse square of the round trip
+// since that bounds how far off an offset can be. Withheld until it spans long enough and
+// the scatter around the line says the slope is good to TIMESYNC_DRIFT_MAX_ERROR
+void Timesync::FitDrift(uint64_t now_us) {
+    uint64_t origin = buckets[(bucket_next + TIMESYNC_DRIFT_BUCKETS - 1) % TIMESYNC_DRIFT_BUCKETS].local_us;
+    uint64_t oldest = buckets[(bucket_next + TIMESYNC_DRIFT_BUCKETS - bucket_count) % TIMESYNC_DRIFT_BUCKETS].local_us;
+    stats.drift_span_s = (now_us - oldest) / 1e6f;
+    double sw = 0, sx = 0, sy = 0;
+    for (size_t i = 0; i < bucket_count; i++) {
+        double w = Weight(buckets[i]);
+        sw += w;
+        sx += w * static_cast<double>(static_cast<int64_t>(buckets[i].local_us - origin));
+        sy += w * static_cast<double>(buckets[i].offset_us);
+    }
+    double mean_x = sx / sw;
+    double mean_y = sy / sw;
+    double sxx = 0, sxy = 0;
+    for (size_t i = 0; i < bucket_count; i++) {
+        double w = Weight(buckets[i]);
+        double x = static_cast<double>(static_cast<int64_t>(buckets[i].local_us - origin)) - mean_x;
+        sxx += w * x * x;
+        sxy += w * x * (static_cast<double>(buckets[i].offset_us) - mean_y);
+    }
+    // a line through 3 points is the least that leaves a residual to judge it by
+    if (bucket_count < 4 || sxx <= 0 || stats.drift_span_s < TIMESYNC_DRIFT_MIN_SPAN) {
+        drift = 0;
+        stats.drift_valid = false;
+        return;
+    }
+    double slope = sxy / sxx;
+    double residual = 0;
+    for (size_t i = 0; i < bucket_count; i++) {
+        double x = static_cast<double>(static_cast<int64_t>(buckets[i].local_us - origin)) - mean_x;
+        double r = static_cast<double>(buckets[i].offset_us) - mean_y - slope * x;
+        residual += Weight(buckets[i]) * r * r;
+    }
+    double error = std::sqrt(residual / (bucket_count - 2) / sxx);
+    stats.drift_valid = error * 1e6 <= TIMESYNC_DRIFT_MAX_ERROR;
+    drift = stats.drift_valid ? slope : 0;
+}
+
+// Inverse square of the round trip, faster than the first histogram bin counts as that fast
+double Timesync::Weight(const sample_t &sample) {
+    double rtt = static_cast<double>(std::max<int64_t>(sample.rtt_us, HISTOGRAM_FIRST_BIN));
+    return 1 / (rtt * rtt);
+}
+
+double Timesync::Offset(uint64_t local_us) {
+    return base + drift * static_cast<double>(static_cast<int64_t>(local_us - reference));
+}
+
+void Timesync::AddLatency(histogram_t &latency, histogram_t &jitter, int64_t &last, int64_t us) {
+    latency.Add(us);
+    if (last >= 0) {
+        jitter.Add(std::abs(us - last));
+    }
+    last = std::max<int64_t>(us, 0);
+}
+
+// One character per bin, taller for fuller bins
+std::string_view Timesync::Bars(const histogram_t &histogram, char (&bars)[HISTOGRAM_BINS]) {
+    const char levels[] = " .:-=+*#";
+    uint32_t max = *std::max_element(histogram.counts, histogram.counts + HISTOGRAM_BINS);
+    std::fill_n(bars, HISTOGRAM_BINS, ' ');
+    for (int bin = 0; bin < HISTOGRAM_BINS && max > 0; bin++) {
+        if (histogram.counts[bin] == 0) { continue; }
+        bars[bin] = levels[1 + histogram.counts[bin] * (sizeof(levels) - 3) / max];
+    }
+    return { bars, HISTOGRAM_BINS };
+}
+
+// Bin edge as shown in the window, the last bin has no upper edge
+std::string_view Timesync::Milliseconds(int64_t us, char (&text)[MILLISECONDS_SIZE]) {
+    char bound = '<';
+    double ms = us / 1000.0;
+    if (us >= static_cast<int64_t>(HISTOGRAM_FIRST_BIN) << (HISTOGRAM_BINS - 1)) {
+        bound = '>';
+        ms = (static_cast<int64_t>(HISTOGRAM_FIRST_BIN) << (HISTOGRAM_BINS - 2)) / 1000.0;
+    }
+    auto result = std::format_to_n(text, MILLISECONDS_SIZE, "{}{:g}", bound, ms);
+    return { text, static_cast<size_t>(result.out - text) };
+}
@@ -0,0 +1,97 @@
+#pragma once
+#include <cstdint>
+#include <chrono>
+
+// Clock synchronization with the autopilot, in the spirit of MAVLink TIMESYNC.
+// Once FEATURE_TIMESYNC is agreed the plug-in keeps sending PING with its clock,
+// the autopilot echoes it in STATE along with when it got it and when STATE left,
+// and every frame in both directions carries the low 32 bits of the sender clock
+
+// PING period once the clocks are being synchronized (s)
+#define TIMESYNC_PERIOD 0.2f
+// Exchanges the offset is fitted over
+#define TIMESYNC_WINDOW 64
+// The drift is fitted over the fastest exchange of every TIMESYNC_DRIFT_BUCKET seconds, for
+// the last TIMESYNC_DRIFT_BUCKETS of them. Over a few seconds the round trip noise swamps it
+#define TIMESYNC_DRIFT_BUCKET 10
+#define TIMESYNC_DRIFT_BUCKETS 30
+// The drift is taken as 0 until the exchanges span this long (s)
+#define TIMESYNC_DRIFT_MIN_SPAN 60
+// and the fit residual puts its standard error below this (ppm)
+#define TIMESYNC_DRIFT_MAX_ERROR 5
+// Exchanges slower than this many times the fastest one in the window are left out of the fit
+#define TIMESYNC_RTT_FACTOR 2
+// Latency histogram bins double in width starting from this (us), the last one is open ended
+#define HISTOGRAM_FIRST_BIN 250
+#define HISTOGRAM_BINS 10
+
+#pragma pack(push, 1)
+// PING once FEATURE_TIMESYNC is agreed
+struct ping_sync_t {
+    uint8_t version;
+    uint8_t features;
+    // plug-in clock when sent (us)
+    uint64_t time_us;
+};
+
+// Appended to STATE once FEATURE_TIMESYNC is agreed, autopilot clock
+struct state_sync_t {
+    // time_us of the last PING received, echoed back
+    uint64_t ping_time_us;
+    // when that PING was received
+    uint64_t ping_rx_us;
+    // when this STATE was sent
+    uint64_t time_us;
+};
+#pragma pack(pop)
+
+static_assert(sizeof(ping_sync_t) == 10);
+static_assert(sizeof(state_sync_t) == 24);
+
+struct histogram_t {
+    uint32_t counts[HISTOGRAM_BINS];
+    uint32_t total;
+    void Add(int64_t us);
+    // Bin a latency falls in
+    static int Bin(int64_t us);
+    // Upper edge of the bin the p quantile falls in (us), 0 when empty
+    int64_t Percentile(double p) const;
+};
+
+struct timesync_stats_t {
+    bool synced;
+    // autopilot clock minus plug-in clock, now (us)
+    int64_t offset_us;
+    // autopilot clock rate relative to the plug-in one (parts per million), 0 until drift_valid
+    double drift_ppm;
+    bool drift_valid;
+    // from the oldest exchange the drift is fitted over to the last one (s)
+    float drift_span_s;
+    // round trip of the last exchange, without the time the autopilot held it (us)
+    int64_t rtt_us;
+    // one-way latency, uplink is plug-in to autopilot. Downlink is measured up to when
+    // the sim thread parses the frame, so it includes waiting for the flight loop
+    histogram_t uplink;
+    histogram_t downlink;
+    // difference between consecutive latencies
+    histogram_t uplink_jitter;
+    histogram_t downlink_jitter;
+};
+
+namespace Timesync {
+    // Plug-in clock every timestamp on the link is taken from (us)
+    uint64_t Now();
+    uint64_t Micros(std::chrono::steady_clock::time_point time);
+    // Whether both sides agreed on FEATURE_TIMESYNC
+    bool IsEnabled();
+    void Reset();
+    // Build the PING sent every TIMESYNC_PERIOD
+    ping_sync_t Ping();
+    // Exchange closed by a STATE, received at the plug-in time given
+    void OnState(const state_sync_t &sync, uint64_t received_us);
+    // Any stamped frame from the autopilot
+    void OnFrame(uint32_t stamp, uint64_t received_us);
+    timesync_stats_t GetStats();
+    // Refresh the settings window
+    void UpdateUI();
+}
@@ -0,0 +1,340 @@
+#if defined (_WIN32) || defined (_WIN64)
+// winsock must come before anything that pulls in windows.h
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#else
+#include <sys/socket.h>
+#include <sys/ioctl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <netdb.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
+#endif
+#include <serialib.h>
+#include <XPLMUtilities.h>
+#include <string>
+#include <format>
+#include <memory>
+#include <vector>
+#include <algorithm>
+#include <cstring>
+#include "transport.hpp"
+#include "serial.hpp"
+
+// largest datagram accepted by the UDP transport
+#define TRANSPORT_MAX_DATAGRAM 65536
+
+#if defined (_WIN32) || defined (_WIN64)
+typedef SOCKET socket_t;
+typedef int socklen_t;
+#define CloseSocket closesocket
+#define SocketError() WSAGetLastError()
+#define SOCKET_WOULD_BLOCK WSAEWOULDBLOCK
+#define SOCKET_IN_PROGRESS WSAEWOULDBLOCK
+#define SOCKET_SEND_FLAGS 0
+#define poll WSAPoll
+#else
+typedef int socket_t;
+#define INVALID_SOCKET -1
+#define CloseSocket close
+#define SocketError() errno
+#define SOCKET_WOULD_BLOCK EWOULDBLOCK
+#define SOCKET_IN_PROGRESS EINPROGRESS
+// a reset connection fails the write with EPIPE instead of raising SIGPIPE,
+// macOS has no such flag and sets SO_NOSIGPIPE on the socket instead
+#if defined (MSG_NOSIGNAL)
+#define SOCKET_SEND_FLAGS MSG_NOSIGNAL
+#else
+#define SOCKET_SEND_FLAGS 0
+#endif
+#endif
+
+namespace {
+    bool SetNonBlocking(socket_t fd) {
+#if defined (_WIN32) || defined (_WIN64)
+        u_long mode = 1;
+        return ioctlsocket(fd, FIONBIO, &mode) == 0;
+#else
+        int flags = fcntl(fd, F_GETFL, 0);
+        return flags >= 0 && fcntl(fd, F_SETFL, flags | O_NONBLOCK) == 0;
+#endif
+    }
+
+    // Bytes queued in the socket, for UDP the size of the next datagram on Linux
+    int Pending(socket_t fd) {
+#if defined (_WIN32) || defined (_WIN64)
+        u_long bytes = 0;
+        if (ioctlsocket(fd, FIONREAD, &bytes) != 0) { return -1; }
+#else
+        int bytes = 0;
+        if (ioctl(fd, FIONREAD, &bytes) != 0) { return -1; }
+#endif
+        return static_cast<int>(bytes);
+    }
+
+    // Wait until the socket can be read or written
+    bool WaitSocket(socket_t fd, short events, int timeout) {
+        pollfd entry = { fd, events, 0 };
+        return poll(&entry, 1, timeout) > 0;
+    }
+
+    // Same with microsecond resolution where the platform has it
+    bool WaitSocket(socket_t fd, std::chrono::microseconds timeout) {
+        pollfd entry = { fd, POLLIN, 0 };
+#if defined (__linux__)
+        timespec time = { static_cast<time_t>(timeout.count() / 1000000), static_cast<long>(timeout.count() % 1000000) * 1000 };
+        return ppoll(&entry, 1, &time, nullptr) > 0;
+#else
+        return poll(&entry, 1, static_cast<int>((timeout.count() + 999) / 1000)) > 0;
+#endif
+    }
+
+    bool StartNetwork() {
+#if defined (_WIN32) || defined (_WIN64)
+        static bool started = false;
+        if (!started) {
+            WSADATA data;
+            started = WSAStartup(MAKEWORD(2, 2), &data) == 0;
+        }
+        return started;
+#else
+        return true;
+#endif
+    }
+
+    // Split host[:port], a missing host means any interface
+    bool Resolve(const std::string &target, int type, sockaddr_storage &addr, socklen_t &len) {
+        size_t colon = target.rfind(':');
+        std::string host = colon == std::string::npos ? target : target.substr(0, colon);
+        std::string port = colon == std::string::npos ? std::to_string(TRANSPORT_PORT) : target.substr(colon + 1);
+        addrinfo hints = {};
+        hints.ai_family = AF_INET;
+        hints.ai_socktype = type;
+        hints.ai_flags = host.empty() ? AI_PASSIVE : 0;
+        addrinfo *result = nullptr;
+        if (getaddrinfo(host.empty() ? nullptr : host.c_str(), port.c_str(), &hints, &result) != 0 || !result) {
+            return false;
+        }
+        memcpy(&addr, result->ai_addr, result->ai_addrlen);
+        len = static_cast<socklen_t>(result->ai_addrlen);
+        freeaddrinfo(result);
+        return true;
+    }
+
+    class SerialTransport : public Transport {
+    public:
+        SerialTransport(const std::string &port) { address = port; }
+        bool Open() override {
+            if (serial.openDevice(address.c_str(), BAUD_RATE) != 1) { return false; }
+            serial.setDTR();
+            serial.clearRTS();
+            return true;
+        }
+        void Close() override { serial.closeDevice(); }
+        bool IsOpen() override { return serial.isDeviceOpen(); }
+        int Available() override { return serial.available(); }
+        int Read(uint8_t *dest, size_t max, unsigned int timeout) override {
+            return serial.readBytes(dest, static_cast<unsigned int>(max), timeout);
+        }
+        int Write(const uint8_t *src, size_t bytes) override {
+            return serial.writeSome(src, static_cast<unsigned int>(bytes));
+        }
+        // TIOCOUTQ, ptys always report 0
+        int Backlog() override { return serial.pending(); }
+        bool IsSerial() override { return true; }
+        bool SetBaudRate(unsigned int baud) override { return serial.setBaudRate(baud) == 1; }
+        bool Wait(std::chrono::microseconds timeout) override {
+            return serial.waitReadable(static_cast<unsigned int>(timeout.count())) == 1;
+        }
+        // ASYNC_LOW_LATENCY, ptys and Windows drivers don't take it
+        bool SetLowLatency(bool state) override { return serial.setLowLatency(state) == 1; }
+    private:
+        serialib serial;
+    };
+
+    class TcpTransport : public Transport {
+    public:
+        TcpTransport(const std::string &target) : target(target) { address = "tcp://" + target; }
+        ~TcpTransport() { Close(); }
+        bool Open() override {
+            sockaddr_storage addr;
+            socklen_t len;
+            if (!StartNetwork() || !Resolve(target, SOCK_STREAM, addr, len)) { return false; }
+            fd = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+            if (fd == INVALID_SOCKET) { return false; }
+            // frames are small and latency matters more than packing them
+            int nodelay = 1;
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, reinterpret_cast<const char *>(&nodelay), sizeof(nodelay));
+#if defined (SO_NOSIGPIPE)
+            int nosigpipe = 1;
+            setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &nosigpipe, sizeof(nosigpipe));
+#endif
+            SetNonBlocking(fd);
+            // the flight loop opens the link, never block it on a missing peer
+            if (connect(fd, reinterpret_cast<sockaddr *>(&addr), len) != 0 &&
+                (SocketError() != SOCKET_IN_PROGRESS || !WaitSocket(fd, POLLOUT, TRANSPORT_CONNECT_TIMEOUT))) {
+                Close();
+                return false;
+            }
+            int error = 0;
+            socklen_t size = sizeof(error);
+            getsockopt(fd, SOL_SOCKET, SO_ERROR, reinterpret_cast<char *>(&error), &size);
+            if (error != 0) {
+                Close();
+                return false;
+            }
+            return true;
+        }
+        void Close() override {
+            if (fd == INVALID_SOCKET) { return; }
+            CloseSocket(fd);
+            fd = INVALID_SOCKET;
+        }
+        bool IsOpen() override { return fd != INVALID_SOCKET; }
+        int Available() override {
+            // a closed connection reads as ready with nothing queued
+            if (WaitSocket(fd, POLLIN, 0) && Pending(fd) == 0) { return -1; }
+            return Pending(fd);
+        }
+        int Read(uint8_t *dest, size_t max, unsigned int timeout) override {
+            if (!WaitSocket(fd, POLLIN, timeout)) { return 0; }
+            int got = recv(fd, reinterpret_cast<char *>(dest), static_cast<int>(max), 0);
+            if (got == 0) { return -1; }
+            if (got < 0) { return SocketError() == SOCKET_WOULD_BLOCK ? 0 : -1; }
+            return got;
+        }
+        int Write(const uint8_t *src, size_t bytes) override {
+            int n = send(fd, reinterpret_cast<const char *>(src), static_cast<int>(bytes), SOCKET_SEND_FLAGS);
+            if (n < 0) { return SocketError() == SOCKET_WOULD_BLOCK ? 0 : -1; }
+            return n;
+        }
+        // Bytes not acknowledged by the peer yet
+        int Backlog() override {
+#if defined (_WIN32) || defined (_WIN64)
+            return 0;
+#else
+            int bytes = 0;
+            if (ioctl(fd, TIOCOUTQ, &bytes) != 0) { return 0; }
+            return bytes;
+#endif
+        }
+        bool IsSerial() override { return false; }
+        bool SetBaudRate(unsigned int) override { return false; }
+        bool Wait(std::chrono::microseconds timeout) override { return WaitSocket(fd, timeout); }
+        // TCP_NODELAY is always set
+        bool SetLowLatency(bool) override { return true; }
+    private:
+        std::string target;
+        socket_t fd = INVALID_SOCKET;
+    };
+
+    // Datagrams are handed out as a byte stream, frames may span several of them
+    class UdpTransport : public Transport {
+    public:
+        UdpTransport(const std::string &target) : target(target), datagram(TRANSPORT_MAX_DATAGRAM) { address = "udp://" + target; }
+        ~UdpTransport() { Close(); }
+        bool Open() override {
+            sockaddr_storage addr;
+            socklen_t len;
+            if (!StartNetwork() || !Resolve(target, SOCK_DGRAM, addr, len)) { return false; }
+            fd = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+            if (fd == INVALID_SOCKET) { return false; }
+            SetNonBlocking(fd);
+            listening = target.empty() || target[0] == ':';
+            if (listening) {
+                if (bind(fd, reinterpret_cast<sockaddr *>(&addr), len) != 0) {
+                    Close();
+                    return false;
+                }
+                peer_len = 0;
+            } else {
+                peer = addr;
+                peer_len = len;
+            }
+            head = 0;
+            tail = 0;
+            return true;
+        }
+        void Close() override {
+            if (fd == INVALID_SOCKET) { return; }
+            CloseSocket(fd);
+            fd = INVALID_SOCKET;
+        }
+        bool IsOpen() override { return fd != INVALID_SOCKET; }
+        int Available() override {
+            if (head == tail && !Receive()) { return -1; }
+            return static_cast<int>(tail - head);
+        }
+        int Read(uint8_t *dest, size_t max, unsigned int timeout) override {
+            if (head == tail) {
+                if (!WaitSocket(fd, POLLIN, timeout)) { return 0; }
+                if (!Receive()) { return -1; }
+            }
+            size_t bytes = std::min(max, tail - head);
+            memcpy(dest, &datagram[head], bytes);
+            head += bytes;
+            return static_cast<int>(bytes);
+        }
+        int Write(const uint8_t *src, size_t bytes) override {
+            // nobody to answer to yet
+            if (peer_len == 0) { return static_cast<int>(bytes); }
+            int n = sendto(fd, reinterpret_cast<const char *>(src), static_cast<int>(bytes), 0,
+                reinterpret_cast<sockaddr *>(&peer), peer_len);
+            // a full socket buffer loses the datagram like a lossy link would
+            if (n < 0 && SocketError() != SOCKET_WOULD_BLOCK) { return -1; }
+            return static_cast<int>(bytes);
+        }
+        // Datagrams leave right away or are lost
+        int Backlog() override { return 0; }
+        bool IsSerial() override { return false; }
+        bool SetBaudRate(unsigned int) override { return false; }
+        bool Wait(std::chrono::microseconds timeout) override { return head != tail || WaitSocket(fd, timeout); }
+        bool SetLowLatency(bool) override { return true; }
+    private:
+        // Take the next datagram if there is one, false on socket errors
+        bool Receive() {
+            sockaddr_storage from;
+            socklen_t from_len = sizeof(from);
+            int got = recvfrom(fd, reinterpret_cast<char *>(datagram.data()), static_cast<int>(datagram.size()), 0,
+                reinterpret_cast<sockaddr *>(&from), &from_len);
+            if (got < 0) {
+                int error = SocketError();
+#if defined (_WIN32) || defined (_WIN64)
+                // an ICMP port unreachable from an earlier send, the peer may still show up
+                if (error == WSAECONNRESET) { return true; }
+#else
+                if (error == ECONNREFUSED) { return true; }
+#endif
+                return error == SOCKET_WOULD_BLOCK;
+            }
+            if (listening) {
+                peer = from;
+                peer_len = from_len;
+            }
+            head = 0;
+            tail = got;
+            return true;
+        }
+        std::string target;
+        socket_t fd = INVALID_SOCKET;
+        bool listening = false;
+        sockaddr_storage peer;
+        socklen_t peer_len = 0;
+        std::vector<uint8_t> datagram;
+        size_t head = 0;
+        size_t tail = 0;
+    };
+}
+
+std::unique_ptr<Transport> Transport::Create(const std::string &address) {
+    if (address.starts_with("tcp://")) {
+        return std::make_unique<TcpTransport>(address.substr(6));
+    }
+    if (address.starts_with("udp://")) {
+        return std::make_unique<UdpTransport>(address.substr(6));
+    }
+    return std::make_unique<SerialTransport>(address);
+}
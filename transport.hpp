@@ -0,0 +1,46 @@
+#pragma once
+#include <string>
+#include <memory>
+#include <cstdint>
+#include <cstddef>
+#include <chrono>
+
+// Default port of the TCP and UDP transports
+#define TRANSPORT_PORT 5790
+// How long connecting may wait for the socket (ms)
+#define TRANSPORT_CONNECT_TIMEOUT 100
+
+// Byte link to the autopilot, owned by the serial I/O thread once open.
+// The address picks the implementation:
+//   tcp://host[:port]   TCP client
+//   udp://host[:port]   UDP to a fixed peer
+//   udp://:port         UDP listening on port, replies go to the last sender
+//   anything else       serial device
+class Transport {
+public:
+    static std::unique_ptr<Transport> Create(const std::string &address);
+    virtual ~Transport() = default;
+    virtual bool Open() = 0;
+    virtual void Close() = 0;
+    virtual bool IsOpen() = 0;
+    // Bytes that can be read right away, negative on error
+    virtual int Available() = 0;
+    // Wait up to timeout for up to max bytes, returns the bytes read or negative on error
+    virtual int Read(uint8_t *dest, size_t max, unsigned int timeout) = 0;
+    // Write as many bytes as the link takes right now without blocking,
+    // returns the bytes written, 0 when it is full, or negative on error
+    virtual int Write(const uint8_t *src, size_t bytes) = 0;
+    // Bytes written but still queued in the OS, 0 when it can't tell
+    virtual int Backlog() = 0;
+    // Whether bytes are paced by a baud rate
+    virtual bool IsSerial() = 0;
+    // Change the speed of an open serial link, false if it is not supported
+    virtual bool SetBaudRate(unsigned int baud) = 0;
+    // Wait up to timeout for bytes to read, false on timeout or error
+    virtual bool Wait(std::chrono::microseconds timeout) = 0;
+    // Have the driver hand over received bytes right away, false if it can't
+    virtual bool SetLowLatency(bool state) = 0;
+    const std::string &Address() { return address; }
+protected:
+    std::string address;
+};
@@ -13,6 +13,9 @@
 #include "serial.hpp"
 #include "calibration.hpp"
 #include "remote.hpp"
+#include "telemetry.hpp"
+#include "recorder.hpp"
+#include "capture.hpp"
 
 // X-Plane top menu plugin definitions
 
@@ -25,12 +28,26 @@ namespace UI::Menu {
 
 namespace UI::Window {
     XPWidgetID id;
-    int width = 260;
-    int height = 125;
+    int width = 360;
+    int height = 330;
     int OnEvent(XPWidgetMessage inMessage, XPWidgetID inWidget, intptr_t inParam1, intptr_t inParam2);
+    void SetLabel(XPWidgetID label, std::string_view text);
     namespace LabelSerialPort {
         XPWidgetID id;
-        void SetText(std::string text) { XPSetWidgetDescriptor(id, text.c_str()); };
+        void SetText(std::string_view text) { SetLabel(id, text); };
+    }
+    namespace LabelLink {
+        XPWidgetID id;
+        void SetText(std::string_view text) { SetLabel(id, text); };
+    }
+    namespace ButtonMultirate {
+        XPWidgetID id;
+        int OnEvent(XPWidgetMessage inMessage, XPWidgetID inWidget, intptr_t inParam1, intptr_t inParam2);
+    }
+    namespace ButtonLowLatency {
+        XPWidgetID id;
+        void SetState(bool state) { XPSetWidgetProperty(id, xpProperty_ButtonState, state); };
+        int OnEvent(XPWidgetMessage inMessage, XPWidgetID inWidget, intptr_t inParam1, intptr_t inParam2);
     }
     namespace ButtonCalibration {
         XPWidgetID id;
@@ -38,7 +55,7 @@ namespace UI::Window {
     }
     namespace LabelCalibration {
         XPWidgetID id;
-        void SetText(std::string text) { XPSetWidgetDescriptor(id, text.c_str()); };
+        void SetText(std::string_view text) { SetLabel(id, text); };
     }
     namespace ButtonCalibrationNextStep {
         XPWidgetID id;
@@ -56,13 +73,67 @@ namespace UI::Window {
         XPWidgetID id;
         int OnEvent(XPWidgetMessage inMessage, XPWidgetID inWidget, intptr_t inParam1, intptr_t inParam2);
     }
+    namespace ButtonRecord {
+        XPWidgetID id;
+        void SetState(bool state) { XPSetWidgetProperty(id, xpProperty_ButtonState, state); };
+        int OnEvent(XPWidgetMessage inMessage, XPWidgetID inWidget, intptr_t inParam1, intptr_t inParam2);
+    }
+    namespace ButtonCapture {
+        XPWidgetID id;
+        void SetState(bool state) { XPSetWidgetProperty(id, xpProperty_ButtonState, state); };
+        int OnEvent(XPWidgetMessage inMessage, XPWidgetID inWidget, intptr_t inParam1, intptr_t inParam2);
+    }
     namespace LabelRemoteArmed {
         XPWidgetID id;
-        void SetText(std::string text) { XPSetWidgetDescriptor(id, text.c_str()); };
+        void SetText(std::string_view text) { SetLabel(id, text); };
     }
     namespace LabelAHRSCount {
         XPWidgetID id;
-        void SetText(std::string text) { XPSetWidgetDescriptor(id, text.c_str()); };
+        void SetText(std::string_view text) { SetLabel(id, text); };
+    }
+    namespace LabelClock {
+        XPWidgetID id;
+        void SetText(std::string_view text) { SetLabel(id, text); };
+    }
+    namespace LabelUplink {
+        XPWidgetID id;
+        void SetText(std::string_view text) { SetLabel(id, text); };
+    }
+    namespace LabelUplinkJitter {
+        XPWidgetID id;
+        void SetText(std::string_view text) { SetLabel(id, text); };
+    }
+    namespace LabelDownlink {
+        XPWidgetID id;
+        void SetText(std::string_view text) { SetLabel(id, text); };
+    }
+    namespace LabelDownlinkJitter {
+        XPWidgetID id;
+        void SetText(std::string_view text) { SetLabel(id, text); };
+    }
+    namespace LabelRx {
+        XPWidgetID id;
+        void SetText(std::string_view text) { SetLabel(id, text); };
+    }
+    namespace LabelRxTypes {
+        XPWidgetID id;
+        void SetText(std::string_view text) { SetLabel(id, text); };
+    }
+    namespace LabelTx {
+        XPWidgetID id;
+        void SetText(std::string_view text) { SetLabel(id, text); };
+    }
+    namespace LabelTxTypes {
+        XPWidgetID id;
+        void SetText(std::string_view text) { SetLabel(id, text); };
+    }
+    namespace TextAddress {
+        XPWidgetID id;
+        void SetText(std::string_view text) { SetLabel(id, text); };
+    }
+    namespace ButtonAddress {
+        XPWidgetID id;
+        int OnEvent(XPWidgetMessage inMessage, XPWidgetID inWidget, intptr_t inParam1, intptr_t inParam2);
     }
 }
 
@@ -98,6 +169,44 @@ void UI::Window::Create() {
         80,
         height - 55,
         1, "Disconnect", 0, id, xpWidgetClass_Caption);
+    LabelLink::id = XPCreateWidget(
+        10 - 2,
+        height - 60 + 3,
+        80,
+        height - 75,
+        1, "Link: 0%", 0, id, xpWidgetClass_Caption);
+    ButtonMultirate::id = XPCreateWidget(
+        10,
+        height - 80,
+        25,
+        height - 95,
+        1, "", 0, id, xpWidgetClass_Button);
+    XPCreateWidget(
+        25 - 2,
+        height - 80 + 3,
+        80,
+        height - 95,
+        1, "Multirate", 0, id, xpWidgetClass_Caption);
+    XPSetWidgetProperty(ButtonMultirate::id, xpProperty_ButtonType, xpRadioButton);
+    XPSetWidgetProperty(ButtonMultirate::id, xpProperty_ButtonBehavior, xpButtonBehaviorCheckBox);
+    XPSetWidgetProperty(ButtonMultirate::id, xpProperty_ButtonState, false);
+    XPAddWidgetCallback(ButtonMultirate::id, ButtonMultirate::OnEvent);
+    ButtonLowLatency::id = XPCreateWidget(
+        10,
+        height - 100,
+        25,
+        height - 115,
+        1, "", 0, id, xpWidgetClass_Button);
+    XPCreateWidget(
+        25 - 2,
+        height - 100 + 3,
+        80,
+        height - 115,
+        1, "Low latency", 0, id, xpWidgetClass_Caption);
+    XPSetWidgetProperty(ButtonLowLatency::id, xpProperty_ButtonType, xpRadioButton);
+    XPSetWidgetProperty(ButtonLowLatency::id, xpProperty_ButtonBehavior, xpButtonBehaviorCheckBox);
+    XPSetWidgetProperty(ButtonLowLatency::id, xpProperty_ButtonState, false);
+    XPAddWidgetCallback(ButtonLowLatency::id, ButtonLowLatency::OnEvent);
     // -- Calibration Widgets --
     XPCreateWidget(
         95 - 2,
@@ -170,10 +279,128 @@ void UI::Window::Create() {
         250,
         height - 95,
         1, "AHRS: 0 Hz", 0, id, xpWidgetClass_Caption);
+    ButtonRecord::id = XPCreateWidget(
+        180,
+        height - 100,
+        195,
+        height - 115,
+        1, "", 0, id, xpWidgetClass_Button);
+    XPCreateWidget(
+        195 - 2,
+        height - 100 + 3,
+        250,
+        height - 115,
+        1, "Record", 0, id, xpWidgetClass_Caption);
+    XPSetWidgetProperty(ButtonRecord::id, xpProperty_ButtonType, xpRadioButton);
+    XPSetWidgetProperty(ButtonRecord::id, xpProperty_ButtonBehavior, xpButtonBehaviorCheckBox);
+    XPSetWidgetProperty(ButtonRecord::id, xpProperty_ButtonState, false);
+    XPAddWidgetCallback(ButtonRecord::id, ButtonRecord::OnEvent);
+    ButtonCapture::id = XPCreateWidget(
+        265,
+        height - 100,
+        280,
+        height - 115,
+        1, "", 0, id, xpWidgetClass_Button);
+    XPCreateWidget(
+        280 - 2,
+        height - 100 + 3,
+        350,
+        height - 115,
+        1, "Capture", 0, id, xpWidgetClass_Caption);
+    XPSetWidgetProperty(ButtonCapture::id, xpProperty_ButtonType, xpRadioButton);
+    XPSetWidgetProperty(ButtonCapture::id, xpProperty_ButtonBehavior, xpButtonBehaviorCheckBox);
+    XPSetWidgetProperty(ButtonCapture::id, xpProperty_ButtonState, false);
+    XPAddWidgetCallback(ButtonCapture::id, ButtonCapture::OnEvent);
     XPSetWidgetProperty(ButtonRemoteOverride::id, xpProperty_ButtonType, xpRadioButton);
     XPSetWidgetProperty(ButtonRemoteOverride::id, xpProperty_ButtonBehavior, xpButtonBehaviorCheckBox);
     XPSetWidgetProperty(ButtonRemoteOverride::id, xpProperty_ButtonState, true);
     XPAddWidgetCallback(ButtonRemoteOverride::id, ButtonRemoteOverride::OnEvent);
+    // -- Link address Widgets --
+    // empty scans the serial ports, otherwise a device, tcp://host:port or udp://host:port
+    XPCreateWidget(
+        10 - 2,
+        height - 120 + 3,
+        60,
+        height - 135,
+        1, "Address", 0, id, xpWidgetClass_Caption);
+    TextAddress::id = XPCreateWidget(
+        60,
+        height - 120,
+        200,
+        height - 135,
+        1, "", 0, id, xpWidgetClass_TextField);
+    XPSetWidgetProperty(TextAddress::id, xpProperty_TextFieldType, xpTextEntryField);
+    ButtonAddress::id = XPCreateWidget(
+        205,
+        height - 120,
+        250,
+        height - 135,
+        1, "Set", 0, id, xpWidgetClass_Button);
+    XPAddWidgetCallback(ButtonAddress::id, ButtonAddress::OnEvent);
+    // -- Latency Widgets --
+    // p50 and p99 of each histogram, then one bar per bin from 0.25 ms doubling up to 64 ms
+    XPCreateWidget(
+        10 - 2,
+        height - 145 + 3,
+        60,
+        height - 160,
+        1, "Clock", 0, id, xpWidgetClass_Caption);
+    LabelClock::id = XPCreateWidget(
+        60 - 2,
+        height - 145 + 3,
+        width - 10,
+        height - 160,
+        1, "Not synced", 0, id, xpWidgetClass_Caption);
+    LabelUplink::id = XPCreateWidget(
+        10 - 2,
+        height - 165 + 3,
+        width - 10,
+        height - 180,
+        1, "Up", 0, id, xpWidgetClass_Caption);
+    LabelUplinkJitter::id = XPCreateWidget(
+        10 - 2,
+        height - 185 + 3,
+        width - 10,
+        height - 200,
+        1, "Jitter", 0, id, xpWidgetClass_Caption);
+    LabelDownlink::id = XPCreateWidget(
+        10 - 2,
+        height - 205 + 3,
+        width - 10,
+        height - 220,
+        1, "Down", 0, id, xpWidgetClass_Caption);
+    LabelDownlinkJitter::id = XPCreateWidget(
+        10 - 2,
+        height - 225 + 3,
+        width - 10,
+        height - 240,
+        1, "Jitter", 0, id, xpWidgetClass_Caption);
+    // -- Link statistics Widgets --
+    // totals and errors, then the rate of each message type seen in the last second
+    LabelRx::id = XPCreateWidget(
+        10 - 2,
+        height - 245 + 3,
+        width - 10,
+        height - 260,
+        1, "Rx", 0, id, xpWidgetClass_Caption);
+    LabelRxTypes::id = XPCreateWidget(
+        10 - 2,
+        height - 265 + 3,
+        width - 10,
+        height - 280,
+        1, "", 0, id, xpWidgetClass_Caption);
+    LabelTx::id = XPCreateWidget(
+        10 - 2,
+        height - 285 + 3,
+        width - 10,
+        height - 300,
+        1, "Tx", 0, id, xpWidgetClass_Caption);
+    LabelTxTypes::id = XPCreateWidget(
+        10 - 2,
+        height - 305 + 3,
+        width - 10,
+        height - 320,
+        1, "", 0, id, xpWidgetClass_Caption);
 
     int screenWidth;
     int screenHeight;
@@ -198,16 +425,85 @@ int UI::Window::OnEvent(
 }
 
 
+// Labels are refreshed every second, only text that changed goes to X-Plane
+void UI::Window::SetLabel(XPWidgetID label, std::string_view text) {
+    char shown[LABEL_SIZE] = {};
+    XPGetWidgetDescriptor(label, shown, LABEL_SIZE - 1);
+    text = text.substr(0, LABEL_SIZE - 1);
+    if (text == shown) { return; }
+    text.copy(shown, text.size());
+    shown[text.size()] = 0;
+    XPSetWidgetDescriptor(label, shown);
+}
+
 void UI::OnSerialConnect(std::string port) {
     UI::Window::LabelSerialPort::SetText(port.c_str());
 }
 
 void UI::OnSerialDisconnect() {
     UI::Window::LabelSerialPort::SetText("Disconnected");
+    UI::Window::LabelLink::SetText("Link: 0%");
     UI::Window::LabelRemoteArmed::SetText("None");
     UI::Window::LabelAHRSCount::SetText("AHRS: 0 Hz");
+    UI::Window::LabelClock::SetText("Not synced");
+    UI::Window::LabelUplink::SetText("Up");
+    UI::Window::LabelUplinkJitter::SetText("Jitter");
+    UI::Window::LabelDownlink::SetText("Down");
+    UI::Window::LabelDownlinkJitter::SetText("Jitter");
+    UI::Window::LabelRx::SetText("Rx");
+    UI::Window::LabelRxTypes::SetText("");
+    UI::Window::LabelTx::SetText("Tx");
+    UI::Window::LabelTxTypes::SetText("");
 }
 
+int UI::Window::ButtonMultirate::OnEvent(XPWidgetMessage inMessage, XPWidgetID inWidget, intptr_t inParam1, intptr_t inParam2) {
+    if (inWidget != id) { return 0; }
+    switch (inMessage) {
+    case xpMsg_ButtonStateChanged:
+        Telemetry::SetMultirate(inParam2);
+        return 1;
+    default:
+        return 0;
+    }
+}
+int UI::Window::ButtonLowLatency::OnEvent(XPWidgetMessage inMessage, XPWidgetID inWidget, intptr_t inParam1, intptr_t inParam2) {
+    if (inWidget != id) { return 0; }
+    switch (inMessage) {
+    case xpMsg_ButtonStateChanged:
+        Serial::SetLowLatency(inParam2);
+        return 1;
+    default:
+        return 0;
+    }
+}
+int UI::Window::ButtonRecord::OnEvent(XPWidgetMessage inMessage, XPWidgetID inWidget, intptr_t inParam1, intptr_t inParam2) {
+    if (inWidget != id) { return 0; }
+    switch (inMessage) {
+    case xpMsg_ButtonStateChanged:
+        if (!inParam2) {
+            Recorder::Stop();
+        } else if (!Recorder::Start()) {
+            SetState(false);
+        }
+        return 1;
+    default:
+        return 0;
+    }
+}
+int UI::Window::ButtonCapture::OnEvent(XPWidgetMessage inMessage, XPWidgetID inWidget, intptr_t inParam1, intptr_t inParam2) {
+    if (inWidget != id) { return 0; }
+    switch (inMessage) {
+    case xpMsg_ButtonStateChanged:
+        if (!inParam2) {
+            Capture::Stop();
+        } else if (!Capture::Start()) {
+            SetState(false);
+        }
+        return 1;
+    default:
+        return 0;
+    }
+}
 int UI::Window::ButtonCalibration::OnEvent(XPWidgetMessage inMessage, XPWidgetID inWidget, intptr_t inParam1, intptr_t inParam2) {
     if (inWidget != id) { return 0; }
     switch (inMessage) {
@@ -261,4 +557,17 @@ int UI::Window::ButtonRemoteOverride::OnEvent(XPWidgetMessage inMessage, XPWidge
     default:
         return 0;
     }
+}
+int UI::Window::ButtonAddress::OnEvent(XPWidgetMessage inMessage, XPWidgetID inWidget, intptr_t inParam1, intptr_t inParam2) {
+    if (inWidget != id) { return 0; }
+    switch (inMessage) {
+    case xpMsg_PushButtonPressed: {
+        char address[256];
+        XPGetWidgetDescriptor(TextAddress::id, address, sizeof(address));
+        Serial::SetAddress(address);
+        return 1;
+    }
+    default:
+        return 0;
+    }
 }
\ No newline at end of file
@@ -1,7 +1,19 @@
 #pragma once
 #include <string>
+#include <string_view>
+#include <format>
+#include <utility>
+
+// Longest label text, anything past it is cut
+#define LABEL_SIZE 128
 
 namespace UI {
+    // Format label text into a caller buffer, the flight loops must not allocate
+    template<typename... Args>
+    std::string_view Format(char (&text)[LABEL_SIZE], std::format_string<Args...> format, Args &&...args) {
+        auto result = std::format_to_n(text, LABEL_SIZE, format, std::forward<Args>(args)...);
+        return { text, static_cast<size_t>(result.out - text) };
+    }
     void OnSerialConnect(std::string port);
     void OnSerialDisconnect();
     namespace Menu {
@@ -10,16 +22,58 @@ namespace UI {
     namespace Window {
         void Create();
         namespace LabelSerialPort {
-            void SetText(std::string text);
+            void SetText(std::string_view text);
+        }
+        namespace LabelLink {
+            void SetText(std::string_view text);
+        }
+        namespace ButtonLowLatency {
+            void SetState(bool state);
+        }
+        namespace ButtonRecord {
+            void SetState(bool state);
+        }
+        namespace ButtonCapture {
+            void SetState(bool state);
+        }
+        namespace TextAddress {
+            void SetText(std::string_view text);
         }
         namespace LabelCalibration {
-            void SetText(std::string text);
+            void SetText(std::string_view text);
         }
         namespace LabelRemoteArmed {
-            void SetText(std::string text);
+            void SetText(std::string_view text);
         }
         namespace LabelAHRSCount {
-            void SetText(std::string text);
+            void SetText(std::string_view text);
+        }
+        namespace LabelClock {
+            void SetText(std::string_view text);
+        }
+        namespace LabelUplink {
+            void SetText(std::string_view text);
+        }
+        namespace LabelUplinkJitter {
+            void SetText(std::string_view text);
+        }
+        namespace LabelDownlink {
+            void SetText(std::string_view text);
+        }
+        namespace LabelDownlinkJitter {
+            void SetText(std::string_view text);
+        }
+        namespace LabelRx {
+            void SetText(std::string_view text);
+        }
+        namespace LabelRxTypes {
+            void SetText(std::string_view text);
+        }
+        namespace LabelTx {
+            void SetText(std::string_view text);
+        }
+        namespace LabelTxTypes {
+            void SetText(std::string_view text);
         }
     }
 }
\ No newline at end of file
@@ -1,4 +1,5 @@
 #include <Eigen/Geometry>
+#include <chrono>
 #include "util.hpp"
 
 // https://mariogc.com/post/angular-velocity-quaternions/
@@ -20,4 +21,21 @@ Eigen::Quaternionf EulerToQuat(Eigen::Vector3f euler) {
         -cos(phi) * sin(theta) * sin(psi) + sin(phi) * cos(theta) * cos(psi),
         cos(phi) * cos(theta) * cos(psi) + sin(phi) * sin(theta) * sin(psi)
     };
-}
\ No newline at end of file
+}
+void GpsTime(int local_day, float local_seconds, float zulu_seconds, uint16_t &week, uint32_t &ms_tow) {
+    using namespace std::chrono;
+    // the sim only has the local date, it is a day off from UTC around midnight
+    int day = local_day;
+    if (local_seconds - zulu_seconds > 12 * 3600) {
+        day++;
+    } else if (zulu_seconds - local_seconds > 12 * 3600) {
+        day--;
+    }
+    year_month_day today = floor<days>(system_clock::now());
+    sys_days date = sys_days(today.year() / January / 1) + days(day);
+    sys_days gps_epoch = sys_days(year(1980) / January / 6);
+    int64_t ms = duration_cast<milliseconds>(date - gps_epoch).count() +
+        static_cast<int64_t>(zulu_seconds * 1000.0) + GPS_LEAP_SECONDS * 1000;
+    week = static_cast<uint16_t>(ms / (7 * 86400000LL));
+    ms_tow = static_cast<uint32_t>(ms % (7 * 86400000LL));
+}
@@ -1,12 +1,17 @@
 #pragma once
 #include <Eigen/Geometry>
 #include <numbers>
+#include <cstdint>
 
 #define m_to_cm 100.0f
 #define deg_to_rad std::numbers::pi_v<float> / 180.0f
 #define rad_to_deg 180.0f / std::numbers::pi_v<float>
 #define inhg_to_pa 3386.38867
 #define decimaldeg_to_deg 1.0e7
+// GPS time is ahead of UTC by the leap seconds since 1980
+#define GPS_LEAP_SECONDS 18
 
 Eigen::Vector3f angularVelocity(Eigen::Quaternionf q1, Eigen::Quaternionf q2, float dt);
-Eigen::Quaternionf EulerToQuat(Eigen::Vector3f euler);
\ No newline at end of file
+Eigen::Quaternionf EulerToQuat(Eigen::Vector3f euler);
+// GPS week and time of week from the sim date, which has no year so the current one is used
+void GpsTime(int local_day, float local_seconds, float zulu_seconds, uint16_t &week, uint32_t &ms_tow);